@@ -0,0 +1,137 @@
+// Times the protein overlap pass (getOverlap_cluster) over a range of hash cell sizes.
+//
+//   $ make bench
+//   $ bin/bench_cell_size pdbfiles/L-sub.pdb [more.pdb ...] [-s <query spacing>] [-d <diameter>] [-c <cutoff>]
+//
+// Queries are the lattice points of the allwaters grid box (pdb bounds padded by 5 A) at the query
+// spacing that have an atom within the cutoff, like the flood filled points the overlap pass sees.
+// Every cell size must give the same number of waters; the fastest one is marked. The last row is the
+// old layout for comparison: 3 A cells and only the 27 cells around the query, which misses atoms past
+// 3 A that the reach covers, so its waters may differ.
+
+#include "map.h"
+#include "pdbtovector.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> pdbFiles;
+    double querySpacing = 1.0;
+    double diameter = 2.5;
+    double cutoff = 5;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-s" && i + 1 < argc) querySpacing = std::stod(argv[++i]);
+        else if (arg == "-d" && i + 1 < argc) diameter = std::stod(argv[++i]);
+        else if (arg == "-c" && i + 1 < argc) cutoff = std::stod(argv[++i]);
+        else pdbFiles.push_back(arg);
+    }
+    if (pdbFiles.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <pdb> [<pdb> ...] [-s <query spacing>] [-d <diameter>] [-c <cutoff>]" << std::endl;
+        return 1;
+    }
+
+    for (const std::string& pdbFile : pdbFiles) {
+        auto parsed = pdbtovector(pdbFile);
+        std::vector<Atom>& atoms = std::get<0>(parsed);
+        if (atoms.empty()) {
+            std::cerr << "Error: No atoms in " << pdbFile << std::endl;
+            continue;
+        }
+
+        CellStencil automatic = makeOverlapStencil(atoms, diameter, cutoff);
+        double reach = automatic.reach;
+
+        // coarse cells for picking the queries only
+        std::unordered_map<GridKey, std::vector<int>> coarse = buildSpatialGrid(atoms, cutoff);
+        auto nearAtom = [&](const std::array<double, 3>& q) {
+            GridKey c = getGridKey_pos(q, cutoff);
+            for (int dz = -1; dz <= 1; dz++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        auto it = coarse.find({c.x + dx, c.y + dy, c.z + dz});
+                        if (it == coarse.end()) continue;
+                        for (int a : it->second) {
+                            std::array<double, 3> p = atoms[a].getCoords();
+                            double dX = q[0] - p[0], dY = q[1] - p[1], dZ = q[2] - p[2];
+                            if (dX*dX + dY*dY + dZ*dZ <= cutoff * cutoff) return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        };
+
+        std::vector<std::array<double, 3>> queries;
+        for (double z = std::floor(std::get<5>(parsed)) - 5; z <= std::ceil(std::get<6>(parsed)) + 5; z += querySpacing) {
+            for (double y = std::floor(std::get<3>(parsed)) - 5; y <= std::ceil(std::get<4>(parsed)) + 5; y += querySpacing) {
+                for (double x = std::floor(std::get<1>(parsed)) - 5; x <= std::ceil(std::get<2>(parsed)) + 5; x += querySpacing) {
+                    if (nearAtom({x, y, z})) queries.push_back({x, y, z});
+                }
+            }
+        }
+
+        printf("%s: %zu atoms, %zu queries, reach %.2f A\n", pdbFile.c_str(), atoms.size(), queries.size(), reach);
+        printf("  %9s %10s %8s %10s %10s %8s\n", "cell (A)", "cells/reach", "stencil", "build (ms)", "query (ms)", "waters");
+
+        std::vector<double> perReach = {0.25, 0.33, 0.5, 0.75, 1, 1.5, 2, 2.5, 3, 4};
+        std::vector<double> timings;
+        for (double k : perReach) {
+            auto t0 = std::chrono::steady_clock::now();
+            CellStencil stencil = makeOverlapStencil(atoms, diameter, cutoff, reach / k);
+            std::unordered_map<GridKey, std::vector<int>> grid = buildSpatialGrid(atoms, stencil.cellSize);
+            auto t1 = std::chrono::steady_clock::now();
+
+            size_t waters = 0;
+            for (const std::array<double, 3>& q : queries) {
+                if (getOverlap_cluster(grid, atoms, q, stencil, diameter, cutoff)) waters++;
+            }
+            auto t2 = std::chrono::steady_clock::now();
+
+            double buildMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            double queryMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+            timings.push_back(queryMs);
+            printf("  %9.3f %10.2f %8zu %10.1f %10.1f %8zu%s\n", stencil.cellSize, k, stencil.offsets.size(),
+                   buildMs, queryMs, waters, k == CELLS_PER_REACH ? "  (default)" : "");
+        }
+
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            CellStencil stencil = makeOverlapStencil(atoms, diameter, cutoff, 3);
+            CellStencil old = stencil;
+            old.offsets.clear();
+            old.minDistance.clear();
+            for (size_t k = 0; k < stencil.offsets.size(); k++) {
+                const GridKey& d = stencil.offsets[k];
+                if (std::abs(d.x) > 1 || std::abs(d.y) > 1 || std::abs(d.z) > 1) continue;
+                old.offsets.push_back(d);
+                old.minDistance.push_back(stencil.minDistance[k]);
+            }
+            std::unordered_map<GridKey, std::vector<int>> grid = buildSpatialGrid(atoms, old.cellSize);
+            auto t1 = std::chrono::steady_clock::now();
+
+            size_t waters = 0;
+            for (const std::array<double, 3>& q : queries) {
+                if (getOverlap_cluster(grid, atoms, q, old, diameter, cutoff)) waters++;
+            }
+            auto t2 = std::chrono::steady_clock::now();
+
+            printf("  %9.3f %10.2f %8zu %10.1f %10.1f %8zu  (old 3 A, 3x3x3)\n", old.cellSize, reach / old.cellSize,
+                   old.offsets.size(), std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                   std::chrono::duration<double, std::milli>(t2 - t1).count(), waters);
+        }
+
+        size_t best = 0;
+        for (size_t i = 1; i < timings.size(); i++) {
+            if (timings[i] < timings[best]) best = i;
+        }
+        printf("  fastest: %.3f A cells (%.2f per reach)\n\n", reach / perReach[best], perReach[best]);
+    }
+    return 0;
+}
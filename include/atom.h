@@ -36,7 +36,7 @@ class Atom {
 
     void set_radius(double new_radius);
 
-    double get_radius();
+    double get_radius() const;
 
     std::string get_resname() const;
 
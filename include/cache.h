@@ -0,0 +1,94 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "internals.h"
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// --- Content hashing (64-bit FNV-1a) ---
+
+const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = FNV_OFFSET);
+
+// Hashes the file contents (not its path or timestamp); a missing file hashes like an empty one
+uint64_t hashFile(const std::string& path, uint64_t seed = FNV_OFFSET);
+
+inline uint64_t hashValue(uint64_t seed, const std::string& value) {
+    // the length keeps "ab" + "c" apart from "a" + "bc"
+    uint64_t length = value.size();
+    return hashBytes(value.data(), value.size(), hashBytes(&length, sizeof(length), seed));
+}
+
+inline uint64_t hashValue(uint64_t seed, const char* value) {
+    return hashValue(seed, std::string(value));
+}
+
+template <typename T>
+uint64_t hashValue(uint64_t seed, const T& value) {
+    static_assert(std::is_arithmetic<T>::value, "hash plain numbers or strings");
+    return hashBytes(&value, sizeof(T), seed);
+}
+
+// Chains every value into the key, in order
+template <typename... Ts>
+uint64_t hashValues(uint64_t seed, const Ts&... values) {
+    ((seed = hashValue(seed, values)), ...);
+    return seed;
+}
+
+// --- Compact lattice encodings ---
+
+// Points of the classifier lattice (minBound + i * spacing, dims as in SeparateGridPoints) as one bit
+// per cell. Unpacking yields the points in z-major order, the order every classifier emits them in.
+std::vector<uint64_t> packLatticePoints(const std::vector<Vec3>& points, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing);
+std::vector<Vec3> unpackLatticePoints(const std::vector<uint64_t>& bits, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing);
+
+// Flood fill points as 32-bit FillInternalVoid lattice indices, keeping their BFS order.
+// Returns false when the lattice is too large for 32-bit indices.
+bool packFillIndices(const std::vector<Vec3>& points, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing, std::vector<uint32_t>& out);
+std::vector<Vec3> unpackFillIndices(const std::vector<uint32_t>& indices, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing);
+
+// --- Stage snapshots ---
+
+// Binary snapshots of stage outputs stored as <dir>/<stage>-<key>.bin.
+// Keys are content hashes of everything upstream of the stage, so a changed input or parameter
+// simply misses; there is nothing to invalidate. Files are written to a temporary name and
+// renamed, so an interrupted run never leaves a half-written snapshot behind.
+class StageCache {
+    std::string dir;
+    bool active;
+
+    std::string path(const std::string& stage, uint64_t key) const;
+    bool readBytes(const std::string& stage, uint64_t key, size_t elementSize, std::vector<char>& out) const;
+    void writeBytes(const std::string& stage, uint64_t key, size_t elementSize, const void* data, size_t count) const;
+
+    public:
+    StageCache(std::string init_dir, bool init_active) : dir(init_dir), active(init_active) {}
+
+    bool enabled() const { return active; }
+    bool has(const std::string& stage, uint64_t key) const;
+
+    template <typename T>
+    bool load(const std::string& stage, uint64_t key, std::vector<T>& out) const {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots hold plain data");
+        std::vector<char> bytes;
+        if (!readBytes(stage, key, sizeof(T), bytes)) return false;
+
+        out.resize(bytes.size() / sizeof(T));
+        if (!bytes.empty()) std::copy(bytes.begin(), bytes.end(), reinterpret_cast<char*>(out.data()));
+        return true;
+    }
+
+    template <typename T>
+    void store(const std::string& stage, uint64_t key, const std::vector<T>& values) const {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots hold plain data");
+        writeBytes(stage, key, sizeof(T), values.data(), values.size());
+    }
+};
+
+#endif
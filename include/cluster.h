@@ -11,11 +11,17 @@
 
 
 
+// Cluster id per atom (0-based, in discovery order); atoms within a diagonal grid step are connected.
+// If visitOrder is given it receives the atom indices in BFS order, cluster after cluster.
+std::vector<int> clusterLabels(const std::vector<Atom>& atoms, double grid_spacing, double map_spacing, std::vector<int>* visitOrder = nullptr);
+
 std::vector<std::vector<Atom>> clusterAtoms(const std::vector<Atom>& atoms, double grid_spacing, double map_spacing);
 
+// Writes <filename>.pdb<compression>; compression ".gz" or ".zst" compresses the file
 void writeClusteredPDB(const std::vector<std::vector<Atom>>& clusters, 
                        const std::string& filename, 
-                       const std::vector<std::string>& remarks = {});
+                       const std::vector<std::string>& remarks = {},
+                       const std::string& compression = "");
 
 std::vector<std::string> extractRemarks(const std::string& filename);
 
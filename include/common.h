@@ -15,4 +15,18 @@
     #define DEBUG_LOG(x) do { } while(0)
 #endif
 
-#endif
\ No newline at end of file
+// Scoped timeline spans, recorded per thread and written as Chrome trace-event JSON (make trace)
+#ifdef TRACE_MODE
+    #include "trace.h"
+    #define TRACE_CONCAT_(a, b) a##b
+    #define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+    #define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan_, __LINE__)(name)
+    #define TRACE_THREAD_NAME(name) traceThreadName(name)
+    #define TRACE_FILE(path) TraceFile TRACE_CONCAT(traceFile_, __LINE__)(path)
+#else
+    #define TRACE_SPAN(name) do { } while(0)
+    #define TRACE_THREAD_NAME(name) do { } while(0)
+    #define TRACE_FILE(path) do { } while(0)
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstdarg>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// Streams for gzip (.gz) and zstd (.zst) files, picked by the file extension; other paths are plain files.
+// gzip needs a build with HAVE_ZLIB and zstd one with HAVE_ZSTD; the Makefile sets each when its header is found.
+
+// --- Function Declarations ---
+
+// ".gz" or ".zst" when path ends in one of them, "" otherwise
+std::string compressionSuffix(const std::string& path);
+
+// path without its compression suffix, so x.pdb.gz is recognized as a pdb file
+std::string stripCompressionSuffix(const std::string& path);
+
+// Whether files with this suffix can be read and written by this build (always for ""); error gets the reason
+bool compressionAvailable(const std::string& suffix, std::string* error = nullptr);
+
+// Stream to read path from. Compressed files are decompressed on a thread of their own into a few 1 MB blocks
+// ahead of the reader, so inflating overlaps the caller's parsing. Returns nullptr (with the reason in error)
+// when the file cannot be opened or its format is not built in. A corrupt or truncated compressed file sets the
+// stream's badbit where the damage is reached, so readers must check bad() and not take it for the end of the file.
+std::unique_ptr<std::istream> openInputStream(const std::string& path, std::string* error = nullptr);
+
+// Writes path, decompressed, to the plain file target, for tools that only read plain text (categorize_water.py).
+// False (with the reason in error) when path cannot be read or is corrupt, or target cannot be written.
+bool decompressFile(const std::string& path, const std::string& target, std::string* error = nullptr);
+
+// Stream to write path to. Compressed output is gathered in 1 MB blocks: gzip blocks are deflated in parallel on
+// the shared pool as independent gzip members (concatenated members are one valid .gz, as pigz writes them) and
+// written in order; zstd uses the library's own worker threads. The file is complete once the stream is
+// destroyed or closeOutputStream returns. Returns nullptr (with the reason in error) like openInputStream.
+std::unique_ptr<std::ostream> openOutputStream(const std::string& path, std::string* error = nullptr);
+
+// Finishes the stream (the last block of a compressed one) and returns whether everything was written
+bool closeOutputStream(std::ostream& out);
+
+// fprintf for the writers that format fixed-column records
+void streamPrintf(std::ostream& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
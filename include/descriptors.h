@@ -0,0 +1,46 @@
+#ifndef DESCRIPTORS_H
+#define DESCRIPTORS_H
+
+#include "atom.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --- Data Structures ---
+
+struct FeatureSettings {
+    int neighbors = 10;         // k nearest protein atoms per site
+    double maxDistance = 30;    // atoms farther than this are never neighbors (pdb_input_processing.py widens its 15 A search to 30 A)
+    double cellSize = 4;        // cell size of the protein hash grid
+};
+
+// The k nearest protein atoms of every site, nearest first (ties by atom index). Slots past the atoms
+// within maxDistance are padding: zero geometry and types, atom -1.
+struct SiteFeatures {
+    size_t sites = 0;
+    int neighbors = 0;
+    std::vector<float> geometry;    // sites x k x 4: dx, dy, dz (atom - site), distance
+    std::vector<int32_t> types;     // sites x k x 2: atom type, residue type
+    std::vector<int32_t> atoms;     // sites x k: index of the atom in the protein
+};
+
+// --- Function Declarations ---
+
+// Type ids as numbered by atom_types / residue_types in categorize_water/pdb_input_processing.py,
+// 0 for names outside those tables (the script numbers them in order of appearance instead)
+int atomTypeId(const std::string& atomName);
+int residueTypeId(const std::string& resName);
+
+// Nearest atom search for every site in parallel, on a hash grid of the protein walked nearest cell
+// first; the walk stops once no unvisited cell can hold an atom closer than the current k-th.
+SiteFeatures extractFeatures(const std::vector<Atom>& protein, const std::vector<std::array<double, 3>>& sites,
+                             const FeatureSettings& settings);
+
+// Writes an array as a .npy file (format 1.0, C order), loadable with numpy.load without parsing.
+// descr is the numpy type string of the elements, e.g. "<f4" or "<i4".
+bool writeNpy(const std::string& path, const std::string& descr, const void* data, size_t elementSize,
+              const std::vector<size_t>& shape);
+
+#endif
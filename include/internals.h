@@ -13,6 +13,9 @@
 #include <algorithm>
 #include <cstdio>
 #include <cfloat>
+#include <cstdint>
+#include <limits>
+#include <functional>
 
 
 
@@ -47,91 +50,31 @@ struct GridCellInfo {
     int closestVertexIndex = -1;
 };
 
-// struct CellVotes {
-//     int indices[3];
-//     float dists[3];
-//     int count; // How many valid candidates we have found so far (0, 1, 2, or 3)
-
-//     CellVotes() {
-//         count = 0;
-//         for(int i=0; i<3; i++) {
-//             indices[i] = -1;
-//             dists[i] = FLT_MAX;
-//         }
-//     }
-
-//     // Smart Insert: Keeps the array sorted (Smallest distance at [0])
-//     // This eliminates the need for std::sort later
-//     void insert(int index, float dist) {
-//         // If dist is worse than our worst candidate, ignore it
-//         if (count == 3 && dist >= dists[2]) return;
-
-//         // Find insertion point
-//         int i;
-//         for (i = count - 1; i >= 0; i--) {
-//             if (dists[i] > dist) {
-//                 if (i + 1 < 3) { // Shift down
-//                     dists[i + 1] = dists[i];
-//                     indices[i + 1] = indices[i];
-//                 }
-//             } else {
-//                 break;
-//             }
-//         }
-        
-//         // Insert at the correct spot
-//         if (i + 1 < 3) {
-//             dists[i + 1] = dist;
-//             indices[i + 1] = index;
-//             if (count < 3) count++;
-//         }
-//     }
-// };
-
-struct CellVotes {
-    int indices[3];    // Index into surfaceVertices
-    float distSq[3];   // Squared distance to that vertex
-    int count;         // How many valid candidates found (0-3)
-
-    CellVotes() {
-        count = 0;
-        for(int i=0; i<3; i++) {
-            indices[i] = -1;
-            distSq[i] = FLT_MAX;
-        }
-    }
-
-    // Smart Insert: Keeps the array sorted (Smallest distance at [0])
-    void insert(int index, float d2) {
-        // Optimization: If full and new point is worse than worst, skip immediately
-        if (count == 3 && d2 >= distSq[2]) return;
-
-        // Find insertion point (Linear scan is fastest for N=3)
-        int i;
-        for (i = count - 1; i >= 0; i--) {
-            if (distSq[i] > d2) {
-                if (i + 1 < 3) { // Shift down
-                    distSq[i + 1] = distSq[i];
-                    indices[i + 1] = indices[i];
-                }
-            } else {
-                break;
-            }
-        }
-        
-        // Insert at the correct spot
-        if (i + 1 < 3) {
-            distSq[i + 1] = d2;
-            indices[i + 1] = index;
-            if (count < 3) count++;
-        }
-    }
-};
+// Candidates kept per narrow band cell by SeparateGridPointsVote
+const int VOTE_CANDIDATES = 3;
 
 // --- Function Declarations ---
 
 std::vector<Vertex> vert_to_vector(std::string vert_file);
 
+// Grid index <-> lattice point helpers (64-bit so large boxes at fine spacing do not overflow)
+int64_t vectoIndex(Vec3 vector, int dimX, int dimY, int dimZ, Vec3 minBound, double spacing);
+Vec3 indextoVec3(int64_t index, int dimX, int dimY, int dimZ, Vec3 minBound, double spacing);
+
+// Phase 1 of SeparateGridPoints restricted to the z slices [zBegin, zEnd).
+// `grid` holds (zEnd - zBegin) * dimX * dimY cells, slice zBegin first.
+void ScatterNearestVertex(
+    const std::vector<Vertex>& surfaceVertices,
+    Vec3 minBound,
+    int dimX,
+    int dimY,
+    int zBegin,
+    int zEnd,
+    float spacing,
+    float searchRadius,
+    std::vector<GridCellInfo>& grid
+);
+
 void SeparateGridPoints(
     const std::vector<Vertex>& surfaceVertices,
     Vec3 minBound,
@@ -142,6 +85,22 @@ void SeparateGridPoints(
     std::vector<Vec3>& outOutside  // Output Vector 2
 );
 
+// SeparateGridPoints by inverse squared distance weighted voting of the VOTE_CANDIDATES nearest
+// vertices instead of the nearest one alone, which holds up better where vertices are sparse.
+// Candidates are stored only for the narrow band (cells within searchRadius of a vertex): the band is
+// a bitset with a running count per word, so a band cell finds its slots with one popcount, and the
+// candidates live in flat index/distance arrays, k slots per band cell. Same outputs and point order
+// as SeparateGridPoints.
+void SeparateGridPointsVote(
+    const std::vector<Vertex>& surfaceVertices,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float searchRadius,
+    std::vector<Vec3>& outInside,
+    std::vector<Vec3>& outOutside
+);
+
 void FillInternalVoid(
     const std::vector<Vec3>& shellPoints,
     const std::vector<Vec3>& initialInsidePoints,
@@ -149,11 +108,28 @@ void FillInternalVoid(
     Vec3 maxBound,
     float spacing,
     std::vector<Vec3>& allPoints,
-    std::vector<std::vector<Vec3>>& layers
+    std::vector<uint16_t>* burialDepth = nullptr  // optional: per lattice cell, see below
 );
 
+// Burial depth of a FillInternalVoid lattice cell: BFS steps from the shell, 1 for the seeds
+// (initial inside points), saturating at 65535; 0 for cells the fill never reached
+const uint16_t BURIAL_UNFILLED = 0;
+
 void WriteWaterPDB(const std::vector<Vec3>& waterPositions, const std::string& filename);
 
+// Writes a scalar field over the lattice minBound + i * spacing (index as vectoIndex) as an
+// OpenDX map cropped to the cells where value() is nonzero
+bool WriteDXMap(
+    const std::string& filename,
+    const std::string& title,
+    int dimX,
+    int dimY,
+    int dimZ,
+    Vec3 minBound,
+    double spacing,
+    const std::function<double(size_t)>& value
+);
+
 
 
 #endif // GRID_PROCESSOR_H
\ No newline at end of file
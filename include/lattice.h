@@ -0,0 +1,54 @@
+#ifndef LATTICE_H
+#define LATTICE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The global lattice waters live on: multiples of the flood fill step in absolute coordinates. The fill
+// starts at the grid box corner, which is on whole Angstroms (or, with --lattice, on multiples of
+// latticeStep), so the waters of any two runs either coincide exactly or are a step apart.
+const double LATTICE_SPACING = 0.25;
+
+// --- Data Structures ---
+
+// A set of lattice points as a sparse bitset: 64 consecutive x indices per word, one word per (z, y, x / 64)
+// that holds any point, words sorted by that key. Set operations are merges with one AND/OR per word.
+struct LatticeSet {
+    struct Word {
+        int32_t z, y, x;    // x is the lattice x index / 64 (rounded down)
+        uint32_t reserved;  // always 0, keeps the struct free of padding
+        uint64_t bits;      // bit b is lattice x index x * 64 + b
+    };
+    std::vector<Word> words;
+
+    size_t count() const;
+};
+
+enum class LatticeOp { UNION, INTERSECTION, DIFFERENCE };
+
+// --- Function Declarations ---
+
+// Smallest multiple of spacing that is also a multiple of unit. With the grid spacing and LATTICE_SPACING, a
+// grid box corner on multiples of it puts both the classifier lattice and the fill lattice on global lattices.
+// Returns 0 when there is none up to 1000 steps.
+double latticeStep(double spacing, double unit = LATTICE_SPACING);
+
+// Builds the set of the given points. Returns false with a message in error when a point is off the lattice.
+bool makeLatticeSet(const std::vector<std::array<double, 3>>& points, LatticeSet& set, std::string& error);
+
+// Points of the set, in (z, y, x) order
+std::vector<std::array<double, 3>> latticePoints(const LatticeSet& set);
+
+// a OP b; DIFFERENCE keeps the points of a that are not in b
+LatticeSet combineLatticeSets(const LatticeSet& a, const LatticeSet& b, LatticeOp op);
+
+// <filename> holds a header (magic AWL1, version, spacing, word count) and the words, all little-endian
+bool writeLatticeSet(const LatticeSet& set, const std::string& filename);
+
+// Returns false with a message in error when the file is missing, truncated, of another spacing or has its
+// words out of order
+bool readLatticeSet(const std::string& filename, LatticeSet& set, std::string& error);
+
+#endif
@@ -7,6 +7,7 @@
 #include <cmath>
 #include <iostream>
 #include <array>
+#include <cstdint>
 
 #include "atom.h"
 
@@ -34,6 +35,28 @@ namespace std {
     };
 }
 
+// Neighbor cells of a uniform hash grid for queries out to `reach`: every cell offset that can hold a
+// point within reach of some point of the center cell, nearest first, so a scan can stop early
+struct CellStencil {
+    double cellSize = 3;
+    double reach = 0;
+    double collisionReach = 0;        // getOverlap_cluster: no atom past this can clash with the water
+    std::vector<GridKey> offsets;
+    std::vector<double> minDistance;  // closest a point of the offset cell can be to the center cell
+};
+
+// Cells per reach the automatic cell size aims for (cellSize = reach / this). bin/bench_cell_size
+// (make bench, 0.25 to 4 per reach) on L-sub and 8OM1: 0.5 per reach (10 A cells) is fastest, 1.5 to 2x
+// faster than 1 per reach and 2 to 4x faster than the old 3 A cells. Smaller cells spend more on hash
+// lookups than they save in distance tests; at 0.25 the cells hold too many atoms that are out of reach
+const double CELLS_PER_REACH = 0.5;
+
+CellStencil makeCellStencil(double cellSize, double reach);
+
+// Stencil for getOverlap_cluster on these atoms: the reach covers the cutoff and the largest clash
+// distance (water radius + radius_aa). cellSize <= 0 picks reach / CELLS_PER_REACH
+CellStencil makeOverlapStencil(const std::vector<Atom>& atoms, double diameter, double cutoff_dist, double cellSize = 0);
+
 GridKey getGridKey(const Atom& input_Atom, double gridCellSize);
 
 GridKey getGridKey_pos(const std::array<double, 3> pos, double gridCellSize);
@@ -44,7 +67,22 @@ buildSpatialGrid(std::vector<Atom> objects, double gridCellSize);
 
 void printSpatialGrid(const std::unordered_map<GridKey, std::vector<int>>& grid);
 
-bool getOverlap_cluster(const std::unordered_map<GridKey, std::vector<int>>& grid, std::vector<Atom>& atomvector, std::array<double,3> target, double gridCellSize, double diameter, double cutoff_dist);
+// Hydrophobic environment of a water site, gathered by getOverlap_cluster from the atoms it visits
+struct SiteEnvironment {
+    float hydrophobicity = 0;   // sum over atoms within the cutoff of hc * (1 - distance / cutoff)
+    int32_t contacts = 0;       // atoms within the cutoff
+};
+
+// Hydrophobicity column (1986, 1989 or 1998 from AtomicRadii) of every atom, in atom order.
+// Returns an empty vector for any other scale.
+std::vector<double> getHydrophobicity(const std::vector<Atom>& atoms, int scale);
+
+// True when a water at target clashes with no atom and has one within cutoff_dist. The grid must be
+// built with stencil.cellSize and the stencil made by makeOverlapStencil for the same diameter/cutoff.
+// With an environment (and the per atom hydrophobicity) the scan does not stop at the first neighbor
+// but covers the whole cutoff, filling the environment of an accepted site in the same pass.
+bool getOverlap_cluster(const std::unordered_map<GridKey, std::vector<int>>& grid, std::vector<Atom>& atomvector, std::array<double,3> target, const CellStencil& stencil, double diameter, double cutoff_dist,
+                        const std::vector<double>* hydrophobicity = nullptr, SiteEnvironment* environment = nullptr);
 
 void testGrid();
 
@@ -0,0 +1,60 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "internals.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+// --- Data Structures ---
+
+struct BVHNode {
+    Vec3 boxMin;
+    Vec3 boxMax;
+    int left = -1;      // child node indices, -1 for leaves
+    int right = -1;
+    int first = 0;      // leaves: range into the triangle order array
+    int count = 0;
+};
+
+// Bounding volume hierarchy over a triangle mesh, specialized for axis-aligned line queries
+class MeshBVH {
+    std::vector<Vec3> vertices;
+    std::vector<std::array<int, 3>> faces;
+    std::vector<int> order;
+    std::vector<BVHNode> nodes;
+
+    int build(int first, int count);
+
+    public:
+    MeshBVH(const std::vector<Vertex>& surfaceVertices, const std::vector<std::array<int, 3>>& surfaceFaces);
+
+    // Collects the coordinate along `axis` (0 = x, 1 = y, 2 = z) of every triangle crossing of the
+    // infinite line through `origin` parallel to that axis. Results are appended unsorted.
+    void lineCrossings(Vec3 origin, int axis, std::vector<float>& outCrossings) const;
+
+    size_t triangleCount() const;
+};
+
+// --- Function Declarations ---
+
+// Reads an MSMS .face file (3 header lines, then 1-based "v1 v2 v3 type sphere") into 0-based triangles
+std::vector<std::array<int, 3>> face_to_vector(std::string face_file);
+
+// Mesh-based alternative to SeparateGridPoints.
+// Cells within searchRadius of a surface vertex are classified by the parity of surface crossings
+// of the lines through them along x, y and z (majority vote of the three). Every lattice row is
+// answered by a single BVH query, and rows are processed in parallel.
+void SeparateGridPointsMesh(
+    const std::vector<Vertex>& surfaceVertices,
+    const std::vector<std::array<int, 3>>& surfaceFaces,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float searchRadius,
+    std::vector<Vec3>& outInside,
+    std::vector<Vec3>& outOutside
+);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef MMCIF_H
+#define MMCIF_H
+
+#include "atom.h"
+
+#include <string>
+#include <vector>
+
+// --- Data Structures ---
+
+// What an _atom_site row carries beyond the Atom itself (auth_asym_id, auth_seq_id, pdbx_PDB_model_num,
+// falling back to the label_ columns), for residue selections and multi-model files
+struct AtomSiteIdentity {
+    std::string chain;
+    int seq = 0;
+    int model = 1;
+};
+
+// --- Function Declarations ---
+
+// .cif and .mmcif files (any case, also with .gz or .zst after it) are read as mmCIF, everything else as PDB
+bool isCIFFile(const std::string& filename);
+
+// Reads the _atom_site loop of an mmCIF file into Atoms (comp and atom ids, Cartn_x/y/z, B_iso_or_equiv;
+// radius from the atomic radii table), in file order, like pdbtovector reads ATOM/HETATM records.
+// No CIF document is built: the file is mapped and split into chunks at line starts, chunks are parsed in
+// parallel with one row per line, and rows that span lines or text fields fall back to a serial token
+// scan. identities, when given, receives one entry per atom. Returns no atoms (with a message on
+// std::cerr) when the file cannot be read or has no _atom_site coordinates.
+std::vector<Atom> readAtomSiteCIF(const std::string& filename, std::vector<AtomSiteIdentity>* identities = nullptr);
+
+// writeClusteredPDB's output as mmCIF (<filename>.cif): one _atom_site row per atom with the cluster
+// rank + 1 as auth_seq_id and serials counting up, neither wrapped, so cluster identity survives any
+// number of clusters. Remarks go to _pdbx_database_remark. Rows are formatted into a buffer and
+// written in blocks. compression (".gz" or ".zst") is appended to the file name and compresses the file.
+// Returns false when the file cannot be written.
+bool writeClusteredCIF(const std::vector<std::vector<Atom>>& clusters,
+                       const std::string& filename,
+                       const std::vector<std::string>& remarks = {},
+                       const std::string& compression = "");
+
+// The same categories as BinaryCIF (<filename>.bcif, MessagePack, format 0.3.0), every column encoded:
+// coordinates and b-factors as fixed point, integer columns delta and/or run-length coded, and all
+// of them packed into the fewest bytes per value (IntegerPacking); constant string columns collapse
+// to one run. Readable by Mol* and other BinaryCIF readers.
+bool writeClusteredBCIF(const std::vector<std::vector<Atom>>& clusters,
+                        const std::string& filename,
+                        const std::vector<std::string>& remarks = {},
+                        const std::string& compression = "");
+
+#endif
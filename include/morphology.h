@@ -0,0 +1,38 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include "atom.h"
+#include "internals.h"
+
+#include <cstdint>
+#include <vector>
+
+// Squared Euclidean distance (in voxels^2) from every cell to the nearest cell where mask == 1.
+// Separable exact transform (Felzenszwalb & Huttenlocher), linear in the number of cells.
+// Pass parallel = false when the caller already runs one transform per worker.
+std::vector<float> squaredDistanceTransform(const std::vector<uint8_t>& mask, int dimX, int dimY, int dimZ, bool parallel = true);
+
+// Surface-free alternative to SeparateGridPoints.
+// Builds the solvent excluded region directly on the voxel lattice (rasterize atom spheres,
+// dilate by the probe radius, erode back), then returns the cells within searchRadius of its
+// boundary split into inside/outside exactly like SeparateGridPoints, ready to seed FillInternalVoid.
+//
+// Buried cavities (solvent cells not connected to the box border) are treated as interior,
+// matching the external-only MSMS surfaces used by the vertex classifier.
+//
+// If outSurface is given, boundary cells thinned to roughly `density` points per A^2 are written
+// to it with outward normals, so the python helpers still have a surface to read.
+void SeparateGridPointsMorphology(
+    const std::vector<Atom>& atoms,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float probeRadius,
+    float searchRadius,
+    std::vector<Vec3>& outInside,
+    std::vector<Vec3>& outOutside,
+    std::vector<Vertex>* outSurface = nullptr,
+    float density = 1.0f
+);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Cell edge (A) gridpoints are ordered by: bricks of 4x4x4 points at the default 0.25 A spacing
+const double MORTON_POINT_CELL = 1.0;
+
+// --- Function Declarations ---
+
+// Interleaves the low 21 bits of x, y and z (x lowest): cells close in space get close codes
+uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z);
+
+// Z-order (Morton) visiting order of items: position(item) -> std::array<double, 3> is quantized to
+// cellSize cells of the items' bounding box, and order[k] is the index of the k-th item along the
+// curve. Items sharing a cell keep their relative order, so the result is deterministic.
+template <typename T, typename Position>
+std::vector<uint32_t> mortonOrder(const std::vector<T>& items, double cellSize, Position position) {
+    std::vector<uint32_t> order(items.size());
+    if (items.empty()) return order;
+
+    std::array<double, 3> lo = position(items[0]);
+    for (const T& item : items) {
+        std::array<double, 3> p = position(item);
+        for (int axis = 0; axis < 3; axis++) lo[axis] = std::min(lo[axis], p[axis]);
+    }
+
+    std::vector<std::pair<uint64_t, uint32_t>> keys(items.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        std::array<double, 3> p = position(items[i]);
+        uint32_t cell[3];
+        for (int axis = 0; axis < 3; axis++) {
+            cell[axis] = (uint32_t)std::min(std::floor((p[axis] - lo[axis]) / cellSize), (double)((1 << 21) - 1));
+        }
+        keys[i] = {mortonCode(cell[0], cell[1], cell[2]), (uint32_t)i};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for (size_t k = 0; k < keys.size(); k++) {
+        order[k] = keys[k].second;
+    }
+    return order;
+}
+
+// Rearranges values into the given order (values[k] becomes the old values[order[k]])
+template <typename T>
+void applyOrder(std::vector<T>& values, const std::vector<uint32_t>& order) {
+    std::vector<T> reordered;
+    reordered.reserve(values.size());
+    for (uint32_t i : order) {
+        reordered.push_back(std::move(values[i]));
+    }
+    values = std::move(reordered);
+}
+
+#endif
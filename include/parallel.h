@@ -0,0 +1,174 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Number of worker threads used by the parallel kernels.
+// 0 means "use std::thread::hardware_concurrency()".
+inline unsigned int g_thread_count = 0;
+
+inline unsigned int getThreadCount() {
+    if (g_thread_count > 0) return g_thread_count;
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw > 0 ? hw : 1;
+}
+
+// --- Data Structures ---
+
+// The work-stealing pool every parallel kernel and stage graph shares. It is started on first use with
+// getThreadCount() - 1 workers (the thread that waits is the last one), and setThreadCount resizes it. Each worker pushes and pops
+// its own tasks at the back of its deque and steals from the front of the others' when it runs dry;
+// tasks submitted from outside the pool go to a shared deque the workers steal from as well.
+class ThreadPool {
+    public:
+    using Task = std::function<void()>;
+
+    static ThreadPool& instance();
+
+    void submit(Task task);
+
+    // Runs one queued task on the calling thread; false when every deque was empty
+    bool runOne();
+
+    // Runs queued tasks on the calling thread until done() holds, sleeping while there are none.
+    // Waiting this way (instead of blocking) is what lets tasks wait for tasks they submitted.
+    void helpUntil(const std::function<bool()>& done);
+
+    // Wakes the threads in helpUntil to check their condition again
+    void notify();
+
+    unsigned int workerCount() const { return (unsigned int)workers.size(); }
+
+    // Stops the workers and starts workerCount new ones. Only call it while no tasks are queued or running.
+    void resize(unsigned int workerCount);
+
+    ~ThreadPool();
+
+    private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    explicit ThreadPool(unsigned int workerCount);
+    void startWorkers(unsigned int workerCount);
+    void stopWorkers();
+    bool take(size_t own, Task& task);
+    void workerLoop(size_t index);
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;   // [0] for outside threads, [i + 1] for worker i
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+// Tasks that are waited for together. wait() returns once all of them finished and rethrows the first
+// exception one of them threw.
+class TaskGroup {
+    public:
+    void run(std::function<void()> task);
+
+    // Runs a task on the calling thread, with its exception kept like a submitted task's
+    void runHere(const std::function<void()>& task);
+
+    void wait();
+
+    private:
+    void fail();
+
+    std::atomic<size_t> pending{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+// Stages of a pipeline and the stages each one needs first. run() starts every stage whose
+// dependencies finished on the shared pool, so independent stages overlap; the stages themselves may
+// use parallelFor. When a stage throws, the stages after it are skipped and run() rethrows.
+class TaskGraph {
+    public:
+    using Stage = size_t;
+
+    Stage add(const std::string& name, std::function<void()> work, const std::vector<Stage>& after = {});
+
+    void run();
+
+    private:
+    struct Node {
+        std::string name;
+        std::function<void()> work;
+        std::vector<Stage> next;
+        size_t waitingFor = 0;
+    };
+
+    void start(Stage stage, TaskGroup& group, std::vector<std::atomic<size_t>>& waiting);
+
+    std::vector<Node> nodes;
+    std::atomic<bool> failed{false};
+};
+
+// --- Function Declarations ---
+
+// Sets the thread count (0 for one per core) and resizes the pool if it already started; call it between
+// parallel runs, never from a task
+void setThreadCount(unsigned int n);
+
+// Writes one line to std::cout under a lock, so the stages of a TaskGraph do not interleave their output
+void logLine(const std::string& line);
+
+// How many chunks parallelFor will split `count` items into.
+// Callers use this to size per-chunk output buffers before the loop.
+inline unsigned int parallelChunkCount(size_t count) {
+    if (count == 0) return 0;
+    return (unsigned int)std::min<size_t>(getThreadCount(), count);
+}
+
+// Splits [0, count) into contiguous chunks and runs fn(begin, end, chunk) on each.
+// Chunks are deterministic for a given thread count, so concatenating per-chunk
+// results in chunk order reproduces the serial ordering.
+template <typename Fn>
+void parallelFor(size_t count, Fn fn) {
+    unsigned int chunks = parallelChunkCount(count);
+    if (chunks == 0) return;
+
+    if (chunks == 1) {
+        fn((size_t)0, count, 0u);
+        return;
+    }
+
+    size_t per_chunk = (count + chunks - 1) / chunks;
+
+    TaskGroup group;
+    for (unsigned int c = 1; c < chunks; c++) {
+        size_t begin = c * per_chunk;
+        size_t end = std::min(count, begin + per_chunk);
+        if (begin >= end) break;
+        group.run([=, &fn]() {
+            TRACE_SPAN("parallelFor chunk");
+            fn(begin, end, c);
+        });
+    }
+
+    // the calling thread takes the first chunk, then helps with the rest
+    group.runHere([&]() {
+        TRACE_SPAN("parallelFor chunk");
+        fn((size_t)0, std::min(count, per_chunk), 0u);
+    });
+    group.wait();
+}
+
+#endif
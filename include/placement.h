@@ -0,0 +1,28 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "atom.h"
+
+#include <vector>
+
+// --- Data Structures ---
+
+struct PlacementSettings {
+    double minDistance = 2.5;       // closest two sites may be (one water diameter)
+    double contactDistance = 4.0;   // protein atoms within this of a candidate count as its contacts
+};
+
+// --- Function Declarations ---
+
+// Picks a maximal set of candidate points at least minDistance apart. Conflicts are checked on a cell
+// list of minDistance cells. Space is cut into blocks of 4x4x4 cells colored by the parity of their block
+// coordinates; blocks of one color are a block apart, so they are filled in parallel, color after color.
+// The contact preference is per block: within a block, candidates with more protein contacts are tried
+// first (ties keep the candidate order), but a site placed in an earlier color can exclude a neighbor
+// with more contacts just across the block border. Every rejected candidate is within minDistance of a
+// site, and the result does not depend on the thread count. Sites are returned in candidate order; chosenIndices, when given, receives their
+// candidate indices.
+std::vector<Atom> placeWaterSites(const std::vector<Atom>& candidates, const std::vector<Atom>& protein,
+                                  const PlacementSettings& settings, std::vector<size_t>* chosenIndices = nullptr);
+
+#endif
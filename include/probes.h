@@ -0,0 +1,49 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include "atom.h"
+#include "internals.h"
+#include "map.h"
+
+#include <string>
+#include <vector>
+
+// --- Data Structures ---
+
+// Clearance of every flood-filled point: the smallest surface-to-surface gap (distance - radius_aa) to
+// a protein atom, and whether any atom center is within the cutoff. getOverlap_cluster keeps a water of
+// diameter d exactly where clearance > d / 2 and nearProtein holds, so one field answers every probe.
+struct ClearanceField {
+    std::vector<float> clearance;     // exact between floor and the largest probe radius, +inf past the collision reach
+    std::vector<uint8_t> nearProtein;
+};
+
+// Cavity sets of a probe sweep, smallest probe first. A point a larger probe fits also fits every smaller
+// one, so each cluster of probe k lies inside exactly one cluster of probe k - 1: parents[k][c] is its
+// index there (-1 for the smallest probe). Clusters are ordered largest first, as clusterAtoms does.
+struct ProbeSweep {
+    std::vector<double> diameters;
+    std::vector<std::vector<std::vector<Atom>>> clusters;
+    std::vector<std::vector<int>> parents;
+};
+
+// --- Function Declarations ---
+
+// Clearance of each point against the atoms in grid. The grid must be built with stencil.cellSize and the
+// stencil made by makeOverlapStencil for the largest probe diameter of the sweep. A point's scan ends once
+// its clearance is at most floor (the smallest probe radius: no probe fits there). Points run in parallel.
+ClearanceField computeClearance(const std::unordered_map<GridKey, std::vector<int>>& grid, const std::vector<Atom>& atoms,
+                                const std::vector<Vec3>& points, const CellStencil& stencil, double cutoff_dist, double floor);
+
+// Thresholds the field at each diameter and clusters the survivors like the final output (points within a
+// diagonal grid_spacing step are connected). The points must lie on a lattice of the given spacing, as the
+// flood fill does; they are connected through lattice offsets, since dense fills overwhelm clusterLabels' cells.
+ProbeSweep sweepProbes(const std::vector<Vec3>& points, const ClearanceField& field, std::vector<double> diameters,
+                       double lattice, double grid_spacing);
+
+// Writes <output_file>_probe_<d>.pdb<compression> per probe (one residue per cluster) and <output_file>_probes.csv
+// with each cluster's size, centroid and containing cluster at the next smaller probe
+bool writeProbeSweep(const ProbeSweep& sweep, const std::string& output_file, const std::vector<std::string>& remarks,
+                     const std::string& compression = "");
+
+#endif
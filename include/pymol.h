@@ -9,6 +9,7 @@
 #include <chrono>
 
 
-void createPyMOLSession(const std::string& pdb_file, const std::string& session_name, const std::string& structure_file = "");
+void createPyMOLSession(const std::string& pdb_file, const std::string& session_name, const std::string& structure_file = "",
+                        const std::string& extension = ".pdb");
 
 #endif
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include "internals.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+// --- Data Structures ---
+
+// The part of the structure a run is restricted to (--roi, or the atoms --parent finds changed):
+//   box:x0,y0,z0,x1,y1,z1    an axis-aligned box
+//   sphere:x,y,z,r           a sphere
+//   sel:TERM[,TERM...]       everything within `radius` of the selected atoms; a term is a residue name
+//                            (HEM, 1PE), a residue number or range (101, 101-110) or either one on a chain (A:101-110,
+//                            A:HEM; mmCIF chain ids may be longer than one character). A term that is not a whole
+//                            number or range is a residue name
+struct Region {
+    enum Kind { NONE, BOX, SPHERE, SELECTION };
+    Kind kind = NONE;
+    Vec3 lo = {0, 0, 0}, hi = {0, 0, 0};           // bounds of the region itself
+    std::array<double, 3> center = {0, 0, 0};     // sphere
+    double radius = 0;                             // sphere, or the distance around a selection
+    std::vector<std::array<double, 3>> selected;   // selection atoms
+
+    // selection atoms counting-sorted into cells at least radius wide (CSR), so contains scans 3x3x3 cells
+    double cellSize = 1.0;
+    std::array<int, 3> cellDims = {0, 0, 0};
+    std::vector<int> cellStart;
+    std::vector<int> cellAtoms;
+
+    bool active() const { return kind != NONE; }
+    bool contains(const std::array<double, 3>& p) const;
+};
+
+// --- Function Declarations ---
+
+// Parses an --roi spec; selections are resolved against the ATOM/HETATM records of pdbFile (the _atom_site
+// rows of an mmCIF file).
+// Returns false with a message in error when the spec is malformed or selects nothing.
+bool parseRegion(const std::string& spec, const std::string& pdbFile, double selectionRadius, Region& region, std::string& error);
+
+// Selection of the atoms that differ between a parent structure and a variant of it (point mutants): the
+// variant's atoms the parent lacks and the parent's atoms the variant lacks, compared by residue name,
+// atom name and coordinates. Returns false with a message in error when nothing differs.
+bool changedAtomsRegion(const std::string& parentFile, const std::string& variantFile, double selectionRadius, Region& region, std::string& error);
+
+// Clamps the grid box [minBound, maxBound] to the region grown by margin, on multiples of step (whole Angstroms
+// by default) so the lattice points stay those of the full box. Returns false when nothing of the box is left.
+bool clampToRegion(const Region& region, double margin, Vec3& minBound, Vec3& maxBound, double step = 1);
+
+// Drops the points outside the region, keeping the order of the rest; the points are tested in parallel
+void keepInRegion(const Region& region, std::vector<Vec3>& points);
+
+#endif
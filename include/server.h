@@ -0,0 +1,75 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "atom.h"
+#include "internals.h"
+#include "map.h"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// --- Data Structures ---
+
+struct PointQuery {
+    bool inside = false;       // cell was reached by the flood fill (buried region)
+    bool water = false;        // a water survived the overlap pass at this cell
+    int cluster = -1;          // cluster rank (0 = largest) of that water
+    double clearance = 0.0;    // distance to the nearest atom surface (radius_aa), negative inside an atom
+};
+
+// Everything a run computed, kept resident for point lookups.
+// Cells use the FillInternalVoid lattice, so query points are snapped to the nearest grid point.
+class QueryServer {
+    std::vector<Atom>& atoms;
+    double hashSpacing;
+    std::vector<double> atomRadii;
+    double maxAtomRadius = 0.0;
+
+    // dense atom cells (CSR) over the occupied hash cell box, faster than the hash grid for ring scans
+    GridKey keyMin = {0, 0, 0};
+    GridKey keyMax = {-1, -1, -1};
+    std::vector<int> cellStart;
+    std::vector<int> cellAtoms;
+
+    Vec3 minBound;
+    float spacing;
+    int dimX, dimY, dimZ;
+    std::vector<uint8_t> cells;                       // CELL_FILLED | CELL_WATER flags, empty when sparse
+    bool sparseCells = false;                         // the box exceeds the memory budget: filled cells listed instead
+    std::vector<int64_t> filledCells;                 // sparse: filled cell indices, sorted by setWaters
+    std::unordered_map<int64_t, int32_t> waterCluster;
+    size_t clusterCount = 0;
+
+    double clearance(const Vec3& p) const;
+    std::string handleLine(const std::string& line, int& control) const;
+
+    public:
+    // maxMemoryBytes (--max-memory, 0 = none) bounds the dense cell flags (one byte per lattice cell); a larger
+    // box keeps only the filled cells, sorted, which costs a binary search per query
+    QueryServer(std::vector<Atom>& atoms, double hashSpacing, Vec3 minBound, Vec3 maxBound, float spacing,
+                size_t maxMemoryBytes = 0);
+
+    bool sparse() const { return sparseCells; }
+
+    // Marks flood fill points; may be called once per slab
+    void addFilled(const std::vector<Vec3>& points);
+
+    // Registers the final waters and ranks their clusters by size
+    void setWaters(const std::vector<Atom>& waters, double clusterSpacing);
+
+    PointQuery query(const Vec3& p) const;
+
+    // Line protocol, one request per line:
+    //   x y z [x y z ...]   one answer line per point: "<inside> <water> <cluster> <clearance>"
+    //   info                lattice and resident data sizes
+    //   quit                ends the session
+    int serveStream(std::istream& in, std::ostream& out) const;
+
+    // Same protocol on a Unix domain socket, one client at a time until a client sends "shutdown"
+    int serveUnixSocket(const std::string& path) const;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "atom.h"
+#include "internals.h"
+#include "map.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// --- Data Structures ---
+
+// Fixed-capacity FIFO between two pipeline stages.
+// push blocks while the queue is full, pop blocks while it is empty.
+// After close, pop drains what is left and then returns false.
+template <typename T>
+class BoundedQueue {
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+    public:
+    explicit BoundedQueue(size_t init_capacity) : capacity(init_capacity > 0 ? init_capacity : 1) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]() { return items.size() < capacity || closed; });
+        if (closed) return;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]() { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        out = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+// A water that survived the overlap pass; bfactor follows reformat.py (0 internal, 1 surface)
+struct StreamWater {
+    std::array<double, 3> position;
+    double bfactor = 0.0;
+};
+
+struct StreamSettings {
+    size_t chunkSize = 16384;     // grid points per chunk
+    size_t queueDepth = 4;        // chunks buffered between two stages
+    double hashSpacing = 3;       // cell size of the water hash grid
+    CellStencil overlapStencil;   // atom hash grid cells, see makeOverlapStencil
+    double waterDiameter = 2.5;
+    double cutoffDistance = 5;
+    double surfaceRadius = 3.5;   // categorize_water.py -r
+    double clusterSpacing = .25;  // grid spacing used for cluster adjacency
+};
+
+struct StreamStats {
+    size_t dowsed = 0;     // grid points that entered the pipeline
+    size_t waters = 0;     // survived the overlap pass
+    size_t surface = 0;    // categorized as surface
+    size_t chunks = 0;
+};
+
+// Produces grid points by calling emit once per batch, in any batch size
+using PointSource = std::function<void(const std::function<void(std::vector<Vec3>&)>& emit)>;
+
+// --- Function Declarations ---
+
+// Fused overlap filter -> categorization -> cluster labeling.
+// The source runs on its own thread and is cut into chunks; each stage runs on its own thread and
+// hands chunks to the next through a BoundedQueue, so at most a few chunks of grid points are alive
+// at any time. Categorization is done natively (a water is surface when a vertex lies within
+// surfaceRadius, as in categorize_water.py) and clusters are labeled incrementally with a union-find
+// over a hash grid of the accepted waters. Returns the clusters sorted by size like clusterAtoms.
+std::vector<std::vector<Atom>> streamWaters(
+    const PointSource& source,
+    std::vector<Atom>& atoms,
+    const std::unordered_map<GridKey, std::vector<int>>& atomGrid,
+    const std::vector<Vertex>& surfaceVertices,
+    const StreamSettings& settings,
+    StreamStats& stats
+);
+
+#endif
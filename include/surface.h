@@ -0,0 +1,24 @@
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include "atom.h"
+#include "internals.h"
+
+#include <string>
+#include <vector>
+
+// Builds solvent excluded surface (SES) vertices with outward normals directly from the
+// parsed atoms, replacing the pdb_to_xyzr + MSMS round trip.
+//
+// - probeRadius: solvent probe radius in Angstroms (MSMS -probe_radius, 1.5 in vert_files/)
+// - density:     vertices per square Angstrom (MSMS -density, 1.0 - 2.0 in vert_files/)
+//
+// Contact vertices are the points where an accessible probe touches its atom (normal points
+// away from the atom). Reentrant vertices are sampled along the probe sphere between the two
+// atoms a probe touches at a seam (normal points toward the probe center).
+std::vector<Vertex> generateSurfaceVertices(const std::vector<Atom>& atoms, float probeRadius, float density);
+
+// Writes vertices in MSMS .vert layout so the python helpers (categorize_water.py) can read them
+void writeVertFile(const std::vector<Vertex>& vertices, const std::string& filename, float probeRadius, float density, size_t sphereCount);
+
+#endif
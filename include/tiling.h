@@ -0,0 +1,42 @@
+#ifndef TILING_H
+#define TILING_H
+
+#include "internals.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// --- Data Structures ---
+
+// Decomposition of the padded flood fill lattice into z slabs that fit a memory budget
+struct TilePlan {
+    int dimX = 0, dimY = 0, dimZ = 0;  // flood fill lattice (SeparateGridPoints dims + 1, as in FillInternalVoid)
+    int slabThickness = 0;             // z slices per slab
+    int slabCount = 0;
+    unsigned int concurrent = 1;       // slabs held in memory (and processed) at the same time
+};
+
+// Working set per lattice cell of a slab: nearest vertex record, component label, cell state, BFS queue
+const size_t TILE_BYTES_PER_CELL = sizeof(GridCellInfo) + sizeof(int32_t) + sizeof(uint8_t) + sizeof(int64_t);
+
+// --- Function Declarations ---
+
+TilePlan planTiles(Vec3 minBound, Vec3 maxBound, float spacing, size_t maxMemoryBytes);
+
+// SeparateGridPoints + FillInternalVoid computed slab by slab under the plan's memory budget.
+// Each slab is classified from the vertices within searchRadius of it, its free cells are labeled
+// into connected components, and components are stitched across slab borders with a union-find.
+// A second sweep recomputes each slab and hands the filled points of that slab to onSlab, in z order.
+// The filled set is identical to the untiled FillInternalVoid result (point order is z-major).
+void FillInternalVoidTiled(
+    const std::vector<Vertex>& surfaceVertices,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float searchRadius,
+    const TilePlan& plan,
+    const std::function<void(int slab, std::vector<Vec3>& points)>& onSlab
+);
+
+#endif
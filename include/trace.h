@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Timeline instrumentation for TRACE_MODE builds (make trace). Use the TRACE_SPAN / TRACE_THREAD_NAME
+// macros of common.h, which compile to nothing in other builds.
+
+// --- Data Structures ---
+
+// Records the time from construction to destruction as a span on the calling thread. Spans go to a
+// buffer of the thread's own, so recording takes no lock.
+class TraceSpan {
+    public:
+    explicit TraceSpan(std::string init_name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    private:
+    std::string name;
+    int64_t start;
+};
+
+// Writes the trace when it goes out of scope, so every return path of main leaves one
+struct TraceFile {
+    std::string path;
+    explicit TraceFile(std::string init_path) : path(std::move(init_path)) {}
+    ~TraceFile();
+};
+
+// --- Function Declarations ---
+
+// Names the calling thread in the timeline (threads are "thread N" otherwise)
+void traceThreadName(const std::string& name);
+
+// Writes every span recorded so far as Chrome trace-event JSON ("X" complete events, microseconds, one
+// row per thread), which chrome://tracing and ui.perfetto.dev open. Returns false when the file
+// cannot be written.
+bool writeTrace(const std::string& filename);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "atom.h"
+#include "internals.h"
+#include "map.h"
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// --- Trajectory input ---
+
+// Number of ATOM/HETATM records before the first ENDMDL (all of them for a single-model file);
+// for mmCIF, the leading _atom_site rows of the first pdbx_PDB_model_num. 0 when the file cannot be read
+size_t firstModelAtomCount(const std::string& pdbFile);
+
+// Frames of coordinates for a fixed topology, read one at a time.
+//   .pdb/.ent: one frame per MODEL ... ENDMDL block (a file without MODEL records is one frame)
+//   anything else: raw float32 x y z per atom (native byte order), frame after frame, atoms in topology order
+class TrajectoryReader {
+    std::ifstream file;
+    bool binary = false;
+    size_t atomCount;
+    size_t frameCount = 0;
+    std::string errorMessage;
+
+    public:
+    TrajectoryReader(const std::string& path, size_t atomCount);
+
+    bool isOpen() const { return file.is_open(); }
+
+    // Fills coords with the next frame; false at the end or on a malformed frame (see error())
+    bool next(std::vector<std::array<double, 3>>& coords);
+
+    const std::string& error() const { return errorMessage; }
+};
+
+// --- Incremental grids ---
+
+struct TrajectorySettings {
+    float spacing = .25f;
+    float probeRadius = 1.5f;
+    double waterDiameter = 2.5;
+    double cutoffDistance = 5;
+    double hashSpacing = 0;        // atom hash grid cells, 0 = sized by makeOverlapStencil
+    double skin = 0.125;           // atoms that moved less than this since they were last stamped keep their stamps
+};
+
+// The morphological classification, flood fill and protein overlap pass kept resident across frames.
+// Atoms are stamped into per-cell counts (united atom spheres for the solvent excluded region, water
+// clash spheres for the overlap pass), so a frame only restamps the atoms that moved beyond the skin.
+// The probe closing is recomputed only in the bricks whose atom cover changed; the connectivity
+// of the solvent (buried cavities) is global and is redone whenever the excluded region changed.
+// With skin 0 every frame gives the same waters as a --classifier morph run on that frame.
+class TrajectoryGrid {
+    TrajectorySettings settings;
+    Vec3 minBound, maxBound;
+    int dimX, dimY, dimZ;
+    double topologyMargin;              // closest any topology atom came to a face of the box
+    size_t slice;
+
+    // per atom, at the position it was last stamped at
+    std::vector<std::array<double, 3>> reference;
+    std::vector<float> coverRadius;     // radius_ua, as rasterized by the morphological classifier
+    std::vector<double> clashRadius;    // water radius + radius_aa, as in getOverlap_cluster
+    CellStencil stencil;
+    std::unordered_map<GridKey, std::vector<int>> hashGrid;
+
+    // per cell
+    std::vector<uint16_t> atomCover;    // atom spheres covering the cell
+    std::vector<uint16_t> clashCover;   // atoms a water at the cell would overlap
+    std::vector<uint8_t> excluded;      // solvent excluded region (atom cover closed by the probe)
+    std::vector<uint8_t> reached;       // solvent connected to the box border
+    std::vector<uint32_t> occupancy;    // frames with a water at the cell
+    size_t frameCount = 0;
+    bool excludedChanged = true;
+
+    // lattice coordinates (as FillInternalVoid emits them), per axis
+    std::vector<float> coordX, coordY, coordZ;
+
+    // bricks of 8^3 cells whose atom cover changed since the last closing
+    int bricksX, bricksY, bricksZ;
+    std::vector<uint8_t> dirtyBricks;
+
+    void stampAtoms(const std::vector<int>& atoms, const std::vector<std::array<double, 3>>* previous);
+    void closeWindow(int x0, int y0, int z0, int x1, int y1, int z1, bool parallel);
+    void refreshExcluded();
+    void floodSolvent();
+    bool nearAtom(const std::array<double, 3>& p) const;
+    double faceDistance(const std::array<double, 3>& p) const;
+
+    public:
+    TrajectoryGrid(const std::vector<Atom>& atoms, Vec3 minBound, Vec3 maxBound, const TrajectorySettings& settings);
+
+    // Moves the atoms to the frame coordinates and counts the restamped ones in restamped. False (with the
+    // reason in error) when the frame has the wrong atom count or an atom came so close to a face of the box
+    // that its stamps would be clipped: nearer than its reach (cover radius + probe, or clash radius), or than
+    // the closest topology atom when that was nearer already
+    bool update(const std::vector<std::array<double, 3>>& coords, size_t& restamped, std::string& error);
+
+    // Adds the waters of the current state to the occupancy map; returns their count
+    size_t accumulate();
+
+    size_t frames() const { return frameCount; }
+
+    // Cells holding a water in at least minFraction of the frames, fraction as the b-factor
+    std::vector<Atom> sites(double minFraction) const;
+
+    // Occupancy fraction as an OpenDX map, cropped to the occupied cells
+    bool writeDX(const std::string& filename) const;
+};
+
+#endif
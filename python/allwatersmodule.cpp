@@ -0,0 +1,523 @@
+// Python bindings for the allwaters engine (plain CPython C API).
+//
+// Results come back as allwaters.Array objects that own the C++ vectors produced by the pipeline
+// and expose them through the buffer protocol, so numpy.asarray(result) is a view, not a copy:
+//
+//     import numpy as np, allwaters
+//     protein = allwaters.pdbtovector("pdbfiles/L-sub.pdb")
+//     verts = allwaters.read_vert("vert_files/L-sub.vert")          # (N, 6) float32
+//     inside, outside = allwaters.separate_grid_points(verts, lo, hi)
+//     points, depth = allwaters.fill_internal_void(outside, inside, lo, hi)
+//     waters = allwaters.filter_overlaps(protein, points)
+//     labels = allwaters.cluster_atoms(waters)
+//     np.asarray(waters).shape                                       # (M, 3) float32, shares memory
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "cluster.h"
+#include "internals.h"
+#include "map.h"
+#include "pdbtovector.h"
+
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+static_assert(sizeof(Vec3) == 3 * sizeof(float), "Vec3 must be three packed floats");
+static_assert(sizeof(Vertex) == 6 * sizeof(float), "Vertex must be six packed floats");
+
+
+// ---------- allwaters.Array ----------
+
+typedef struct {
+    PyObject_HEAD
+    std::shared_ptr<void>* owner;   // keeps the C++ storage alive, shared by views of the same buffer
+    char* data;
+    int ndim;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    const char* format;             // "f", "d" or "i"
+    Py_ssize_t itemsize;
+} ArrayObject;
+
+static void Array_dealloc(ArrayObject* self) {
+    delete self->owner;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int Array_getbuffer(ArrayObject* self, Py_buffer* view, int flags) {
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+        // results are shared between views, so they stay read-only
+        PyErr_SetString(PyExc_BufferError, "allwaters.Array is read-only");
+        view->obj = NULL;
+        return -1;
+    }
+
+    view->buf = self->data;
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    view->len = self->itemsize;
+    for (int i = 0; i < self->ndim; i++) view->len *= self->shape[i];
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char*)self->format : NULL;
+    view->ndim = self->ndim;
+    view->shape = self->shape;
+    view->strides = self->strides;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyBufferProcs Array_as_buffer = {
+    (getbufferproc)Array_getbuffer,
+    NULL
+};
+
+static Py_ssize_t Array_length(ArrayObject* self) {
+    return self->shape[0];
+}
+
+static PySequenceMethods Array_as_sequence = {
+    (lenfunc)Array_length,
+};
+
+static PyObject* Array_get_shape(ArrayObject* self, void*) {
+    if (self->ndim == 1) return Py_BuildValue("(n)", self->shape[0]);
+    return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PyObject* Array_repr(ArrayObject* self) {
+    if (self->ndim == 1) {
+        return PyUnicode_FromFormat("allwaters.Array(shape=(%zd,), format='%s')", self->shape[0], self->format);
+    }
+    return PyUnicode_FromFormat("allwaters.Array(shape=(%zd, %zd), format='%s')", self->shape[0], self->shape[1], self->format);
+}
+
+static PyGetSetDef Array_getset[] = {
+    {"shape", (getter)Array_get_shape, NULL, "array shape", NULL},
+    {NULL}
+};
+
+static PyTypeObject ArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "allwaters.Array",
+};
+
+// Wraps a vector without copying: the vector is moved into shared storage owned by the Array.
+template <typename T>
+static PyObject* makeArray(std::vector<T>&& values, const char* format, Py_ssize_t itemsize, Py_ssize_t columns) {
+    auto storage = std::make_shared<std::vector<T>>(std::move(values));
+
+    ArrayObject* self = PyObject_New(ArrayObject, &ArrayType);
+    if (!self) return NULL;
+
+    size_t bytes = storage->size() * sizeof(T);
+    self->data = reinterpret_cast<char*>(storage->data());
+    self->owner = new std::shared_ptr<void>(storage);
+    self->format = format;
+    self->itemsize = itemsize;
+
+    Py_ssize_t rows = (Py_ssize_t)(bytes / (itemsize * columns));
+    if (columns == 1) {
+        self->ndim = 1;
+        self->shape[0] = rows;
+        self->strides[0] = itemsize;
+    } else {
+        self->ndim = 2;
+        self->shape[0] = rows;
+        self->shape[1] = columns;
+        self->strides[0] = itemsize * columns;
+        self->strides[1] = itemsize;
+    }
+    return (PyObject*)self;
+}
+
+// Runs work with the GIL released. C++ exceptions must not cross the C API, so one thrown by work is turned
+// into MemoryError (std::bad_alloc), ValueError (a number that did not parse) or RuntimeError; false then,
+// with the Python error set.
+template <typename Fn>
+static bool runWithoutGIL(Fn work) {
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        work();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (!error) return true;
+
+    try {
+        std::rethrow_exception(error);
+    }
+    catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    }
+    catch (const std::invalid_argument& e) {
+        PyErr_Format(PyExc_ValueError, "could not parse a number (%s)", e.what());
+    }
+    catch (const std::out_of_range& e) {
+        PyErr_Format(PyExc_ValueError, "number out of range (%s)", e.what());
+    }
+    catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    catch (...) {
+        PyErr_SetString(PyExc_RuntimeError, "unknown C++ exception");
+    }
+    return false;
+}
+
+// The readers only report a bad file on stderr and return nothing, so an empty result is raised here:
+// OSError when the file cannot be opened, ValueError when nothing could be read from it
+static PyObject* raiseUnreadable(const char* path, const char* what) {
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(path, ec)) {
+        return PyErr_Format(PyExc_OSError, "could not open %s", path);
+    }
+    return PyErr_Format(PyExc_ValueError, "no %s read from %s", what, path);
+}
+
+// ---------- argument helpers ----------
+
+// Reads an (N, columns) float32/float64 buffer (any strides) into rows of floats
+static bool readRows(PyObject* obj, size_t columns, std::vector<float>& out, const char* name) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_RECORDS_RO) != 0) {
+        return false;
+    }
+
+    std::string format = view.format ? view.format : "B";
+    if (!format.empty() && (format[0] == '<' || format[0] == '=' || format[0] == '@')) format = format.substr(1);
+
+    bool ok = view.ndim == 2 && view.shape[1] == (Py_ssize_t)columns && (format == "f" || format == "d");
+    if (!ok) {
+        PyErr_Format(PyExc_ValueError, "%s must be an (N, %zu) float32 or float64 array", name, columns);
+        PyBuffer_Release(&view);
+        return false;
+    }
+
+    out.resize((size_t)view.shape[0] * columns);
+    for (Py_ssize_t i = 0; i < view.shape[0]; i++) {
+        for (size_t j = 0; j < columns; j++) {
+            const char* item = (const char*)view.buf + i * view.strides[0] + j * view.strides[1];
+            out[i * columns + j] = format == "f" ? *(const float*)item : (float)*(const double*)item;
+        }
+    }
+
+    PyBuffer_Release(&view);
+    return true;
+}
+
+static bool readPoints(PyObject* obj, std::vector<Vec3>& out, const char* name) {
+    std::vector<float> rows;
+    if (!readRows(obj, 3, rows, name)) return false;
+
+    out.resize(rows.size() / 3);
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = {rows[3 * i], rows[3 * i + 1], rows[3 * i + 2]};
+    }
+    return true;
+}
+
+static bool readBound(PyObject* obj, Vec3& out) {
+    return PyArg_ParseTuple(obj, "fff", &out.x, &out.y, &out.z) != 0;
+}
+
+// ---------- allwaters.Structure ----------
+
+typedef struct {
+    PyObject_HEAD
+    std::vector<Atom>* atoms;
+    std::unordered_map<GridKey, std::vector<int>>* grid;
+    double gridSpacing;
+    PyObject* bounds;
+} StructureObject;
+
+static void Structure_dealloc(StructureObject* self) {
+    delete self->atoms;
+    delete self->grid;
+    Py_XDECREF(self->bounds);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static Py_ssize_t Structure_length(StructureObject* self) {
+    return (Py_ssize_t)self->atoms->size();
+}
+
+static PySequenceMethods Structure_as_sequence = {
+    (lenfunc)Structure_length,
+};
+
+static PyObject* Structure_get_coords(StructureObject* self, void*) {
+    std::vector<double> coords;
+    coords.reserve(self->atoms->size() * 3);
+    for (const Atom& atom : *self->atoms) {
+        std::array<double, 3> c = atom.getCoords();
+        coords.insert(coords.end(), c.begin(), c.end());
+    }
+    return makeArray(std::move(coords), "d", sizeof(double), 3);
+}
+
+static PyObject* Structure_get_names(StructureObject* self, bool residues) {
+    PyObject* list = PyList_New((Py_ssize_t)self->atoms->size());
+    if (!list) return NULL;
+    for (size_t i = 0; i < self->atoms->size(); i++) {
+        const Atom& atom = (*self->atoms)[i];
+        std::string name = residues ? atom.get_resname() : atom.get_atomname();
+        PyList_SET_ITEM(list, (Py_ssize_t)i, PyUnicode_FromString(name.c_str()));
+    }
+    return list;
+}
+
+static PyObject* Structure_get_resnames(StructureObject* self, void*) {
+    return Structure_get_names(self, true);
+}
+
+static PyObject* Structure_get_atomnames(StructureObject* self, void*) {
+    return Structure_get_names(self, false);
+}
+
+static PyObject* Structure_get_bounds(StructureObject* self, void*) {
+    Py_INCREF(self->bounds);
+    return self->bounds;
+}
+
+static PyGetSetDef Structure_getset[] = {
+    {"coords", (getter)Structure_get_coords, NULL, "(N, 3) float64 atom coordinates", NULL},
+    {"resnames", (getter)Structure_get_resnames, NULL, "residue name per atom", NULL},
+    {"atomnames", (getter)Structure_get_atomnames, NULL, "atom name per atom", NULL},
+    {"bounds", (getter)Structure_get_bounds, NULL, "(minx, maxx, miny, maxy, minz, maxz)", NULL},
+    {NULL}
+};
+
+static PyTypeObject StructureType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "allwaters.Structure",
+};
+
+// ---------- module functions ----------
+
+static PyObject* py_pdbtovector(PyObject*, PyObject* args, PyObject* kwargs) {
+    const char* path;
+    double hashSpacing = 0;
+    static const char* keywords[] = {"path", "hash_spacing", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|d", (char**)keywords, &path, &hashSpacing)) return NULL;
+
+    std::tuple<std::vector<Atom>, double, double, double, double, double, double> parsed;
+    if (!runWithoutGIL([&]() { parsed = pdbtovector(path); })) return NULL;
+    if (std::get<0>(parsed).empty()) return raiseUnreadable(path, "atoms");
+
+    std::unique_ptr<std::vector<Atom>> atoms;
+    std::unique_ptr<std::unordered_map<GridKey, std::vector<int>>> grid;
+    if (!runWithoutGIL([&]() {
+        atoms = std::make_unique<std::vector<Atom>>(std::move(std::get<0>(parsed)));
+        if (hashSpacing <= 0) {
+            // the size the allwaters overlap pass picks for its default water diameter and cutoff
+            hashSpacing = makeOverlapStencil(*atoms, 2.5, 5).cellSize;
+        }
+        grid = std::make_unique<std::unordered_map<GridKey, std::vector<int>>>(buildSpatialGrid(*atoms, hashSpacing));
+    })) return NULL;
+
+    StructureObject* self = PyObject_New(StructureObject, &StructureType);
+    if (!self) return NULL;
+
+    self->atoms = atoms.release();
+    self->grid = grid.release();
+    self->gridSpacing = hashSpacing;
+    self->bounds = Py_BuildValue("(dddddd)", std::get<1>(parsed), std::get<2>(parsed), std::get<3>(parsed),
+                                 std::get<4>(parsed), std::get<5>(parsed), std::get<6>(parsed));
+    return (PyObject*)self;
+}
+
+static PyObject* py_read_vert(PyObject*, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path)) return NULL;
+
+    std::vector<Vertex> vertices;
+    if (!runWithoutGIL([&]() { vertices = vert_to_vector(path); })) return NULL;
+    if (vertices.empty()) return raiseUnreadable(path, "vertices");
+
+    // position xyz then normal xyz, the MSMS column order
+    return makeArray(std::move(vertices), "f", sizeof(float), 6);
+}
+
+static PyObject* py_separate_grid_points(PyObject*, PyObject* args, PyObject* kwargs) {
+    PyObject* vertsObj;
+    PyObject* minObj;
+    PyObject* maxObj;
+    float spacing = 0.25f;
+    float searchRadius = 3.5f;
+    static const char* keywords[] = {"vertices", "min_bound", "max_bound", "spacing", "search_radius", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|ff", (char**)keywords,
+                                     &vertsObj, &minObj, &maxObj, &spacing, &searchRadius)) return NULL;
+
+    Vec3 minB, maxB;
+    std::vector<float> rows;
+    if (!readBound(minObj, minB) || !readBound(maxObj, maxB)) return NULL;
+    if (!readRows(vertsObj, 6, rows, "vertices")) return NULL;
+
+    std::vector<Vertex> vertices(rows.size() / 6);
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vertices[i].position = {rows[6 * i], rows[6 * i + 1], rows[6 * i + 2]};
+        vertices[i].normal = {rows[6 * i + 3], rows[6 * i + 4], rows[6 * i + 5]};
+    }
+
+    std::vector<Vec3> inside, outside;
+    if (!runWithoutGIL([&]() {
+        SeparateGridPoints(vertices, minB, maxB, spacing, searchRadius, inside, outside);
+    })) return NULL;
+
+    PyObject* in = makeArray(std::move(inside), "f", sizeof(float), 3);
+    PyObject* out = makeArray(std::move(outside), "f", sizeof(float), 3);
+    return Py_BuildValue("(NN)", in, out);
+}
+
+static PyObject* py_fill_internal_void(PyObject*, PyObject* args, PyObject* kwargs) {
+    PyObject* shellObj;
+    PyObject* insideObj;
+    PyObject* minObj;
+    PyObject* maxObj;
+    float spacing = 0.25f;
+    static const char* keywords[] = {"shell", "inside", "min_bound", "max_bound", "spacing", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|f", (char**)keywords,
+                                     &shellObj, &insideObj, &minObj, &maxObj, &spacing)) return NULL;
+
+    Vec3 minB, maxB;
+    std::vector<Vec3> shell, inside;
+    if (!readBound(minObj, minB) || !readBound(maxObj, maxB)) return NULL;
+    if (!readPoints(shellObj, shell, "shell") || !readPoints(insideObj, inside, "inside")) return NULL;
+
+    std::vector<Vec3> points;
+    std::vector<uint16_t> depth;
+    if (!runWithoutGIL([&]() {
+        std::vector<uint16_t> burial;
+        FillInternalVoid(shell, inside, minB, maxB, spacing, points, &burial);
+
+        // same lattice as FillInternalVoid
+        int dimX = static_cast<int>(std::ceil((maxB.x - minB.x) / spacing)) + 1;
+        int dimY = static_cast<int>(std::ceil((maxB.y - minB.y) / spacing)) + 1;
+        int dimZ = static_cast<int>(std::ceil((maxB.z - minB.z) / spacing)) + 1;
+        depth.reserve(points.size());
+        for (const Vec3& p : points) {
+            depth.push_back(burial[vectoIndex(p, dimX, dimY, dimZ, minB, spacing)]);
+        }
+    })) return NULL;
+
+    PyObject* p = makeArray(std::move(points), "f", sizeof(float), 3);
+    PyObject* l = makeArray(std::move(depth), "H", sizeof(uint16_t), 1);
+    return Py_BuildValue("(NN)", p, l);
+}
+
+static PyObject* py_filter_overlaps(PyObject*, PyObject* args, PyObject* kwargs) {
+    PyObject* structureObj;
+    PyObject* pointsObj;
+    double waterDiameter = 2.5;
+    double cutoff = 5;
+    static const char* keywords[] = {"structure", "points", "water_diameter", "cutoff", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O|dd", (char**)keywords,
+                                     &StructureType, &structureObj, &pointsObj, &waterDiameter, &cutoff)) return NULL;
+
+    StructureObject* structure = (StructureObject*)structureObj;
+    std::vector<Vec3> points;
+    if (!readPoints(pointsObj, points, "points")) return NULL;
+
+    std::vector<Vec3> waters;
+    if (!runWithoutGIL([&]() {
+        CellStencil stencil = makeOverlapStencil(*structure->atoms, waterDiameter, cutoff, structure->gridSpacing);
+        for (const Vec3& p : points) {
+            std::array<double, 3> target = {p.x, p.y, p.z};
+            if (getOverlap_cluster(*structure->grid, *structure->atoms, target, stencil, waterDiameter, cutoff)) {
+                waters.push_back(p);
+            }
+        }
+    })) return NULL;
+
+    return makeArray(std::move(waters), "f", sizeof(float), 3);
+}
+
+static PyObject* py_cluster_atoms(PyObject*, PyObject* args, PyObject* kwargs) {
+    PyObject* pointsObj;
+    double gridSpacing = 0.25;
+    double mapSpacing = 3;
+    static const char* keywords[] = {"points", "grid_spacing", "map_spacing", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|dd", (char**)keywords,
+                                     &pointsObj, &gridSpacing, &mapSpacing)) return NULL;
+
+    std::vector<Vec3> points;
+    if (!readPoints(pointsObj, points, "points")) return NULL;
+
+    std::vector<int32_t> labels;
+    if (!runWithoutGIL([&]() {
+        std::vector<Atom> atoms;
+        atoms.reserve(points.size());
+        for (const Vec3& p : points) {
+            atoms.push_back(Atom("HOH", "O", {p.x, p.y, p.z}));
+        }
+        std::vector<int> computed = clusterLabels(atoms, gridSpacing, mapSpacing);
+        labels.assign(computed.begin(), computed.end());
+    })) return NULL;
+
+    return makeArray(std::move(labels), "i", sizeof(int32_t), 1);
+}
+
+static PyMethodDef module_methods[] = {
+    {"pdbtovector", (PyCFunction)(void(*)(void))py_pdbtovector, METH_VARARGS | METH_KEYWORDS,
+     "pdbtovector(path, hash_spacing=0) -> Structure\nParses a pdb file and builds the atom hash grid used by filter_overlaps (0 sizes the cells from the default water diameter and cutoff)."},
+    {"read_vert", (PyCFunction)py_read_vert, METH_VARARGS,
+     "read_vert(path) -> Array (N, 6) float32\nMSMS vertex file as position xyz + normal xyz rows."},
+    {"separate_grid_points", (PyCFunction)(void(*)(void))py_separate_grid_points, METH_VARARGS | METH_KEYWORDS,
+     "separate_grid_points(vertices, min_bound, max_bound, spacing=0.25, search_radius=3.5) -> (inside, outside)"},
+    {"fill_internal_void", (PyCFunction)(void(*)(void))py_fill_internal_void, METH_VARARGS | METH_KEYWORDS,
+     "fill_internal_void(shell, inside, min_bound, max_bound, spacing=0.25) -> (points, depth)\ndepth is the burial depth of every point: BFS steps from the shell, 1 for the seeds."},
+    {"filter_overlaps", (PyCFunction)(void(*)(void))py_filter_overlaps, METH_VARARGS | METH_KEYWORDS,
+     "filter_overlaps(structure, points, water_diameter=2.5, cutoff=5.0) -> waters\nKeeps points that clear every atom and have one within cutoff."},
+    {"cluster_atoms", (PyCFunction)(void(*)(void))py_cluster_atoms, METH_VARARGS | METH_KEYWORDS,
+     "cluster_atoms(points, grid_spacing=0.25, map_spacing=3.0) -> labels\nCluster id per point, in discovery order."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef allwaters_module = {
+    PyModuleDef_HEAD_INIT,
+    "allwaters",
+    "In-process access to the allwaters pipeline stages with zero-copy results.",
+    -1,
+    module_methods
+};
+
+PyMODINIT_FUNC PyInit_allwaters(void) {
+    ArrayType.tp_basicsize = sizeof(ArrayObject);
+    ArrayType.tp_dealloc = (destructor)Array_dealloc;
+    ArrayType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ArrayType.tp_doc = "Read-only view of a C++ result buffer (buffer protocol, numpy.asarray-compatible)";
+    ArrayType.tp_as_buffer = &Array_as_buffer;
+    ArrayType.tp_as_sequence = &Array_as_sequence;
+    ArrayType.tp_getset = Array_getset;
+    ArrayType.tp_repr = (reprfunc)Array_repr;
+
+    StructureType.tp_basicsize = sizeof(StructureObject);
+    StructureType.tp_dealloc = (destructor)Structure_dealloc;
+    StructureType.tp_flags = Py_TPFLAGS_DEFAULT;
+    StructureType.tp_doc = "Atoms parsed by pdbtovector together with their hash grid";
+    StructureType.tp_as_sequence = &Structure_as_sequence;
+    StructureType.tp_getset = Structure_getset;
+
+    if (PyType_Ready(&ArrayType) < 0 || PyType_Ready(&StructureType) < 0) return NULL;
+
+    PyObject* module = PyModule_Create(&allwaters_module);
+    if (!module) return NULL;
+
+    Py_INCREF(&ArrayType);
+    PyModule_AddObject(module, "Array", (PyObject*)&ArrayType);
+    Py_INCREF(&StructureType);
+    PyModule_AddObject(module, "Structure", (PyObject*)&StructureType);
+    return module;
+}
@@ -27,7 +27,7 @@ void Atom::set_radius(double new_radius) {
     radius = new_radius;
 }
 
-double Atom::get_radius() {
+double Atom::get_radius() const {
     return radius;
 }
 
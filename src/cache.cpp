@@ -0,0 +1,182 @@
+#include "cache.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+
+// Bump when the layout of any cached stage output changes
+static const uint32_t CACHE_FORMAT_VERSION = 1;
+
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t elementSize;
+    uint64_t count;
+};
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+uint64_t hashFile(const std::string& path, uint64_t seed) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return seed;
+
+    std::vector<char> buffer(1 << 16);
+    uint64_t h = seed;
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        h = hashBytes(buffer.data(), (size_t)file.gcount(), h);
+    }
+    return h;
+}
+
+std::vector<uint64_t> packLatticePoints(const std::vector<Vec3>& points, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing) {
+    size_t totalCells = (size_t)dimX * dimY * dimZ;
+    std::vector<uint64_t> bits((totalCells + 63) / 64, 0);
+
+    for (const Vec3& p : points) {
+        long long x = std::llround((p.x - minBound.x) / spacing);
+        long long y = std::llround((p.y - minBound.y) / spacing);
+        long long z = std::llround((p.z - minBound.z) / spacing);
+        if (x < 0 || x >= dimX || y < 0 || y >= dimY || z < 0 || z >= dimZ) continue;
+
+        size_t i = ((size_t)z * dimY + (size_t)y) * dimX + (size_t)x;
+        bits[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    return bits;
+}
+
+std::vector<Vec3> unpackLatticePoints(const std::vector<uint64_t>& bits, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing) {
+    std::vector<Vec3> points;
+    size_t totalCells = std::min((size_t)dimX * dimY * dimZ, bits.size() * 64);
+
+    for (size_t word = 0; word * 64 < totalCells; word++) {
+        uint64_t w = bits[word];
+        while (w) {
+            size_t i = word * 64 + (size_t)__builtin_ctzll(w);
+            w &= w - 1;
+            if (i >= totalCells) break;
+
+            int x = (int)(i % dimX);
+            int y = (int)((i / dimX) % dimY);
+            int z = (int)(i / ((size_t)dimX * dimY));
+
+            // same expression the classifiers use, so the floats match bit for bit
+            Vec3 p;
+            p.x = minBound.x + (x * spacing);
+            p.y = minBound.y + (y * spacing);
+            p.z = minBound.z + (z * spacing);
+            points.push_back(p);
+        }
+    }
+    return points;
+}
+
+bool packFillIndices(const std::vector<Vec3>& points, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing, std::vector<uint32_t>& out) {
+    if ((uint64_t)dimX * dimY * dimZ > UINT32_MAX) return false;
+
+    out.clear();
+    out.reserve(points.size());
+    for (const Vec3& p : points) {
+        int64_t idx = vectoIndex(p, dimX, dimY, dimZ, minBound, spacing);
+        if (idx < 0) return false;
+        out.push_back((uint32_t)idx);
+    }
+    return true;
+}
+
+std::vector<Vec3> unpackFillIndices(const std::vector<uint32_t>& indices, Vec3 minBound, int dimX, int dimY, int dimZ, float spacing) {
+    std::vector<Vec3> points;
+    points.reserve(indices.size());
+    for (uint32_t idx : indices) {
+        points.push_back(indextoVec3(idx, dimX, dimY, dimZ, minBound, spacing));
+    }
+    return points;
+}
+
+std::string StageCache::path(const std::string& stage, uint64_t key) const {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+    return dir + "/" + stage + "-" + hex + ".bin";
+}
+
+bool StageCache::has(const std::string& stage, uint64_t key) const {
+    return active && std::filesystem::exists(path(stage, key));
+}
+
+bool StageCache::readBytes(const std::string& stage, uint64_t key, size_t elementSize, std::vector<char>& out) const {
+    if (!active) return false;
+    TRACE_SPAN("cache load " + stage);
+
+    std::ifstream file(path(stage, key), std::ios::binary);
+    if (!file.is_open()) return false;
+
+    SnapshotHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+
+    // a different build, layout or (astronomically unlikely) key collision is just a miss
+    if (std::memcmp(header.magic, "AWC1", 4) != 0 || header.version != CACHE_FORMAT_VERSION ||
+        header.key != key || header.elementSize != elementSize) {
+        DEBUG_LOG("cache: ignoring incompatible snapshot " << path(stage, key));
+        return false;
+    }
+
+    out.resize(header.count * elementSize);
+    if (!out.empty() && !file.read(out.data(), out.size())) {
+        DEBUG_LOG("cache: truncated snapshot " << path(stage, key));
+        return false;
+    }
+
+    PRINT_LOG("cache hit: " << stage << " (" << header.count << " items)");
+    return true;
+}
+
+void StageCache::writeBytes(const std::string& stage, uint64_t key, size_t elementSize, const void* data, size_t count) const {
+    if (!active) return;
+    TRACE_SPAN("cache store " + stage);
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    std::string finalPath = path(stage, key);
+    std::string tempPath = finalPath + ".tmp";
+
+    std::ofstream file(tempPath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "WARNING: Could not write cache snapshot " << tempPath << std::endl;
+        return;
+    }
+
+    SnapshotHeader header;
+    std::memcpy(header.magic, "AWC1", 4);
+    header.version = CACHE_FORMAT_VERSION;
+    header.key = key;
+    header.elementSize = elementSize;
+    header.count = count;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(static_cast<const char*>(data), (std::streamsize)(count * elementSize));
+    file.close();
+
+    if (!file) {
+        std::cerr << "WARNING: Could not write cache snapshot " << tempPath << std::endl;
+        std::filesystem::remove(tempPath, ec);
+        return;
+    }
+    std::filesystem::rename(tempPath, finalPath, ec);
+}
@@ -1,6 +1,7 @@
 #include "cluster.h"
 
 #include "common.h"
+#include "compress.h"
 
 #include <algorithm>
 #include <cmath>
@@ -8,30 +9,35 @@
 #include <string>
 #include <iostream>
 
-std::vector<std::vector<Atom>> clusterAtoms(const std::vector<Atom>& atoms, double grid_spacing, double map_spacing) {
+std::vector<int> clusterLabels(const std::vector<Atom>& atoms, double grid_spacing, double map_spacing, std::vector<int>* visitOrder) {
+    TRACE_SPAN("clusterLabels");
     //Build the spatial grid
     std::unordered_map<GridKey, std::vector<int>> grid = buildSpatialGrid(atoms, map_spacing);
     
-    std::vector<std::vector<Atom>> clusters;
-    std::vector<bool> visited(atoms.size(), false);
+    std::vector<int> labels(atoms.size(), -1);
+    int clusterCount = 0;
 
     // Define the maximum distance squared for adjacency (including diagonals)
     // We add a tiny epsilon (1.05 factor) to handle floating point inaccuracies.
     double maxDistSq = 3.0 * grid_spacing * grid_spacing * 1.05; 
 
+    if (visitOrder) {
+        visitOrder->clear();
+        visitOrder->reserve(atoms.size());
+    }
+
     for (int i = 0; i < (int)atoms.size(); ++i) {
-        if (visited[i]) continue;
+        if (labels[i] != -1) continue;
 
-        std::vector<Atom> currentCluster;
         std::queue<int> q;
 
-        visited[i] = true;
+        labels[i] = clusterCount;
         q.push(i);
 
         while (!q.empty()) {
             int currIdx = q.front();
             q.pop();
-            currentCluster.push_back(atoms[currIdx]);
+            if (visitOrder) visitOrder->push_back(currIdx);
 
             std::array<double, 3> posA = atoms[currIdx].getCoords();
             GridKey k = getGridKey(atoms[currIdx], map_spacing);
@@ -46,7 +52,7 @@ std::vector<std::vector<Atom>> clusterAtoms(const std::vector<Atom>& atoms, doub
                         if (it != grid.end()) {
                             for (int neighborIdx : it->second) {
                                 
-                                if (visited[neighborIdx]) continue;
+                                if (labels[neighborIdx] != -1) continue;
 
                                 std::array<double, 3> posB = atoms[neighborIdx].getCoords();
 
@@ -56,7 +62,7 @@ std::vector<std::vector<Atom>> clusterAtoms(const std::vector<Atom>& atoms, doub
                                 double distSq = dX*dX + dY*dY + dZ*dZ;
 
                                 if (distSq <= maxDistSq) {
-                                    visited[neighborIdx] = true;
+                                    labels[neighborIdx] = clusterCount;
                                     q.push(neighborIdx);
                                 }
                             }
@@ -65,8 +71,26 @@ std::vector<std::vector<Atom>> clusterAtoms(const std::vector<Atom>& atoms, doub
                 }
             }
         }
-        clusters.push_back(currentCluster);
+        clusterCount++;
+    }
+
+    return labels;
+}
+
+std::vector<std::vector<Atom>> clusterAtoms(const std::vector<Atom>& atoms, double grid_spacing, double map_spacing) {
+    TRACE_SPAN("clusterAtoms");
+    std::vector<int> visitOrder;
+    std::vector<int> labels = clusterLabels(atoms, grid_spacing, map_spacing, &visitOrder);
+
+    // clusters are discovered in label order, and each is filled in BFS order
+    std::vector<std::vector<Atom>> clusters;
+    for (int idx : visitOrder) {
+        if (labels[idx] == (int)clusters.size()) {
+            clusters.emplace_back();
+        }
+        clusters[labels[idx]].push_back(atoms[idx]);
     }
+
     std::sort(clusters.begin(), clusters.end(), 
         [](const std::vector<Atom>& a, const std::vector<Atom>& b) {
             return a.size() > b.size();
@@ -78,11 +102,13 @@ std::vector<std::vector<Atom>> clusterAtoms(const std::vector<Atom>& atoms, doub
 
 void writeClusteredPDB(const std::vector<std::vector<Atom>>& clusters, 
                        const std::string& filename, 
-                       const std::vector<std::string>& remarks) {
+                       const std::vector<std::string>& remarks,
+                       const std::string& compression) {
+    TRACE_SPAN("writeClusteredPDB");
     // 1. Open File
-    FILE* pFile = fopen((filename + ".pdb").c_str(), "w");
+    std::unique_ptr<std::ostream> pFile = openOutputStream(filename + ".pdb" + compression);
     
-    if (pFile == NULL) {
+    if (!pFile) {
         std::cerr << "Error: Could not open file for writing." << std::endl;
         return;
     }
@@ -91,9 +117,9 @@ void writeClusteredPDB(const std::vector<std::vector<Atom>>& clusters,
     for (const auto& remark : remarks) {
         // PDB standard usually has at least one space after REMARK. 
         // Adding 4 spaces keeps it visually aligned with typical PDB headers.
-        fprintf(pFile, "REMARK    %s\n", remark.c_str());
+        streamPrintf(*pFile, "REMARK    %s\n", remark.c_str());
     }
-    fprintf(pFile, "REMARK    --------------------------------\n");
+    streamPrintf(*pFile, "REMARK    --------------------------------\n");
 
     // 2. Write Atom Data
     int atomGlobalCount = 1;
@@ -104,7 +130,7 @@ void writeClusteredPDB(const std::vector<std::vector<Atom>>& clusters,
         for (const auto& atom : clusters[i]) {
             std::array<double, 3> c = atom.getCoords();
             
-            fprintf(pFile, "HETATM%5d  %-3s %3s A%4d    %8.3f%8.3f%8.3f  1.00%6.2f          %s\n",
+            streamPrintf(*pFile, "HETATM%5d  %-3s %3s A%4d    %8.3f%8.3f%8.3f  1.00%6.2f          %s\n",
                     atomGlobalCount % 100000, 
                     atom.get_atomname().c_str(),
                     atom.get_resname().c_str(),
@@ -116,21 +142,23 @@ void writeClusteredPDB(const std::vector<std::vector<Atom>>& clusters,
             atomGlobalCount++;
         }
     }
-    fprintf(pFile, "END\n");
-    fclose(pFile);
+    streamPrintf(*pFile, "END\n");
+    if (!closeOutputStream(*pFile)) {
+        std::cerr << "Error: Could not write " << filename << ".pdb" << compression << std::endl;
+    }
 }
 
 std::vector<std::string> extractRemarks(const std::string& filename) {
     std::vector<std::string> remarks;
-    std::ifstream file(filename);
+    std::unique_ptr<std::istream> file = openInputStream(filename);
 
-    if (!file.is_open()) {
+    if (!file) {
         std::cerr << "Error: Could not open PDB file for reading remarks: " << filename << std::endl;
         return remarks; // Returns an empty vector safely
     }
 
     std::string line;
-    while (std::getline(file, line)) {
+    while (std::getline(*file, line)) {
         // 1. Check if the line starts with "REMARK"
         if (line.rfind("REMARK", 0) == 0) { // rfind at index 0 is a fast "starts_with" check
             
@@ -153,6 +181,11 @@ std::vector<std::string> extractRemarks(const std::string& filename) {
         }
     }
 
-    file.close();
+    // damage before the first atom record; the atoms of the same file are read next and stop the run
+    if (file->bad()) {
+        std::cerr << "Error: Could not read the remarks of " << filename << " (corrupt or truncated)" << std::endl;
+        remarks.clear();
+    }
+
     return remarks;
 }
\ No newline at end of file
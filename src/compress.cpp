@@ -0,0 +1,485 @@
+#include "compress.h"
+
+#include "common.h"
+#include "parallel.h"
+#include "stream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+
+// decompressed blocks handed to the reader, and uncompressed blocks compressed at a time
+static const size_t BLOCK_SIZE = 1 << 20;
+static const size_t READ_AHEAD_BLOCKS = 4;
+static const size_t COMPRESSED_READ_SIZE = 1 << 18;
+
+static bool endsWith(const std::string& text, const std::string& suffix) {
+    if (text.size() < suffix.size()) return false;
+    return std::equal(suffix.begin(), suffix.end(), text.end() - suffix.size(), [](char a, char b) {
+        return std::tolower((unsigned char)a) == std::tolower((unsigned char)b);
+    });
+}
+
+std::string compressionSuffix(const std::string& path) {
+    if (endsWith(path, ".gz")) return ".gz";
+    if (endsWith(path, ".zst")) return ".zst";
+    return "";
+}
+
+std::string stripCompressionSuffix(const std::string& path) {
+    return path.substr(0, path.size() - compressionSuffix(path).size());
+}
+
+bool compressionAvailable(const std::string& suffix, std::string* error) {
+    std::string reason;
+#ifndef HAVE_ZLIB
+    if (suffix == ".gz") reason = "allwaters was built without zlib (HAVE_ZLIB), .gz files are not supported";
+#endif
+#ifndef HAVE_ZSTD
+    if (suffix == ".zst") reason = "allwaters was built without libzstd (HAVE_ZSTD), .zst files are not supported";
+#endif
+    if (error && !reason.empty()) *error = reason;
+    return reason.empty();
+}
+
+
+// ==================== Input ====================
+
+// Pushes the decompressed contents of file as blocks of up to BLOCK_SIZE; false when the data is corrupt
+// or ends inside a stream
+#ifdef HAVE_ZLIB
+static bool inflateGzip(FILE* file, BoundedQueue<std::string>& blocks, const std::atomic<bool>& stopping) {
+    z_stream zs = {};
+    // 15 + 32: gzip or zlib header, detected
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) return false;
+
+    std::vector<unsigned char> in(COMPRESSED_READ_SIZE);
+    std::string out(BLOCK_SIZE, '\0');
+    size_t used = 0;
+    bool inStream = false;
+    bool afterMember = false;
+    bool ok = true;
+
+    while (!stopping.load()) {
+        if (zs.avail_in == 0) {
+            size_t n = fread(in.data(), 1, in.size(), file);
+            if (n == 0) break;
+            zs.next_in = in.data();
+            zs.avail_in = (uInt)n;
+        }
+
+        // zero padding after the last member (tape blocks, preallocated files) is skipped, as gzip does
+        if (afterMember) {
+            while (zs.avail_in > 0 && *zs.next_in == 0) {
+                zs.next_in++;
+                zs.avail_in--;
+            }
+            if (zs.avail_in == 0) continue;
+            afterMember = false;
+        }
+
+        zs.next_out = reinterpret_cast<Bytef*>(&out[used]);
+        zs.avail_out = (uInt)(BLOCK_SIZE - used);
+        inStream = true;
+        int status = inflate(&zs, Z_NO_FLUSH);
+        used = BLOCK_SIZE - zs.avail_out;
+
+        if (status == Z_STREAM_END) {
+            // another gzip member may follow (pigz output, or ours)
+            inStream = false;
+            afterMember = true;
+            inflateReset(&zs);
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            ok = false;
+            break;
+        }
+
+        if (used == BLOCK_SIZE) {
+            blocks.push(std::move(out));
+            out.assign(BLOCK_SIZE, '\0');
+            used = 0;
+        }
+    }
+
+    if (used > 0) {
+        out.resize(used);
+        blocks.push(std::move(out));
+    }
+    inflateEnd(&zs);
+    return ok && (!inStream || stopping.load());
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static bool inflateZstd(FILE* file, BoundedQueue<std::string>& blocks, const std::atomic<bool>& stopping) {
+    ZSTD_DStream* ds = ZSTD_createDStream();
+    if (!ds) return false;
+    ZSTD_initDStream(ds);
+
+    std::vector<char> in(ZSTD_DStreamInSize());
+    std::string out(BLOCK_SIZE, '\0');
+    size_t used = 0;
+    size_t pending = 0;   // nonzero while a frame is unfinished
+    bool ok = true;
+
+    while (ok && !stopping.load()) {
+        size_t n = fread(in.data(), 1, in.size(), file);
+        if (n == 0) break;
+
+        ZSTD_inBuffer input = {in.data(), n, 0};
+        bool full = false;
+        while (input.pos < input.size || full) {
+            ZSTD_outBuffer output = {&out[used], BLOCK_SIZE - used, 0};
+            pending = ZSTD_decompressStream(ds, &output, &input);
+            if (ZSTD_isError(pending)) {
+                ok = false;
+                break;
+            }
+            used += output.pos;
+            full = used == BLOCK_SIZE;
+            if (full) {
+                blocks.push(std::move(out));
+                out.assign(BLOCK_SIZE, '\0');
+                used = 0;
+            }
+        }
+    }
+
+    if (used > 0) {
+        out.resize(used);
+        blocks.push(std::move(out));
+    }
+    ZSTD_freeDStream(ds);
+    return ok && (pending == 0 || stopping.load());
+}
+#endif
+
+// Reads the blocks a decompression thread queues up, one block ahead of the parser or more. A corrupt or
+// truncated stream throws from underflow once the blocks before the damage are read, which sets the
+// stream's badbit, so readers can tell it from the end of the file.
+class InflateBuf : public std::streambuf {
+    BoundedQueue<std::string> blocks{READ_AHEAD_BLOCKS};
+    std::string current;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> failed{false};
+    std::string path;
+    std::thread producer;
+
+    public:
+    InflateBuf(FILE* file, const std::string& suffix, const std::string& init_path) : path(init_path) {
+        producer = std::thread([this, file, suffix]() {
+            TRACE_THREAD_NAME("inflate " + path);
+            bool ok = true;
+            {
+                TRACE_SPAN("inflate " + path);
+#ifdef HAVE_ZLIB
+                if (suffix == ".gz") ok = inflateGzip(file, blocks, stopping);
+#endif
+#ifdef HAVE_ZSTD
+                if (suffix == ".zst") ok = inflateZstd(file, blocks, stopping);
+#endif
+            }
+            // seen by underflow after the queue is closed and drained
+            failed.store(!ok);
+            fclose(file);
+            blocks.close();
+        });
+    }
+
+    ~InflateBuf() override {
+        // a reader that stops early releases the thread from a full queue
+        stopping.store(true);
+        blocks.close();
+        producer.join();
+    }
+
+    protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        if (!blocks.pop(current)) {
+            if (failed.load()) throw std::ios_base::failure(path + " is corrupt or truncated");
+            return traits_type::eof();
+        }
+        setg(&current[0], &current[0], &current[0] + current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+};
+
+class InflateStream : public std::istream {
+    InflateBuf buffer;
+
+    public:
+    InflateStream(FILE* file, const std::string& suffix, const std::string& path) : std::istream(nullptr), buffer(file, suffix, path) {
+        rdbuf(&buffer);
+    }
+};
+
+std::unique_ptr<std::istream> openInputStream(const std::string& path, std::string* error) {
+    std::string suffix = compressionSuffix(path);
+    if (!compressionAvailable(suffix, error)) return nullptr;
+
+    if (suffix.empty()) {
+        auto file = std::make_unique<std::ifstream>(path);
+        if (!file->is_open()) {
+            if (error) *error = "could not open " + path;
+            return nullptr;
+        }
+        return file;
+    }
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        if (error) *error = "could not open " + path;
+        return nullptr;
+    }
+    return std::make_unique<InflateStream>(file, suffix, path);
+}
+
+bool decompressFile(const std::string& path, const std::string& target, std::string* error) {
+    std::unique_ptr<std::istream> in = openInputStream(path, error);
+    if (!in) return false;
+
+    std::ofstream out(target, std::ios::binary);
+    if (!out.is_open()) {
+        if (error) *error = "could not open " + target + " for writing";
+        return false;
+    }
+
+    std::vector<char> chunk(BLOCK_SIZE);
+    while (in->read(chunk.data(), (std::streamsize)chunk.size()) || in->gcount() > 0) {
+        out.write(chunk.data(), in->gcount());
+    }
+    if (in->bad()) {
+        if (error) *error = path + " is corrupt or truncated";
+        return false;
+    }
+    out.close();
+    if (out.fail()) {
+        if (error) *error = "could not write " + target;
+        return false;
+    }
+    return true;
+}
+
+
+// ==================== Output ====================
+
+#ifdef HAVE_ZLIB
+// One complete gzip member
+static bool deflateMember(const std::string& input, std::string& output) {
+    TRACE_SPAN("deflate block");
+    z_stream zs = {};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+    output.resize(deflateBound(&zs, (uLong)input.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    zs.avail_in = (uInt)input.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    zs.avail_out = (uInt)output.size();
+
+    int status = deflate(&zs, Z_FINISH);
+    output.resize(zs.total_out);
+    deflateEnd(&zs);
+    return status == Z_STREAM_END;
+}
+#endif
+
+// Collects BLOCK_SIZE blocks and writes them compressed, in order
+class DeflateBuf : public std::streambuf {
+    struct PendingBlock {
+        std::string input;
+        std::string output;
+        bool ok = false;
+        std::atomic<bool> done{false};
+    };
+
+    FILE* file;
+    std::string suffix;
+    std::string block;
+    std::deque<std::unique_ptr<PendingBlock>> pending;
+    bool failed = false;
+    bool finished = false;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* cctx = nullptr;
+    std::vector<char> zstdOut;
+#endif
+
+    void writeOldest() {
+        PendingBlock& oldest = *pending.front();
+        ThreadPool::instance().helpUntil([&]() { return oldest.done.load(); });
+        if (!oldest.ok || fwrite(oldest.output.data(), 1, oldest.output.size(), file) != oldest.output.size()) failed = true;
+        pending.pop_front();
+    }
+
+#ifdef HAVE_ZSTD
+    void compressZstd(const char* data, size_t size, ZSTD_EndDirective mode) {
+        TRACE_SPAN("zstd block");
+        ZSTD_inBuffer input = {data, size, 0};
+        size_t remaining = 0;
+        do {
+            ZSTD_outBuffer output = {zstdOut.data(), zstdOut.size(), 0};
+            remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining)) {
+                failed = true;
+                return;
+            }
+            if (fwrite(zstdOut.data(), 1, output.pos, file) != output.pos) failed = true;
+        } while (mode == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+    }
+#endif
+
+    void flushBlock() {
+        size_t size = pptr() - pbase();
+        if (size == 0) return;
+
+#ifdef HAVE_ZLIB
+        if (suffix == ".gz") {
+            auto next = std::make_unique<PendingBlock>();
+            next->input.assign(pbase(), size);
+            PendingBlock* task = next.get();
+            pending.push_back(std::move(next));
+            ThreadPool::instance().submit([task]() {
+                task->ok = deflateMember(task->input, task->output);
+                task->done.store(true);
+                ThreadPool::instance().notify();
+            });
+
+            // a couple of blocks per thread in flight bounds the memory
+            while (pending.size() > 2 * (size_t)getThreadCount()) {
+                writeOldest();
+            }
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (suffix == ".zst") compressZstd(pbase(), size, ZSTD_e_continue);
+#endif
+        setp(&block[0], &block[0] + block.size());
+    }
+
+    public:
+    DeflateBuf(FILE* init_file, const std::string& init_suffix) : file(init_file), suffix(init_suffix), block(BLOCK_SIZE, '\0') {
+        setp(&block[0], &block[0] + block.size());
+#ifdef HAVE_ZSTD
+        if (suffix == ".zst") {
+            cctx = ZSTD_createCCtx();
+            zstdOut.resize(ZSTD_CStreamOutSize());
+            // the library's worker threads compress while this one feeds them (ignored by single-threaded builds)
+            if (!cctx) failed = true;
+            else if (getThreadCount() > 1) ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, (int)getThreadCount());
+        }
+#endif
+    }
+
+    ~DeflateBuf() override {
+        finish();
+    }
+
+    bool finish() {
+        if (finished) return !failed;
+        finished = true;
+
+        flushBlock();
+        while (!pending.empty()) {
+            writeOldest();
+        }
+#ifdef HAVE_ZSTD
+        if (cctx) {
+            compressZstd(nullptr, 0, ZSTD_e_end);
+            ZSTD_freeCCtx(cctx);
+            cctx = nullptr;
+        }
+#endif
+        if (fclose(file) != 0) failed = true;
+        return !failed;
+    }
+
+    protected:
+    int_type overflow(int_type c) override {
+        if (finished) return traits_type::eof();
+        flushBlock();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return failed ? traits_type::eof() : traits_type::not_eof(c);
+    }
+};
+
+class DeflateStream : public std::ostream {
+    DeflateBuf buffer;
+
+    public:
+    DeflateStream(FILE* file, const std::string& suffix) : std::ostream(nullptr), buffer(file, suffix) {
+        rdbuf(&buffer);
+    }
+
+    bool close() {
+        return buffer.finish();
+    }
+};
+
+std::unique_ptr<std::ostream> openOutputStream(const std::string& path, std::string* error) {
+    std::string suffix = compressionSuffix(path);
+    if (!compressionAvailable(suffix, error)) return nullptr;
+
+    if (suffix.empty()) {
+        auto file = std::make_unique<std::ofstream>(path);
+        if (!file->is_open()) {
+            if (error) *error = "could not open " + path + " for writing";
+            return nullptr;
+        }
+        return file;
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        if (error) *error = "could not open " + path + " for writing";
+        return nullptr;
+    }
+    return std::make_unique<DeflateStream>(file, suffix);
+}
+
+bool closeOutputStream(std::ostream& out) {
+    if (auto* compressed = dynamic_cast<DeflateStream*>(&out)) {
+        return compressed->close() && !out.fail();
+    }
+    if (auto* plain = dynamic_cast<std::ofstream*>(&out)) {
+        plain->close();
+    }
+    return !out.fail();
+}
+
+void streamPrintf(std::ostream& out, const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    if ((size_t)length < sizeof(line)) {
+        out.write(line, length);
+        return;
+    }
+
+    // longer than a record line, e.g. a long remark
+    std::vector<char> longLine(length + 1);
+    va_start(args, format);
+    vsnprintf(longLine.data(), longLine.size(), format, args);
+    va_end(args);
+    out.write(longLine.data(), length);
+}
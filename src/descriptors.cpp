@@ -0,0 +1,142 @@
+#include "descriptors.h"
+
+#include "common.h"
+#include "map.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <utility>
+
+
+int atomTypeId(const std::string& atomName) {
+    static const std::map<std::string, int> ATOM_TYPES = {
+        {"C", 1}, {"N", 2}, {"O", 3}, {"SD", 4}, {"H", 5}, {"CA", 6}, {"CB", 7},
+        {"CG", 8}, {"CD1", 9}, {"CD2", 10}, {"CE1", 11}, {"CE2", 12}, {"CZ", 13}
+    };
+    auto it = ATOM_TYPES.find(atomName);
+    return it == ATOM_TYPES.end() ? 0 : it->second;
+}
+
+int residueTypeId(const std::string& resName) {
+    static const std::map<std::string, int> RESIDUE_TYPES = {
+        {"ALA", 1}, {"ARG", 2}, {"ASP", 3}, {"ASN", 4}, {"CYS", 5}, {"GLU", 6}, {"GLY", 7},
+        {"HIS", 8}, {"ILE", 9}, {"LEU", 10}, {"MET", 11}, {"LYS", 12}, {"PHE", 13}, {"PRO", 14},
+        {"SEC", 15}, {"SER", 16}, {"THR", 17}, {"TYR", 18}, {"TRP", 19}, {"VAL", 20}, {"HOH", 21}
+    };
+    auto it = RESIDUE_TYPES.find(resName);
+    return it == RESIDUE_TYPES.end() ? 0 : it->second;
+}
+
+SiteFeatures extractFeatures(const std::vector<Atom>& protein, const std::vector<std::array<double, 3>>& sites,
+                             const FeatureSettings& settings) {
+    TRACE_SPAN("extractFeatures");
+    SiteFeatures features;
+    int k = settings.neighbors;
+    features.sites = sites.size();
+    features.neighbors = k;
+    features.geometry.assign(sites.size() * k * 4, 0.0f);
+    features.types.assign(sites.size() * k * 2, 0);
+    features.atoms.assign(sites.size() * k, -1);
+
+    // --- PHASE 1: PROTEIN INDEX ---
+    std::vector<std::array<double, 3>> coords(protein.size());
+    std::vector<int32_t> atomTypes(protein.size());
+    std::vector<int32_t> residueTypes(protein.size());
+    for (size_t i = 0; i < protein.size(); i++) {
+        coords[i] = protein[i].getCoords();
+        atomTypes[i] = atomTypeId(protein[i].get_atomname());
+        residueTypes[i] = residueTypeId(protein[i].get_resname());
+    }
+
+    std::unordered_map<GridKey, std::vector<int>> grid = buildSpatialGrid(protein, settings.cellSize);
+    CellStencil stencil = makeCellStencil(settings.cellSize, settings.maxDistance);
+    double maxSq = settings.maxDistance * settings.maxDistance;
+
+    // --- PHASE 2: K NEAREST ATOMS PER SITE ---
+    parallelFor(sites.size(), [&](size_t begin, size_t end, unsigned int) {
+        // max-heap of (squared distance, atom) holding the best k so far
+        std::vector<std::pair<double, int>> best;
+        best.reserve(k);
+
+        for (size_t s = begin; s < end; s++) {
+            const std::array<double, 3>& site = sites[s];
+            GridKey center = getGridKey_pos(site, settings.cellSize);
+            best.clear();
+
+            for (size_t c = 0; c < stencil.offsets.size(); c++) {
+                if ((int)best.size() == k && stencil.minDistance[c] * stencil.minDistance[c] > best.front().first) break;
+
+                const GridKey& offset = stencil.offsets[c];
+                auto it = grid.find({center.x + offset.x, center.y + offset.y, center.z + offset.z});
+                if (it == grid.end()) continue;
+
+                for (int a : it->second) {
+                    double dX = coords[a][0] - site[0];
+                    double dY = coords[a][1] - site[1];
+                    double dZ = coords[a][2] - site[2];
+                    std::pair<double, int> candidate = {dX*dX + dY*dY + dZ*dZ, a};
+                    if (candidate.first > maxSq) continue;
+
+                    if ((int)best.size() < k) {
+                        best.push_back(candidate);
+                        std::push_heap(best.begin(), best.end());
+                    } else if (candidate < best.front()) {
+                        std::pop_heap(best.begin(), best.end());
+                        best.back() = candidate;
+                        std::push_heap(best.begin(), best.end());
+                    }
+                }
+            }
+            std::sort_heap(best.begin(), best.end());
+
+            for (size_t n = 0; n < best.size(); n++) {
+                int a = best[n].second;
+                size_t slot = s * k + n;
+                features.geometry[slot * 4 + 0] = (float)(coords[a][0] - site[0]);
+                features.geometry[slot * 4 + 1] = (float)(coords[a][1] - site[1]);
+                features.geometry[slot * 4 + 2] = (float)(coords[a][2] - site[2]);
+                features.geometry[slot * 4 + 3] = (float)std::sqrt(best[n].first);
+                features.types[slot * 2 + 0] = atomTypes[a];
+                features.types[slot * 2 + 1] = residueTypes[a];
+                features.atoms[slot] = a;
+            }
+        }
+    });
+
+    DEBUG_LOG("extractFeatures: " << sites.size() << " sites, " << k << " neighbors, " << stencil.offsets.size() << " stencil cells");
+    return features;
+}
+
+bool writeNpy(const std::string& path, const std::string& descr, const void* data, size_t elementSize,
+              const std::vector<size_t>& shape) {
+    std::string shapeText = "(";
+    size_t count = 1;
+    for (size_t i = 0; i < shape.size(); i++) {
+        if (i > 0) shapeText += ", ";
+        shapeText += std::to_string(shape[i]);
+        count *= shape[i];
+    }
+    shapeText += shape.size() == 1 ? ",)" : ")";
+
+    // magic, version 1.0, header length, then the header dict padded with spaces so the data starts
+    // on a 64 byte boundary
+    std::string header = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': " + shapeText + ", }";
+    size_t unpadded = 10 + header.size() + 1;
+    header.append((64 - unpadded % 64) % 64, ' ');
+    header += '\n';
+    if (header.size() > 65535) return false;
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+
+    uint16_t headerLength = (uint16_t)header.size();
+    out.write("\x93NUMPY\x01\x00", 8);
+    char lengthBytes[2] = {(char)(headerLength & 0xff), (char)(headerLength >> 8)};
+    out.write(lengthBytes, 2);
+    out.write(header.data(), header.size());
+    out.write(static_cast<const char*>(data), (std::streamsize)(count * elementSize));
+    return (bool)out;
+}
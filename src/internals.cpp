@@ -1,15 +1,24 @@
 #include "internals.h" 
 
 #include "common.h"
+#include "compress.h"
+
+#include <tuple>
 
 
 std::vector<Vertex> vert_to_vector(std::string vert_file) {
+    TRACE_SPAN("vert_to_vector");
     std::vector<Vertex> output;
-    std::ifstream infile(vert_file);
+    std::string error;
+    std::unique_ptr<std::istream> infile = openInputStream(vert_file, &error);
+    if (!infile) {
+        std::cerr << "Error: " << error << std::endl;
+        return output;
+    }
     std::string line_string;
     
     int z = 0;
-    while(std::getline(infile, line_string)) {
+    while(std::getline(*infile, line_string)) {
         if(!line_string.empty() & (z > 2)){
 
             std::stringstream ss(line_string);
@@ -29,21 +38,31 @@ std::vector<Vertex> vert_to_vector(std::string vert_file) {
         }
         z++;
     }
+    if (infile->bad()) {
+        std::cerr << "Error: Could not read " << vert_file << " to the end (corrupt or truncated)" << std::endl;
+        output.clear();
+    }
     return output;
 }
 
-int vectoIndex(Vec3 vector, int dimX, int dimY, int dimZ, Vec3 minBound, double spacing) {
+int64_t vectoIndex(Vec3 vector, int dimX, int dimY, int dimZ, Vec3 minBound, double spacing) {
+
+    // round, not truncate: lattice points rebuilt from floats can land a hair below their cell
+    int64_t grid_x = std::llround((vector.x - minBound.x) * (1/spacing));
+    int64_t grid_y = std::llround((vector.y - minBound.y) * (1/spacing));
+    int64_t grid_z = std::llround((vector.z - minBound.z) * (1/spacing));
 
-    double grid_x = (vector.x - minBound.x) * (1/spacing);
-    double grid_y = (vector.y - minBound.y) * (1/spacing);
-    double grid_z = (vector.z - minBound.z) * (1/spacing);
+    if (grid_x < 0 || grid_x >= dimX || grid_y < 0 || grid_y >= dimY || grid_z < 0 || grid_z >= dimZ) {
+        return -1;
+    }
 
-    int idx = grid_z * (dimX * dimY) + grid_y * dimX + grid_x;
+    int64_t idx = grid_z * ((int64_t)dimX * dimY) + grid_y * dimX + grid_x;
     return idx;
 }
-Vec3 indextoVec3(int index, int dimX, int dimY, int dimZ, Vec3 minBound, double spacing) {
-    double z = index / (dimX * dimY);
-    int remainder = index % (dimX * dimY);
+Vec3 indextoVec3(int64_t index, int dimX, int dimY, int dimZ, Vec3 minBound, double spacing) {
+    int64_t slice = (int64_t)dimX * dimY;
+    double z = index / slice;
+    int64_t remainder = index % slice;
     double y = remainder / dimX;
     double x = remainder % dimX;
 
@@ -55,24 +74,24 @@ Vec3 indextoVec3(int index, int dimX, int dimY, int dimZ, Vec3 minBound, double
     return vector;
 }
 
-void SeparateGridPoints(
+// Total order on vertices (position, then normal) for breaking distance ties
+static bool vertexLess(const Vertex& a, const Vertex& b) {
+    return std::tie(a.position.x, a.position.y, a.position.z, a.normal.x, a.normal.y, a.normal.z) <
+           std::tie(b.position.x, b.position.y, b.position.z, b.normal.x, b.normal.y, b.normal.z);
+}
+
+void ScatterNearestVertex(
     const std::vector<Vertex>& surfaceVertices,
     Vec3 minBound,
-    Vec3 maxBound,
+    int dimX,
+    int dimY,
+    int zBegin,
+    int zEnd,
     float spacing,
     float searchRadius,
-    std::vector<Vec3>& outInside, 
-    std::vector<Vec3>& outOutside
+    std::vector<GridCellInfo>& grid
 ) {
-    
-    int dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing));
-    int dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing));
-    int dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing));
-
-    size_t totalCells = (size_t)dimX * dimY * dimZ;
-    
-    std::vector<GridCellInfo> grid(totalCells);
-
+    TRACE_SPAN("ScatterNearestVertex");
     float searchRadiusSq = searchRadius * searchRadius;
     int searchRadius_cells = static_cast<int>(std::ceil(searchRadius / spacing));
 
@@ -83,11 +102,15 @@ void SeparateGridPoints(
         int cy = static_cast<int>(std::floor((vert.position.y - minBound.y) / spacing));
         int cz = static_cast<int>(std::floor((vert.position.z - minBound.z) / spacing));
 
+        if (cz + searchRadius_cells < zBegin || cz - searchRadius_cells >= zEnd) {
+            continue;
+        }
+
         for (int z = cz - searchRadius_cells; z <= cz + searchRadius_cells; z++) {
             for (int y = cy - searchRadius_cells; y <= cy + searchRadius_cells; y++) {
                 for (int x = cx - searchRadius_cells; x <= cx + searchRadius_cells; x++) {   
                     
-                    if(x < 0 || x >= dimX || y < 0 || y >= dimY || z < 0 || z >= dimZ) {
+                    if(x < 0 || x >= dimX || y < 0 || y >= dimY || z < zBegin || z >= zEnd) {
                         continue;
                     }
 
@@ -96,13 +119,15 @@ void SeparateGridPoints(
                     gridPos.y = minBound.y + (y * spacing);
                     gridPos.z = minBound.z + (z * spacing);
 
-                    double distanceSq = (gridPos - vert.position).lengthSq();
+                    float distanceSq = (gridPos - vert.position).lengthSq();
 
                     if(distanceSq <= searchRadiusSq) {
                         
-                        size_t idx = (size_t)z * (dimX * dimY) + (size_t)y * dimX + (size_t)x;
+                        size_t idx = (size_t)(z - zBegin) * ((size_t)dimX * dimY) + (size_t)y * dimX + (size_t)x;
 
-                        if (distanceSq < grid[idx].minDistSq) {
+                        // equal distances go to the smaller vertex, so the vertex order does not matter
+                        if (distanceSq < grid[idx].minDistSq ||
+                            (distanceSq == grid[idx].minDistSq && vertexLess(vert, surfaceVertices[grid[idx].closestVertexIndex]))) {
                             grid[idx].closestVertexIndex = i;
                             grid[idx].minDistSq = distanceSq;
                         }
@@ -111,13 +136,35 @@ void SeparateGridPoints(
             }
         }
     }
+}
+
+void SeparateGridPoints(
+    const std::vector<Vertex>& surfaceVertices,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float searchRadius,
+    std::vector<Vec3>& outInside, 
+    std::vector<Vec3>& outOutside
+) {
+    TRACE_SPAN("SeparateGridPoints");
+    
+    int dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing));
+    int dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing));
+    int dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing));
+
+    size_t totalCells = (size_t)dimX * dimY * dimZ;
+    
+    std::vector<GridCellInfo> grid(totalCells);
+
+    ScatterNearestVertex(surfaceVertices, minBound, dimX, dimY, 0, dimZ, spacing, searchRadius, grid);
 
     // --- PHASE 2: CLASSIFY ---
     for(int z = 0; z < dimZ; z++) {
         for(int y = 0; y < dimY; y++) {
             for(int x = 0; x < dimX; x++) {
                 
-                size_t i = (size_t)z * (dimX * dimY) + (size_t)y * dimX + (size_t)x;
+                size_t i = (size_t)z * ((size_t)dimX * dimY) + (size_t)y * dimX + (size_t)x;
 
                 if(grid[i].closestVertexIndex != -1){
                     
@@ -143,122 +190,189 @@ void SeparateGridPoints(
     }
 }
 
-//weighted voting
-// void SeparateGridPoints(
-//     const std::vector<Vertex>& surfaceVertices,
-//     Vec3 minBound,
-//     Vec3 maxBound,
-//     float spacing,
-//     float searchRadius,
-//     std::vector<Vec3>& outInside, 
-//     std::vector<Vec3>& outOutside
-// ) {
-//     // --- SETUP GRID DIMENSIONS ---
-//     int dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing));
-//     int dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing));
-//     int dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing));
-    
-//     size_t totalCells = (size_t)dimX * dimY * dimZ;
+// Calls fn(vertex, first cell index, last cell index) for every x row of cells within searchRadius of a
+// vertex. Each row is clipped analytically to the sphere, then its ends are settled with the same float
+// distance test as ScatterNearestVertex (distance grows monotonically away from the vertex along a row),
+// so the rows hold exactly the cells the scatter would visit.
+template <typename Fn>
+static void forEachRowInReach(const std::vector<Vertex>& surfaceVertices, Vec3 minBound, int dimX, int dimY, int dimZ,
+                              float spacing, float searchRadius, Fn fn) {
+    float searchRadiusSq = searchRadius * searchRadius;
+    int searchRadius_cells = static_cast<int>(std::ceil(searchRadius / spacing));
+
+    for (int i = 0; i < (int)surfaceVertices.size(); i++) {
+        const Vertex& vert = surfaceVertices[i];
 
-//     // 1. ALLOCATE: One large contiguous block
-//     // 50M cells * ~30 bytes = ~1.5 GB RAM. Safe for modern machines.
-//     std::vector<CellVotes> grid(totalCells);
+        int cx = static_cast<int>(std::floor((vert.position.x - minBound.x) / spacing));
+        int cy = static_cast<int>(std::floor((vert.position.y - minBound.y) / spacing));
+        int cz = static_cast<int>(std::floor((vert.position.z - minBound.z) / spacing));
+        int xMin = std::max(0, cx - searchRadius_cells);
+        int xMax = std::min(dimX - 1, cx + searchRadius_cells);
+        if (xMin > xMax) continue;
+
+        for (int z = std::max(0, cz - searchRadius_cells); z <= std::min(dimZ - 1, cz + searchRadius_cells); z++) {
+            for (int y = std::max(0, cy - searchRadius_cells); y <= std::min(dimY - 1, cy + searchRadius_cells); y++) {
+                Vec3 rowPos;
+                rowPos.y = minBound.y + (y * spacing);
+                rowPos.z = minBound.z + (z * spacing);
+
+                auto inReach = [&](int x) {
+                    rowPos.x = minBound.x + (x * spacing);
+                    return (rowPos - vert.position).lengthSq() <= searchRadiusSq;
+                };
+
+                float dY = rowPos.y - vert.position.y;
+                float dZ = rowPos.z - vert.position.z;
+                float rest = searchRadiusSq - dY * dY - dZ * dZ;
+                if (rest < -1e-3f * searchRadiusSq) continue;
+                float half = std::sqrt(std::max(rest, 0.0f));
+
+                int first = std::max(xMin, static_cast<int>(std::ceil((vert.position.x - half - minBound.x) / spacing)));
+                int last = std::min(xMax, static_cast<int>(std::floor((vert.position.x + half - minBound.x) / spacing)));
+                if (first > last) {
+                    // a sliver row: at most the cells next to the estimate can be in reach
+                    int x = std::min(std::max(last, xMin), xMax);
+                    if (!inReach(x) && (x + 1 > xMax || !inReach(++x))) continue;
+                    first = last = x;
+                }
 
-//     float searchRadiusSq = searchRadius * searchRadius;
-//     int searchRadius_cells = static_cast<int>(std::ceil(searchRadius / spacing));
+                while (first > xMin && inReach(first - 1)) first--;
+                while (first <= last && !inReach(first)) first++;
+                while (last < xMax && inReach(last + 1)) last++;
+                while (last >= first && !inReach(last)) last--;
+                if (first > last) continue;
 
-//     // --- PHASE 1: COLLECT CANDIDATES (SCATTER) ---
-//     // Iterate over surface vertices and "scatter" them into nearby grid cells
-//     for(int i = 0; i < surfaceVertices.size(); i++){
-//         const Vertex& vert = surfaceVertices[i];
-        
-//         // Find which cell this vertex falls into
-//         int cx = static_cast<int>(std::floor((vert.position.x - minBound.x) / spacing));
-//         int cy = static_cast<int>(std::floor((vert.position.y - minBound.y) / spacing));
-//         int cz = static_cast<int>(std::floor((vert.position.z - minBound.z) / spacing));
-
-//         // Search neighboring cells within radius
-//         for (int z = cz - searchRadius_cells; z <= cz + searchRadius_cells; z++) {
-//             for (int y = cy - searchRadius_cells; y <= cy + searchRadius_cells; y++) {
-//                 for (int x = cx - searchRadius_cells; x <= cx + searchRadius_cells; x++) {   
-                    
-//                     // Bounds Check
-//                     if(x < 0 || x >= dimX || y < 0 || y >= dimY || z < 0 || z >= dimZ) continue;
+                size_t row = (size_t)z * ((size_t)dimX * dimY) + (size_t)y * dimX;
+                fn(i, row + first, row + last);
+            }
+        }
+    }
+}
+
+void SeparateGridPointsVote(
+    const std::vector<Vertex>& surfaceVertices,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float searchRadius,
+    std::vector<Vec3>& outInside,
+    std::vector<Vec3>& outOutside
+) {
+    TRACE_SPAN("SeparateGridPointsVote");
+    int dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing));
+    int dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing));
+    int dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing));
+    size_t totalCells = (size_t)dimX * dimY * dimZ;
+    const int k = VOTE_CANDIDATES;
+
+    // --- PHASE 1: NARROW BAND ---
+    std::vector<uint64_t> band((totalCells + 63) / 64, 0);
+    forEachRowInReach(surfaceVertices, minBound, dimX, dimY, dimZ, spacing, searchRadius,
+                      [&](int, size_t first, size_t last) {
+        for (size_t w = first >> 6; w <= last >> 6; w++) {
+            uint64_t bits = ~0ULL;
+            if (w == first >> 6) bits &= ~0ULL << (first & 63);
+            if (w == last >> 6) bits &= ~0ULL >> (63 - (last & 63));
+            band[w] |= bits;
+        }
+    });
 
-//                     // Calculate Grid Point Position
-//                     Vec3 gridPos;
-//                     gridPos.x = minBound.x + (x * spacing);
-//                     gridPos.y = minBound.y + (y * spacing);
-//                     gridPos.z = minBound.z + (z * spacing);
+    // band cells before each word, so a cell finds its slot with one popcount
+    std::vector<uint32_t> wordRank(band.size() + 1, 0);
+    for (size_t w = 0; w < band.size(); w++) {
+        wordRank[w + 1] = wordRank[w] + (uint32_t)__builtin_popcountll(band[w]);
+    }
+    size_t bandCells = wordRank.back();
+
+    // --- PHASE 2: NEAREST CANDIDATES PER BAND CELL ---
+    // k slots per band cell, nearest first; equal distances go to the smaller vertex as in ScatterNearestVertex.
+    // A row lies entirely in the band, so its cells take consecutive slots.
+    std::vector<int32_t> candidates(bandCells * k, -1);
+    std::vector<float> weights(bandCells * k, FLT_MAX);   // squared distances until phase 3
+    size_t plane = (size_t)dimX * dimY;
+
+    forEachRowInReach(surfaceVertices, minBound, dimX, dimY, dimZ, spacing, searchRadius,
+                      [&](int vertex, size_t first, size_t last) {
+        const Vertex& vert = surfaceVertices[vertex];
+        size_t slot = (size_t)wordRank[first >> 6] + (size_t)__builtin_popcountll(band[first >> 6] & ((1ULL << (first & 63)) - 1));
+
+        Vec3 gridPos;
+        gridPos.y = minBound.y + ((int)((first / dimX) % dimY) * spacing);
+        gridPos.z = minBound.z + ((int)(first / plane) * spacing);
+        int x = (int)(first % dimX);
+
+        for (size_t idx = first; idx <= last; idx++, slot++, x++) {
+            gridPos.x = minBound.x + (x * spacing);
+            float distanceSq = (gridPos - vert.position).lengthSq();
+
+            int32_t* index = &candidates[slot * k];
+            float* distSq = &weights[slot * k];
+            auto closer = [&](int j) {
+                return index[j] == -1 || distanceSq < distSq[j] ||
+                       (distanceSq == distSq[j] && vertexLess(vert, surfaceVertices[index[j]]));
+            };
+            if (!closer(k - 1)) continue;
+
+            int j = k - 1;
+            while (j > 0 && closer(j - 1)) {
+                index[j] = index[j - 1];
+                distSq[j] = distSq[j - 1];
+                j--;
+            }
+            index[j] = vertex;
+            distSq[j] = distanceSq;
+        }
+    });
 
-//                     // Quick Box Check (Avoid sqrt)
-//                     if (std::abs(gridPos.x - vert.position.x) > searchRadius) continue;
-//                     if (std::abs(gridPos.y - vert.position.y) > searchRadius) continue;
-//                     if (std::abs(gridPos.z - vert.position.z) > searchRadius) continue;
+    // --- PHASE 3: VOTE ---
+    // weights in one flat pass (empty slots weigh 0), then a branchless signed sum per band cell
+    for (size_t s = 0; s < weights.size(); s++) {
+        weights[s] = candidates[s] < 0 ? 0.0f : 1.0f / (weights[s] + 1e-6f);
+    }
 
-//                     // Precise Distance Check
-//                     double d2 = (gridPos - vert.position).lengthSq();
+    // each vertex as a plane n.p - n.v: negative on the inside
+    size_t vertexCount = surfaceVertices.size();
+    std::vector<float> planeX(vertexCount), planeY(vertexCount), planeZ(vertexCount), planeOffset(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        const Vertex& vert = surfaceVertices[v];
+        planeX[v] = vert.normal.x;
+        planeY[v] = vert.normal.y;
+        planeZ[v] = vert.normal.z;
+        planeOffset[v] = vert.normal.dot(vert.position);
+    }
 
-//                     if(d2 <= searchRadiusSq) {
-//                         size_t idx = (size_t)z * (dimX * dimY) + (size_t)y * dimX + (size_t)x;
-                        
-//                         // INSERT into fixed-size priority queue
-//                         grid[idx].insert(i, (float)d2);
-//                     }
-//                 }
-//             }
-//         }
-//     }
-
-    // --- PHASE 2: WEIGHTED VOTING ---
-    // Iterate over grid cells and classify them based on their collected candidates
-//     for(int z = 0; z < dimZ; z++) {
-//         for(int y = 0; y < dimY; y++) {
-//             for(int x = 0; x < dimX; x++) {
-                
-//                 size_t idx = (size_t)z * (dimX * dimY) + (size_t)y * dimX + (size_t)x;
-//                 CellVotes& cell = grid[idx];
-
-//                 // Only process cells that found at least one surface vertex
-//                 if(cell.count > 0){
-//                     Vec3 test_point;
-//                     test_point.x = minBound.x + (x * spacing);
-//                     test_point.y = minBound.y + (y * spacing);
-//                     test_point.z = minBound.z + (z * spacing);
-
-//                     double scoreInside = 0.0;
-//                     double scoreOutside = 0.0;
-                    
-//                     // Iterate through top 3 (or fewer) candidates
-//                     for(int j = 0; j < cell.count; j++) {
-//                         const Vertex& v = surfaceVertices[cell.indices[j]];
-//                         Vec3 dir = test_point - v.position;
-                        
-//                         // WEIGHT CALCULATION: Inverse Distance Weighting
-                        
-//                         // 1. Calculate Weight (1 / distance)
-//                         // Add epsilon to avoid divide-by-zero
-//                         float weight = 1.0f / (cell.distSq[j]  + 1e-6f);
-
-//                         // 2. Dot Product Check
-//                         if (v.normal.dot(dir) < 0) {
-//                             scoreInside += weight;
-//                         } else {
-//                             scoreOutside += weight;
-//                         }
-//                     }
-
-//                     // DECISION: Whichever score is higher wins
-//                     if (scoreInside > scoreOutside) {
-//                         outInside.push_back(test_point);
-//                     } else {
-//                         outOutside.push_back(test_point);
-//                     }
-//                 }
-//             }
-//         }
-//     }
-// }
+    for (size_t w = 0; w < band.size(); w++) {
+        uint64_t bits = band[w];
+        size_t slot = wordRank[w];
+
+        while (bits) {
+            size_t idx = w * 64 + (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            Vec3 test_point;
+            test_point.x = minBound.x + ((int)(idx % dimX) * spacing);
+            test_point.y = minBound.y + ((int)((idx / dimX) % dimY) * spacing);
+            test_point.z = minBound.z + ((int)(idx / plane) * spacing);
+
+            float score = 0;
+            for (int j = 0; j < k; j++) {
+                int v = std::max(candidates[slot * k + j], 0);
+                float side = planeX[v] * test_point.x + planeY[v] * test_point.y + planeZ[v] * test_point.z - planeOffset[v];
+                score += side < 0 ? weights[slot * k + j] : -weights[slot * k + j];
+            }
+            slot++;
+
+            if (score > 0) {
+                outInside.push_back(test_point);
+            } else {
+                outOutside.push_back(test_point);
+            }
+        }
+    }
+
+    DEBUG_LOG("SeparateGridPointsVote: " << bandCells << " band cells of " << totalCells << ", "
+              << (band.size() * 12 + bandCells * k * 8) / (1024 * 1024) << " MB");
+}
 
 void FillInternalVoid(
     const std::vector<Vec3>& shellPoints,
@@ -267,11 +381,11 @@ void FillInternalVoid(
     Vec3 maxBound,
     float spacing,
     std::vector<Vec3>& allPoints,
-    std::vector<std::vector<Vec3>>& layers
+    std::vector<uint16_t>* burialDepth
 ) {
+    TRACE_SPAN("FillInternalVoid");
     // Clear outputs to ensure fresh start
     allPoints.clear();
-    layers.clear();
 
     // 1. Setup Grid Dimensions
     // Added +1 buffer to ensure coverage
@@ -283,37 +397,45 @@ void FillInternalVoid(
     // 2. The "Marked" Map (visited/wall tracker)
     std::vector<bool> marked(totalCells, false);
 
+    // Depth of every filled cell, written as the BFS reaches it
+    if (burialDepth) {
+        burialDepth->assign(totalCells, BURIAL_UNFILLED);
+    }
+    uint16_t depth = 1;
+
     // 3. Mark the Shells (The Walls)
     for (const auto& p : shellPoints) {
-        int idx = vectoIndex(p, dimX, dimY, dimZ, minBound, spacing);
+        int64_t idx = vectoIndex(p, dimX, dimY, dimZ, minBound, spacing);
         if (idx != -1) {
             marked[idx] = true; 
         }
     }
 
+    // The +1 buffer layer on the high faces is never classified. Wall it off, or a box cut through
+    // the protein (--roi) lets the fill leak along it into the solvent.
+    size_t sliceCells = (size_t)dimX * dimY;
+    for (int z = 0; z < dimZ; z++) {
+        for (int y = 0; y < dimY; y++) marked[z * sliceCells + (size_t)y * dimX + (dimX - 1)] = true;
+        for (int x = 0; x < dimX; x++) marked[z * sliceCells + (size_t)(dimY - 1) * dimX + x] = true;
+    }
+    for (size_t i = 0; i < sliceCells; i++) marked[(size_t)(dimZ - 1) * sliceCells + i] = true;
+
     // 4. Initialize Queue with Seeds
-    std::vector<int> currentLayerIndices;
-    std::vector<Vec3> layer0;
+    std::vector<int64_t> currentLayerIndices;
     
     for (const auto& p : initialInsidePoints) {
-        int idx = vectoIndex(p, dimX, dimY, dimZ, minBound, spacing);
+        int64_t idx = vectoIndex(p, dimX, dimY, dimZ, minBound, spacing);
         
         // Only process if valid and NOT already marked (shell or duplicate)
         if (idx != -1 && !marked[idx]) {
             marked[idx] = true; 
             currentLayerIndices.push_back(idx);
+            if (burialDepth) (*burialDepth)[idx] = depth;
             
             // Reconstruct point to ensure grid alignment consistency
-            Vec3 alignedP = indextoVec3(idx, dimX, dimY, dimZ, minBound, spacing);
-            
-            allPoints.push_back(alignedP);
-            layer0.push_back(alignedP);
+            allPoints.push_back(indextoVec3(idx, dimX, dimY, dimZ, minBound, spacing));
         }
     }
-    
-    if (!layer0.empty()) {
-        layers.push_back(layer0);
-    }
 
     // 5. BFS Loop (Flood Fill)
     // Neighbors: +X, -X, +Y, -Y, +Z, -Z
@@ -321,18 +443,20 @@ void FillInternalVoid(
     const int dy[6] = {0, 0, 1, -1, 0, 0};
     const int dz[6] = {0, 0, 0, 0, 1, -1};
 
+    std::vector<int64_t> nextLayerIndices;
+
     while (!currentLayerIndices.empty()) {
-        std::vector<int> nextLayerIndices;
-        std::vector<Vec3> nextLayerVecs;
+        nextLayerIndices.clear();
+        if (depth < std::numeric_limits<uint16_t>::max()) depth++;
 
-        for (int currentIdx : currentLayerIndices) {
+        for (int64_t currentIdx : currentLayerIndices) {
             
             // Manual index unpacking for neighbor calculation
-            int slice = dimX * dimY;
-            int cz = currentIdx / slice;
-            int rem = currentIdx % slice;
-            int cy = rem / dimX;
-            int cx = rem % dimX;
+            int64_t slice = (int64_t)dimX * dimY;
+            int cz = (int)(currentIdx / slice);
+            int64_t rem = currentIdx % slice;
+            int cy = (int)(rem / dimX);
+            int cx = (int)(rem % dimX);
 
             for (int i = 0; i < 6; i++) {
                 int nx = cx + dx[i];
@@ -342,40 +466,35 @@ void FillInternalVoid(
                 // Bounds Check
                 if (nx >= 0 && nx < dimX && ny >= 0 && ny < dimY && nz >= 0 && nz < dimZ) {
                     
-                    int nIdx = nz * slice + ny * dimX + nx;
+                    int64_t nIdx = nz * slice + (int64_t)ny * dimX + nx;
 
                     if (!marked[nIdx]) {
                         marked[nIdx] = true; // Mark visited immediately
                         nextLayerIndices.push_back(nIdx);
+                        if (burialDepth) (*burialDepth)[nIdx] = depth;
                         
-                        Vec3 nPos = indextoVec3(nIdx, dimX, dimY, dimZ, minBound, spacing);
-                        
-                        nextLayerVecs.push_back(nPos);
-                        allPoints.push_back(nPos);
+                        allPoints.push_back(indextoVec3(nIdx, dimX, dimY, dimZ, minBound, spacing));
                     }
                 }
             }
         }
 
-        if (!nextLayerVecs.empty()) {
-            layers.push_back(nextLayerVecs);
-        }
-
-        currentLayerIndices = nextLayerIndices;
+        currentLayerIndices.swap(nextLayerIndices);
     }
 }
 
 
 void WriteWaterPDB(const std::vector<Vec3>& waterPositions, const std::string& filename) {
-    FILE* file = fopen(filename.c_str(), "w");
+    TRACE_SPAN("WriteWaterPDB");
+    std::unique_ptr<std::ostream> file = openOutputStream(filename);
     if (!file) {
         fprintf(stderr, "Error: Could not open file %s for writing.\n", filename.c_str());
         return;
     }
 
     // PDB Header
-    fprintf(file, "REMARK    GENERATED BY SOLVATION TOOL\n");
-    fprintf(file, "REMARK    THIS FILE CONTAINS %zu WATER MOLECULES\n", waterPositions.size());
+    streamPrintf(*file, "REMARK    GENERATED BY SOLVATION TOOL\n");
+    streamPrintf(*file, "REMARK    THIS FILE CONTAINS %zu WATER MOLECULES\n", waterPositions.size());
 
     int serial = 1;  
     int resSeq = 1;  
@@ -401,7 +520,7 @@ void WriteWaterPDB(const std::vector<Vec3>& waterPositions, const std::string& f
         // 22:    Chain 'A'
         // 23-26: ResSeq (4d)
         // 31-54: Coords (8.3f)
-        fprintf(file, "ATOM  %5d  OW  HOH A%4d    %8.3f%8.3f%8.3f  1.00  0.00           O  \n",
+        streamPrintf(*file, "ATOM  %5d  OW  HOH A%4d    %8.3f%8.3f%8.3f  1.00  0.00           O  \n",
             printSerial,
             printResSeq,
             pos.x,
@@ -413,8 +532,76 @@ void WriteWaterPDB(const std::vector<Vec3>& waterPositions, const std::string& f
         resSeq++;
     }
 
-    fprintf(file, "END\n");
-    fclose(file);
+    streamPrintf(*file, "END\n");
+    if (!closeOutputStream(*file)) {
+        fprintf(stderr, "Error: Could not write %s\n", filename.c_str());
+        return;
+    }
     
     printf("Successfully wrote %.3e waters to %s\n", (double)waterPositions.size(), filename.c_str());
-}
\ No newline at end of file
+}
+
+bool WriteDXMap(
+    const std::string& filename,
+    const std::string& title,
+    int dimX,
+    int dimY,
+    int dimZ,
+    Vec3 minBound,
+    double spacing,
+    const std::function<double(size_t)>& value
+) {
+    size_t slice = (size_t)dimX * dimY;
+    size_t totalCells = slice * dimZ;
+
+    // crop to the nonzero cells, the rest of the box is zero
+    int x0 = dimX, y0 = dimY, z0 = dimZ, x1 = 0, y1 = 0, z1 = 0;
+    for (size_t i = 0; i < totalCells; i++) {
+        if (value(i) == 0) continue;
+        int z = (int)(i / slice);
+        int y = (int)((i % slice) / dimX);
+        int x = (int)(i % dimX);
+        x0 = std::min(x0, x); x1 = std::max(x1, x + 1);
+        y0 = std::min(y0, y); y1 = std::max(y1, y + 1);
+        z0 = std::min(z0, z); z1 = std::max(z1, z + 1);
+    }
+    if (x0 >= x1) {
+        x0 = y0 = z0 = 0;
+        x1 = y1 = z1 = 1;
+    }
+
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "Error: Could not open file " << filename << " for writing." << std::endl;
+        return false;
+    }
+
+    int nx = x1 - x0, ny = y1 - y0, nz = z1 - z0;
+    Vec3 origin = indextoVec3((int64_t)z0 * slice + (int64_t)y0 * dimX + x0, dimX, dimY, dimZ, minBound, spacing);
+
+    fprintf(file, "# %s\n", title.c_str());
+    fprintf(file, "object 1 class gridpositions counts %d %d %d\n", nx, ny, nz);
+    fprintf(file, "origin %.4f %.4f %.4f\n", origin.x, origin.y, origin.z);
+    fprintf(file, "delta %.4f 0 0\ndelta 0 %.4f 0\ndelta 0 0 %.4f\n", spacing, spacing, spacing);
+    fprintf(file, "object 2 class gridconnections counts %d %d %d\n", nx, ny, nz);
+    fprintf(file, "object 3 class array type double rank 0 items %zu data follows\n", (size_t)nx * ny * nz);
+
+    // DX runs z fastest
+    size_t column = 0;
+    for (int x = x0; x < x1; x++) {
+        for (int y = y0; y < y1; y++) {
+            for (int z = z0; z < z1; z++) {
+                fprintf(file, "%g%s", value((size_t)z * slice + (size_t)y * dimX + x), (++column % 3 == 0) ? "\n" : " ");
+            }
+        }
+    }
+    if (column % 3 != 0) fprintf(file, "\n");
+
+    fprintf(file, "attribute \"dep\" string \"positions\"\n");
+    fprintf(file, "object \"map\" class field\n");
+    fprintf(file, "component \"positions\" value 1\n");
+    fprintf(file, "component \"connections\" value 2\n");
+    fprintf(file, "component \"data\" value 3\n");
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,225 @@
+#include "lattice.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <tuple>
+
+
+// Bump when the file layout changes
+static const uint32_t LATTICE_FORMAT_VERSION = 1;
+
+// Files are little-endian whatever the host: a 24 byte header (magic AWL1, uint32 version, float64 spacing,
+// uint64 word count) and 24 bytes per word (int32 z, y, x, uint32 0, uint64 bits)
+static const size_t HEADER_BYTES = 24;
+static const size_t WORD_BYTES = 24;
+
+static void putLE(unsigned char* out, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint64_t getLE(const unsigned char* in, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) value |= (uint64_t)in[i] << (8 * i);
+    return value;
+}
+
+static bool before(const LatticeSet::Word& a, const LatticeSet::Word& b) {
+    return std::tie(a.z, a.y, a.x) < std::tie(b.z, b.y, b.x);
+}
+
+static bool sameKey(const LatticeSet::Word& a, const LatticeSet::Word& b) {
+    return a.z == b.z && a.y == b.y && a.x == b.x;
+}
+
+size_t LatticeSet::count() const {
+    size_t total = 0;
+    for (const Word& w : words) {
+        total += (size_t)__builtin_popcountll(w.bits);
+    }
+    return total;
+}
+
+double latticeStep(double spacing, double unit) {
+    for (int n = 1; n <= 1000; n++) {
+        double units = n * spacing / unit;
+        if (std::fabs(units - std::round(units)) < 1e-6 * std::max(1.0, units)) return std::round(units) * unit;
+    }
+    return 0;
+}
+
+bool makeLatticeSet(const std::vector<std::array<double, 3>>& points, LatticeSet& set, std::string& error) {
+    TRACE_SPAN("makeLatticeSet");
+    set.words.clear();
+    set.words.reserve(points.size());
+
+    for (const std::array<double, 3>& p : points) {
+        long long index[3];
+        for (int axis = 0; axis < 3; axis++) {
+            double steps = p[axis] / LATTICE_SPACING;
+            index[axis] = std::llround(steps);
+            if (std::fabs(steps - (double)index[axis]) > 1e-3) {
+                error = "point (" + std::to_string(p[0]) + ", " + std::to_string(p[1]) + ", " + std::to_string(p[2]) +
+                        ") is not on the " + std::to_string(LATTICE_SPACING) + " A lattice";
+                return false;
+            }
+        }
+        // floor division, so negative x indices land in the word below
+        long long word = index[0] >= 0 ? index[0] / 64 : -((-index[0] + 63) / 64);
+        set.words.push_back({(int32_t)index[2], (int32_t)index[1], (int32_t)word, 0, (uint64_t)1 << (index[0] - word * 64)});
+    }
+
+    std::sort(set.words.begin(), set.words.end(), before);
+
+    // fold the one-bit words of each key together
+    size_t kept = 0;
+    for (size_t i = 0; i < set.words.size(); i++) {
+        if (kept > 0 && sameKey(set.words[kept - 1], set.words[i])) {
+            set.words[kept - 1].bits |= set.words[i].bits;
+        } else {
+            set.words[kept++] = set.words[i];
+        }
+    }
+    set.words.resize(kept);
+    return true;
+}
+
+std::vector<std::array<double, 3>> latticePoints(const LatticeSet& set) {
+    std::vector<std::array<double, 3>> points;
+    points.reserve(set.count());
+    for (const LatticeSet::Word& w : set.words) {
+        uint64_t bits = w.bits;
+        while (bits) {
+            int b = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            points.push_back({((double)w.x * 64 + b) * LATTICE_SPACING, w.y * LATTICE_SPACING, w.z * LATTICE_SPACING});
+        }
+    }
+    return points;
+}
+
+LatticeSet combineLatticeSets(const LatticeSet& a, const LatticeSet& b, LatticeOp op) {
+    TRACE_SPAN("combineLatticeSets");
+    LatticeSet result;
+    size_t i = 0, j = 0;
+
+    auto emit = [&](const LatticeSet::Word& key, uint64_t bits) {
+        if (bits) result.words.push_back({key.z, key.y, key.x, 0, bits});
+    };
+
+    while (i < a.words.size() || j < b.words.size()) {
+        bool takeA = j == b.words.size() || (i < a.words.size() && before(a.words[i], b.words[j]));
+        bool takeB = i == a.words.size() || (j < b.words.size() && before(b.words[j], a.words[i]));
+
+        if (takeA) {
+            // only in a
+            if (op != LatticeOp::INTERSECTION) emit(a.words[i], a.words[i].bits);
+            i++;
+        } else if (takeB) {
+            // only in b
+            if (op == LatticeOp::UNION) emit(b.words[j], b.words[j].bits);
+            j++;
+        } else {
+            uint64_t bits = op == LatticeOp::UNION        ? a.words[i].bits | b.words[j].bits
+                          : op == LatticeOp::INTERSECTION ? a.words[i].bits & b.words[j].bits
+                                                          : a.words[i].bits & ~b.words[j].bits;
+            emit(a.words[i], bits);
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+bool writeLatticeSet(const LatticeSet& set, const std::string& filename) {
+    TRACE_SPAN("writeLatticeSet");
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open " << filename << " for writing." << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> bytes(HEADER_BYTES + set.words.size() * WORD_BYTES);
+    uint64_t spacingBits;
+    std::memcpy(&spacingBits, &LATTICE_SPACING, sizeof(spacingBits));
+    std::memcpy(bytes.data(), "AWL1", 4);
+    putLE(&bytes[4], LATTICE_FORMAT_VERSION, 4);
+    putLE(&bytes[8], spacingBits, 8);
+    putLE(&bytes[16], set.words.size(), 8);
+
+    unsigned char* out = bytes.data() + HEADER_BYTES;
+    for (const LatticeSet::Word& w : set.words) {
+        putLE(out, (uint32_t)w.z, 4);
+        putLE(out + 4, (uint32_t)w.y, 4);
+        putLE(out + 8, (uint32_t)w.x, 4);
+        putLE(out + 12, 0, 4);
+        putLE(out + 16, w.bits, 8);
+        out += WORD_BYTES;
+    }
+
+    file.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize)bytes.size());
+    if (!file) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool readLatticeSet(const std::string& filename, LatticeSet& set, std::string& error) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        error = "could not open " + filename;
+        return false;
+    }
+    uint64_t fileSize = (uint64_t)file.tellg();
+    file.seekg(0);
+
+    unsigned char header[HEADER_BYTES];
+    if (!file.read(reinterpret_cast<char*>(header), HEADER_BYTES) || std::memcmp(header, "AWL1", 4) != 0 ||
+        getLE(&header[4], 4) != LATTICE_FORMAT_VERSION) {
+        error = filename + " is not a lattice set of this version";
+        return false;
+    }
+    uint64_t spacingBits = getLE(&header[8], 8);
+    double spacing;
+    std::memcpy(&spacing, &spacingBits, sizeof(spacing));
+    if (spacing != LATTICE_SPACING) {
+        error = filename + " is on a " + std::to_string(spacing) + " A lattice";
+        return false;
+    }
+
+    // the count is checked against the file before anything is allocated for it
+    uint64_t count = getLE(&header[16], 8);
+    if (count > (fileSize - HEADER_BYTES) / WORD_BYTES) {
+        error = filename + " is truncated";
+        return false;
+    }
+
+    std::vector<unsigned char> bytes(count * WORD_BYTES);
+    if (!file.read(reinterpret_cast<char*>(bytes.data()), (std::streamsize)bytes.size())) {
+        error = filename + " is truncated";
+        return false;
+    }
+
+    set.words.resize(count);
+    const unsigned char* in = bytes.data();
+    for (size_t i = 0; i < count; i++, in += WORD_BYTES) {
+        LatticeSet::Word& w = set.words[i];
+        w.z = (int32_t)(uint32_t)getLE(in, 4);
+        w.y = (int32_t)(uint32_t)getLE(in + 4, 4);
+        w.x = (int32_t)(uint32_t)getLE(in + 8, 4);
+        w.reserved = 0;
+        w.bits = getLE(in + 16, 8);
+
+        // combineLatticeSets merges sorted, unique keys
+        if (i > 0 && !before(set.words[i - 1], w)) {
+            error = filename + " is corrupt (words out of order)";
+            set.words.clear();
+            return false;
+        }
+    }
+    return true;
+}
@@ -1,22 +1,53 @@
 #include "AtomicRadii.h"
+#include "cache.h"
 #include "cluster.h"
+#include "compress.h"
 #include "common.h"
+#include "descriptors.h"
 #include "internals.h"
+#include "lattice.h"
 #include "pdbtovector.h"
 #include "pymol.h"
+#include "server.h"
 #include "map.h"
-
+#include "mesh.h"
+#include "mmcif.h"
+#include "morton.h"
+#include "morphology.h"
+#include "parallel.h"
+#include "placement.h"
+#include "probes.h"
+#include "region.h"
+#include "stream.h"
+#include "surface.h"
+#include "tiling.h"
+#include "trajectory.h"
+
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
 
 
 double hash_spacing = 3;
+double cell_size = 0;          // overlap pass hash cells, 0 = sized from the water and cutoff radii
+double roi_margin = 8;         // grid kept around the region of interest
+double roi_radius = 8;         // distance around a residue selection that makes up the region
 double grid_spacing = .25;
 double water_diameter = 2.5;
 double cutoff_distance = 5;
 float shellradius = 3.5;
+float probe_radius = 1.5;
+float vertex_density = 1.0;
+std::string classifier = "vert";
+size_t max_memory_mb = 0;
+double skin_distance = 0.125;
+double min_occupancy = 0.5;
 std::string structure_file = "";
 
 
@@ -24,13 +55,194 @@ int main(int argc, char* argv[]){
 
     auto start_time = std::chrono::high_resolution_clock::now();
 
+// ---------- features subcommand: k nearest protein atoms per site as .npy tensors ----------
+    if (argc > 1 && std::string(argv[1]) == "features") {
+        std::string protein_file = "";
+        std::string sites_file = "";
+        std::string features_output = "";
+        FeatureSettings settings;
+
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+
+            if ((arg == "-p" || arg == "--pdb") && i + 1 < argc) {
+                protein_file = argv[++i];
+            }
+            else if ((arg == "-w" || arg == "--sites") && i + 1 < argc) {
+                sites_file = argv[++i];
+            }
+            else if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+                features_output = std::string("results/") + argv[++i];
+            }
+            else if ((arg == "-k" || arg == "-t" || arg == "--threads") && i + 1 < argc) {
+                // counts are whole numbers: "2.5" or "8x" are rejected instead of truncated
+                std::string test_value = argv[++i];
+                int value = 0;
+                size_t used = 0;
+                try {
+                    value = std::stoi(test_value, &used);
+                }
+                catch (const std::exception& e) {
+                    used = 0;
+                }
+                if (used == 0 || used != test_value.size()) {
+                    std::cerr << "Error: Invalid value for " << arg << ". '" << test_value << "' is not a valid integer." << std::endl;
+                    return 1;
+                }
+                if (value <= 0) {
+                    std::cerr << "Error: " << arg << " must be positive." << std::endl;
+                    return 1;
+                }
+                if (arg == "-k") settings.neighbors = value;
+                else setThreadCount((unsigned int)value);
+            }
+            else if (arg == "--max-distance" && i + 1 < argc) {
+                std::string test_value = argv[++i];
+                double value;
+                try {
+                    value = std::stod(test_value);
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid value for " << arg << ". '" << test_value << "' is not a valid number." << std::endl;
+                    return 1;
+                }
+                if (value <= 0) {
+                    std::cerr << "Error: " << arg << " must be positive." << std::endl;
+                    return 1;
+                }
+                settings.maxDistance = value;
+            }
+            else {
+                std::cerr << "Error: Unknown or incomplete argument '" << arg << "'" << std::endl;
+                std::cerr << "Usage: " << argv[0] << " features -p <pdb> -o <out> [-w <sites pdb>] [-k <count>] [--max-distance <value>] [-t <threads>]" << std::endl;
+                return 1;
+            }
+        }
+        if (protein_file.empty() || features_output.empty()) {
+            std::cerr << "Usage: " << argv[0] << " features -p <pdb> -o <out> [-w <sites pdb>] [-k <count>] [--max-distance <value>] [-t <threads>]" << std::endl;
+            return 1;
+        }
+
+        // waters of the structure are the sites unless a sites file is given; they are never neighbors
+        std::vector<Atom> protein;
+        std::vector<std::array<double, 3>> sites;
+        std::vector<Atom> structure = std::get<0>(pdbtovector(protein_file));
+        for (const Atom& atom : structure) {
+            bool water = atom.get_resname() == "HOH" || atom.get_atomname() == "OW";
+            if (!water) protein.push_back(atom);
+            else if (sites_file.empty()) sites.push_back(atom.getCoords());
+        }
+        if (!sites_file.empty()) {
+            std::vector<Atom> sitesAtoms = std::get<0>(pdbtovector(sites_file));
+            for (const Atom& site : sitesAtoms) {
+                sites.push_back(site.getCoords());
+            }
+        }
+        if (protein.empty() || sites.empty()) {
+            std::cerr << "Error: Need protein atoms and sites, found " << protein.size() << " atoms and " << sites.size() << " sites" << std::endl;
+            return 1;
+        }
+
+        std::cout << "-> " << settings.neighbors << " nearest of " << protein.size() << " atoms for " << sites.size() << " sites" << std::endl;
+        SiteFeatures features = extractFeatures(protein, sites, settings);
+
+        size_t k = (size_t)settings.neighbors;
+        std::vector<float> sitePoints;
+        for (const std::array<double, 3>& p : sites) {
+            sitePoints.insert(sitePoints.end(), {(float)p[0], (float)p[1], (float)p[2]});
+        }
+        bool written =
+            writeNpy(features_output + "_geometry.npy", "<f4", features.geometry.data(), sizeof(float), {sites.size(), k, 4}) &&
+            writeNpy(features_output + "_types.npy", "<i4", features.types.data(), sizeof(int32_t), {sites.size(), k, 2}) &&
+            writeNpy(features_output + "_atoms.npy", "<i4", features.atoms.data(), sizeof(int32_t), {sites.size(), k}) &&
+            writeNpy(features_output + "_sites.npy", "<f4", sitePoints.data(), sizeof(float), {sites.size(), 3});
+        if (!written) {
+            std::cerr << "Error: Could not write " << features_output << "_*.npy" << std::endl;
+            return 1;
+        }
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cout << "-> Wrote " << features_output << "_{geometry,types,atoms,sites}.npy in " << std::fixed << std::setprecision(2) << elapsed << " s" << std::endl;
+        return 0;
+    }
+
+// ---------- lattice subcommand: set algebra between the water sets of --lattice runs ----------
+    if (argc > 1 && std::string(argv[1]) == "lattice") {
+        std::string usage = std::string("Usage: ") + argv[0] + " lattice <union|intersect|diff> <a.lattice> <b.lattice> [<c.lattice> ...] -o <out>";
+        std::string lattice_output = "";
+        std::vector<std::string> set_files;
+
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+
+            if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+                lattice_output = std::string("results/") + argv[++i];
+            }
+            else if (!arg.empty() && arg[0] != '-') {
+                set_files.push_back(arg);
+            }
+            else {
+                std::cerr << "Error: Unknown or incomplete argument '" << arg << "'" << std::endl;
+                std::cerr << usage << std::endl;
+                return 1;
+            }
+        }
+
+        std::string op_name = argc > 2 ? argv[2] : "";
+        if ((op_name != "union" && op_name != "intersect" && op_name != "diff") || set_files.size() < 2 || lattice_output.empty()) {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+        LatticeOp op = op_name == "union" ? LatticeOp::UNION : op_name == "intersect" ? LatticeOp::INTERSECTION : LatticeOp::DIFFERENCE;
+
+        // folded left to right: diff keeps the points of the first set that are in none of the others
+        LatticeSet result;
+        for (size_t f = 0; f < set_files.size(); f++) {
+            LatticeSet set;
+            std::string lattice_error;
+            if (!readLatticeSet(set_files[f], set, lattice_error)) {
+                std::cerr << "Error: " << lattice_error << std::endl;
+                return 1;
+            }
+            std::cout << "-> " << set_files[f] << ": " << set.count() << " points in " << set.words.size() << " words" << std::endl;
+            result = f == 0 ? std::move(set) : combineLatticeSets(result, set, op);
+        }
+
+        std::vector<Atom> points;
+        for (const std::array<double, 3>& p : latticePoints(result)) {
+            points.push_back(Atom("HOH", "O", p));
+        }
+        std::cout << "-> " << op_name << ": " << points.size() << " points" << std::endl;
+
+        if (!writeLatticeSet(result, lattice_output + ".lattice")) return 1;
+        vectortopdb(points, lattice_output + ".pdb");
+        std::cout << "-> Wrote " << lattice_output << ".lattice and " << lattice_output << ".pdb" << std::endl;
+        return 0;
+    }
+
 // ---------- input handling ----------
     std::string input_file = "";
     std::string vert_file = "";
+    std::string face_file = "";
     std::string output_file = "";
     std::string r_value = "3.5";
     bool only_cluster = false;
     bool pymol = false;
+    bool stream_mode = false;
+    bool place_sites = false;
+    bool write_burial = false;
+    std::vector<double> probe_diameters;
+    bool morton_order = false;
+    bool snap_lattice = false;
+    std::string output_format = "pdb";
+    std::string output_compression = "";
+    int hydrophobic_scale = 0;
+    bool use_cache = true;
+    std::string serve_target = "";
+    std::string trajectory_file = "";
+    std::string roi_spec = "";
+    std::string parent_file = "";
+    std::string parent_waters_file = "";
 
 
     for (int i = 1; i < argc; ++i) {
@@ -43,6 +255,9 @@ int main(int argc, char* argv[]){
         else if ((arg == "-v" || arg == "--vert") && i + 1 < argc) {
             vert_file = argv[++i];
         } 
+        else if ((arg == "--face") && i + 1 < argc) {
+            face_file = argv[++i];
+        }
         else if ((arg == "-o" || arg == "--out") && i + 1 < argc) {
             output_file = std::string("results/") + argv[++i];
         }         
@@ -74,37 +289,398 @@ int main(int argc, char* argv[]){
                 return 1;
             }
         }
+        else if ((arg == "--probe") && i + 1 < argc) {
+            std::string test_probe = argv[++i];
+            try {
+                probe_radius = std::stof(test_probe);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Invalid probe radius. '" << test_probe << "' is not a valid number." << std::endl;
+                return 1;
+            }
+            if (probe_radius <= 0) {
+                std::cerr << "Error: Probe radius must be positive." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--density") && i + 1 < argc) {
+            std::string test_density = argv[++i];
+            try {
+                vertex_density = std::stof(test_density);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Invalid vertex density. '" << test_density << "' is not a valid number." << std::endl;
+                return 1;
+            }
+            if (vertex_density <= 0) {
+                std::cerr << "Error: Vertex density must be positive." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--classifier") && i + 1 < argc) {
+            classifier = argv[++i];
+            if (classifier != "vert" && classifier != "vote" && classifier != "morph" && classifier != "mesh") {
+                std::cerr << "Error: Unknown classifier '" << classifier << "' (expected vert, vote, morph or mesh)." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--max-memory") && i + 1 < argc) {
+            std::string test_memory = argv[++i];
+            try {
+                max_memory_mb = (size_t)std::stoull(test_memory);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Invalid memory budget. '" << test_memory << "' is not a valid number of MB." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc) {
+            // a whole number: "-1" would wrap to 4294967295 threads and "2.5" be truncated
+            std::string test_threads = argv[++i];
+            int threads = 0;
+            size_t used = 0;
+            try {
+                threads = std::stoi(test_threads, &used);
+            }
+            catch (const std::exception& e) {
+                used = 0;
+            }
+            if (used == 0 || used != test_threads.size()) {
+                std::cerr << "Error: Invalid thread count. '" << test_threads << "' is not a valid integer." << std::endl;
+                return 1;
+            }
+            if (threads <= 0) {
+                std::cerr << "Error: Thread count must be positive." << std::endl;
+                return 1;
+            }
+            setThreadCount((unsigned int)threads);
+        }
         else if ((arg == "-cluster")) {
             only_cluster = true;
         }
         else if ((arg == "-pymol")) {
             pymol=true;
         }
+        else if ((arg == "--no-cache")) {
+            use_cache = false;
+        }
+        else if ((arg == "--stream")) {
+            stream_mode = true;
+        }
+        else if ((arg == "--place")) {
+            place_sites = true;
+        }
+        else if ((arg == "--cell-size") && i + 1 < argc) {
+            std::string test_cell = argv[++i];
+            try {
+                cell_size = std::stod(test_cell);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Invalid cell size. '" << test_cell << "' is not a valid number." << std::endl;
+                return 1;
+            }
+            if (cell_size <= 0) {
+                std::cerr << "Error: Cell size must be positive." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--roi") && i + 1 < argc) {
+            roi_spec = argv[++i];
+        }
+        else if ((arg == "--parent") && i + 1 < argc) {
+            parent_file = argv[++i];
+        }
+        else if ((arg == "--parent-waters") && i + 1 < argc) {
+            parent_waters_file = argv[++i];
+        }
+        else if ((arg == "--roi-margin" || arg == "--roi-radius") && i + 1 < argc) {
+            std::string test_distance = argv[++i];
+            double distance;
+            try {
+                distance = std::stod(test_distance);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Invalid distance for " << arg << ". '" << test_distance << "' is not a valid number." << std::endl;
+                return 1;
+            }
+            if (distance < 0) {
+                std::cerr << "Error: " << arg << " cannot be negative." << std::endl;
+                return 1;
+            }
+            (arg == "--roi-margin" ? roi_margin : roi_radius) = distance;
+        }
+        else if ((arg == "--morton")) {
+            morton_order = true;
+        }
+        else if ((arg == "--lattice")) {
+            snap_lattice = true;
+        }
+        else if ((arg == "--format") && i + 1 < argc) {
+            output_format = argv[++i];
+            if (output_format != "pdb" && output_format != "cif" && output_format != "bcif") {
+                std::cerr << "Error: Invalid output format '" << output_format << "'. Use pdb, cif or bcif." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--compress") && i + 1 < argc) {
+            std::string codec = argv[++i];
+            if (codec != "gz" && codec != "zst") {
+                std::cerr << "Error: Invalid compression '" << codec << "'. Use gz or zst." << std::endl;
+                return 1;
+            }
+            output_compression = "." + codec;
+            std::string error;
+            if (!compressionAvailable(output_compression, &error)) {
+                std::cerr << "Error: " << error << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--burial")) {
+            write_burial = true;
+        }
+        else if ((arg == "--probe-sweep") && i + 1 < argc) {
+            std::string test_probes = argv[++i];
+            std::stringstream list(test_probes);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                double diameter = 0;
+                try {
+                    diameter = std::stod(item);
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "Error: Invalid probe diameter. '" << item << "' is not a valid number." << std::endl;
+                    return 1;
+                }
+                if (diameter <= 0) {
+                    std::cerr << "Error: Probe diameters must be positive." << std::endl;
+                    return 1;
+                }
+                probe_diameters.push_back(diameter);
+            }
+            if (probe_diameters.empty()) {
+                std::cerr << "Error: --probe-sweep needs at least one diameter." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--hydrophobic") && i + 1 < argc) {
+            std::string test_scale = argv[++i];
+            if (test_scale != "1986" && test_scale != "1989" && test_scale != "1998") {
+                std::cerr << "Error: Invalid hydrophobicity scale '" << test_scale << "'. Use 1986, 1989 or 1998." << std::endl;
+                return 1;
+            }
+            hydrophobic_scale = std::stoi(test_scale);
+        }
+        else if ((arg == "--serve") && i + 1 < argc) {
+            serve_target = argv[++i];
+        }
+        else if ((arg == "--trajectory") && i + 1 < argc) {
+            trajectory_file = argv[++i];
+        }
+        else if ((arg == "--skin") && i + 1 < argc) {
+            std::string test_skin = argv[++i];
+            try {
+                skin_distance = std::stod(test_skin);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Invalid skin distance. '" << test_skin << "' is not a valid number." << std::endl;
+                return 1;
+            }
+            if (skin_distance < 0) {
+                std::cerr << "Error: Skin distance cannot be negative." << std::endl;
+                return 1;
+            }
+        }
+        else if ((arg == "--min-occupancy") && i + 1 < argc) {
+            std::string test_occupancy = argv[++i];
+            try {
+                min_occupancy = std::stod(test_occupancy);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: Invalid occupancy. '" << test_occupancy << "' is not a valid number." << std::endl;
+                return 1;
+            }
+            if (min_occupancy < 0 || min_occupancy > 1) {
+                std::cerr << "Error: Occupancy must be a fraction between 0 and 1." << std::endl;
+                return 1;
+            }
+        }
     
 
         else {
             std::cerr << "Error: Unknown or incomplete argument '" << arg << "'" << std::endl;
-            std::cerr << "Usage: " << argv[0] << " -p <pdb> -v <vert> -o <out> [-r <value>] [-cluster] [-pymol]" << std::endl;
+            std::cerr << "Usage: " << argv[0] << " -p <pdb> -o <out> [-v <vert>] [-r <value>] [-s <value>] [--probe <value>] [--density <value>] [--classifier <vert|vote|morph|mesh>] [--face <face>] [--max-memory <MB>] [--cell-size <value>] [-t <threads>] [--stream] [--place] [--burial] [--probe-sweep <d1,d2,..>] [--hydrophobic <1986|1989|1998>] [--morton] [--lattice] [--roi <box:..|sphere:..|sel:..>] [--roi-margin <value>] [--roi-radius <value>] [--parent <pdb> --parent-waters <pdb>] [--serve <socket|->] [--trajectory <file>] [--skin <value>] [--min-occupancy <value>] [--format <pdb|cif|bcif>] [--compress <gz|zst>] [--no-cache] [-cluster] [-pymol]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (max_memory_mb > 0 && classifier != "vert") {
+        std::cerr << "Error: --max-memory currently supports only --classifier vert" << std::endl;
+        return 1;
+    }
+
+    if (!serve_target.empty() && (stream_mode || only_cluster)) {
+        std::cerr << "Error: --serve cannot be combined with --stream or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (place_sites && (stream_mode || only_cluster || !trajectory_file.empty())) {
+        std::cerr << "Error: --place cannot be combined with --stream, --trajectory or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (write_burial && (stream_mode || only_cluster || max_memory_mb > 0 || !serve_target.empty() || !trajectory_file.empty())) {
+        std::cerr << "Error: --burial cannot be combined with --stream, --max-memory, --serve, --trajectory or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (!probe_diameters.empty() && (stream_mode || only_cluster || max_memory_mb > 0 || !trajectory_file.empty())) {
+        std::cerr << "Error: --probe-sweep cannot be combined with --stream, --max-memory, --trajectory or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (hydrophobic_scale && (stream_mode || only_cluster || !serve_target.empty() || !trajectory_file.empty())) {
+        std::cerr << "Error: --hydrophobic cannot be combined with --stream, --serve, --trajectory or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (!roi_spec.empty() && (only_cluster || !trajectory_file.empty())) {
+        std::cerr << "Error: --roi cannot be combined with --trajectory or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (parent_file.empty() != parent_waters_file.empty()) {
+        std::cerr << "Error: --parent and --parent-waters must be given together" << std::endl;
+        return 1;
+    }
+
+    if (!parent_file.empty() && (!roi_spec.empty() || stream_mode || only_cluster || !serve_target.empty() || !trajectory_file.empty() ||
+                                 hydrophobic_scale || !probe_diameters.empty())) {
+        std::cerr << "Error: --parent cannot be combined with --roi, --stream, --serve, --trajectory, --hydrophobic, --probe-sweep or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (snap_lattice && (stream_mode || only_cluster || !serve_target.empty() || !trajectory_file.empty())) {
+        std::cerr << "Error: --lattice cannot be combined with --stream, --serve, --trajectory or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (snap_lattice && latticeStep(grid_spacing) == 0) {
+        std::cerr << "Error: --lattice needs a grid spacing with a common multiple with " << LATTICE_SPACING << " A" << std::endl;
+        return 1;
+    }
+
+    if (morton_order && (only_cluster || !trajectory_file.empty())) {
+        std::cerr << "Error: --morton cannot be combined with --trajectory or -cluster" << std::endl;
+        return 1;
+    }
+
+    if (!trajectory_file.empty()) {
+        if (stream_mode || !serve_target.empty() || only_cluster || max_memory_mb > 0) {
+            std::cerr << "Error: --trajectory cannot be combined with --stream, --serve, -cluster or --max-memory" << std::endl;
+            return 1;
+        }
+        if (classifier == "mesh") {
+            std::cerr << "Error: --trajectory classifies every frame by morphology, --classifier mesh is not supported" << std::endl;
             return 1;
         }
+        // frames come without surfaces, so the grid is classified on its own
+        classifier = "morph";
     }
 
-    if ((input_file.empty() || vert_file.empty() || output_file.empty())) {
+    // streaming keeps the flood fill bounded too, unless the budget was given explicitly
+    if (stream_mode && classifier == "vert" && max_memory_mb == 0) {
+        max_memory_mb = 256;
+    }
+
+    if (classifier == "mesh" && !only_cluster) {
+        // MSMS writes <name>.vert and <name>.face side by side
+        if (face_file.empty() && !vert_file.empty()) {
+            face_file = std::filesystem::path(vert_file).replace_extension(".face").string();
+        }
+        if (vert_file.empty() || !std::filesystem::exists(face_file)) {
+            std::cerr << "Error: --classifier mesh needs -v <vert> and a matching .face file (or --face <face>)" << std::endl;
+            return 1;
+        }
+    }
+
+    // --serve writes no result files, so -o only names the incidental ones (trace, print logs)
+    if (!serve_target.empty() && output_file.empty() && !input_file.empty()) {
+        output_file = "results/" + std::filesystem::path(stripCompressionSuffix(input_file)).stem().string();
+    }
+
+    if ((input_file.empty() || output_file.empty())) {
         std::cerr << "Error: Missing required arguments" << std::endl;
-        std::cerr << "Usage: " << argv[0] << " -p <pdb> -v <vert> -o <out> [-r <value>] [-cluster] [-pymol]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " -p <pdb> -o <out> [-v <vert>] [-r <value>] [-s <value>] [--probe <value>] [--density <value>] [--classifier <vert|vote|morph|mesh>] [--face <face>] [--max-memory <MB>] [--cell-size <value>] [-t <threads>] [--stream] [--place] [--burial] [--probe-sweep <d1,d2,..>] [--hydrophobic <1986|1989|1998>] [--morton] [--lattice] [--roi <box:..|sphere:..|sel:..>] [--roi-margin <value>] [--roi-radius <value>] [--parent <pdb> --parent-waters <pdb>] [--serve <socket|->] [--trajectory <file>] [--skin <value>] [--min-occupancy <value>] [--format <pdb|cif|bcif>] [--compress <gz|zst>] [--no-cache] [-cluster] [-pymol]" << std::endl;
         return 1;
     }
 
+    Region roi;
+    if (!roi_spec.empty()) {
+        std::string roi_error;
+        if (!parseRegion(roi_spec, input_file, roi_radius, roi, roi_error)) {
+            std::cerr << "Error: Invalid --roi '" << roi_spec << "': " << roi_error << std::endl;
+            return 1;
+        }
+    }
+
+    // --parent: the region is every point within --roi-radius of an atom that changed
+    if (!parent_file.empty()) {
+        std::string parent_error;
+        if (!changedAtomsRegion(parent_file, input_file, roi_radius, roi, parent_error)) {
+            std::cerr << "Error: --parent: " << parent_error << std::endl;
+            return 1;
+        }
+    }
+
 
     std::cout << "--- Files ---" << std::endl;
     std::cout << "Input PDB:  " << input_file << std::endl;
-    std::cout << "Input Vert: " << vert_file << std::endl;
+    if (!vert_file.empty()) {
+        std::cout << "Input Vert: " << vert_file << std::endl;
+        if (classifier == "mesh") {
+            std::cout << "Input Face: " << face_file << std::endl;
+        }
+    } else if (!only_cluster && classifier == "morph") {
+        std::cout << "Input Vert: (not needed, morphological classifier)" << std::endl;
+    } else if (!only_cluster) {
+        std::cout << "Input Vert: (generated, probe " << probe_radius << " A, density " << vertex_density << ")" << std::endl;
+    }
     std::cout << "Output:     " << output_file << std::endl;
     std::cout << "--- Params ---" << std::endl;
     std::cout << "Grid Spacing: " << grid_spacing << std::endl;
+    std::cout << "Threads: " << getThreadCount() << std::endl;
     if(!only_cluster) {
         std::cout << "Water Diameter: " << water_diameter << std::endl;
         std::cout << "Internal/External Shell Radius (Initial/Flood Fill): " << shellradius << std::endl;
+        std::cout << "Inside/Outside Classifier: " << classifier << std::endl;
+        if (max_memory_mb > 0) {
+            std::cout << "Memory Budget (tiled): " << max_memory_mb << " MB" << std::endl;
+        }
+        if (stream_mode) {
+            std::cout << "Streaming: flood fill -> overlaps -> categorize -> cluster in chunks" << std::endl;
+        }
+        if (place_sites) {
+            std::cout << "Water Sites: placed at least " << water_diameter << " A apart" << std::endl;
+        }
+        if (write_burial) {
+            std::cout << "Burial Depth: written as an OpenDX map" << std::endl;
+        }
+        if (!probe_diameters.empty()) {
+            std::cout << "Probe Sweep: " << probe_diameters.size() << " diameters from one clearance field" << std::endl;
+        }
+        if (hydrophobic_scale) {
+            std::cout << "Hydrophobic Environment: " << hydrophobic_scale << " scale within " << cutoff_distance << " A" << std::endl;
+        }
+        if (!parent_file.empty()) {
+            std::cout << "Parent: " << parent_file << " (" << roi.selected.size() << " atoms changed, rerun within "
+                      << roi_radius << " A of them, grid margin " << roi_margin << " A)" << std::endl;
+        } else if (roi.active()) {
+            std::cout << "Region of Interest: " << roi_spec << " (grid margin " << roi_margin << " A)" << std::endl;
+        }
+        if (!trajectory_file.empty()) {
+            std::cout << "Trajectory: " << trajectory_file << " (skin " << skin_distance << " A, sites in >= "
+                      << min_occupancy * 100 << "% of frames)" << std::endl;
+        }
         std::cout << "Internal/External Shell Radius (Secondary/Categorize): " << r_value << std::endl;
     }
     if(pymol) {
@@ -112,8 +688,9 @@ int main(int argc, char* argv[]){
     }
 
 
+    // in --serve mode stdin may be the query channel, so there is no prompt
     std::string response;
-    while (true) {
+    while (serve_target.empty()) {
         std::cout << "\nProceed? (y/n): ";
         std::cin >> response;
         if (response == "y" || response == "Y") {
@@ -126,16 +703,125 @@ int main(int argc, char* argv[]){
         }
     }
 
+    // make trace builds: the timeline of the run, written however main returns
+    TRACE_FILE(output_file + "_trace.json");
+
     //---------- the next section does not apply if the -cluster tag is selected ----------
 
-    if(!only_cluster) { 
-    // ---------- reading PDB into vector ----------
+    std::vector<std::vector<Atom>> streamed_clusters;
+
+    // --parent: the parent's waters outside the region, b-factor = their category in the parent's output;
+    // they skip categorize_water.py and rejoin the recomputed waters for clustering
+    std::vector<Atom> parent_kept;
+
+    // --hydrophobic: environment of every water by its coordinates as the pdb writers round them (0.001 A), so
+    // the sites can be found again once categorize_water.py and clustering have reordered them
+    std::map<std::array<long long, 3>, SiteEnvironment> site_environments;
+    auto siteKey = [](const std::array<double, 3>& c) {
+        return std::array<long long, 3>{std::llround(c[0] * 1000), std::llround(c[1] * 1000), std::llround(c[2] * 1000)};
+    };
 
+    // ---------- trajectory: grids kept across frames, occupancy accumulated per cell ----------
+
+    size_t trajectory_frames = 0;
+
+    if (!trajectory_file.empty()) {
         std::cout << "-> Entering pdbtovector" << std::endl;
 
         std::tuple<std::vector<Atom>, double, double, double, double, double, double> newtuple = pdbtovector(input_file);
+        std::vector<Atom> atomvector = std::get<0>(newtuple);
+
+        // a multi-MODEL topology lists every frame: the box covers them all, the atoms come from the first
+        size_t model_atoms = std::min(firstModelAtomCount(input_file), atomvector.size());
+        atomvector.erase(atomvector.begin() + model_atoms, atomvector.end());
+        if (atomvector.empty()) {
+            std::cerr << "Error: No atoms read from " << input_file << std::endl;
+            return 1;
+        }
+
+        Vec3 minB = {(float)std::floor(std::get<1>(newtuple)) - 5, (float)std::floor(std::get<3>(newtuple)) - 5, (float)std::floor(std::get<5>(newtuple)) - 5};
+        Vec3 maxB = {(float)std::ceil(std::get<2>(newtuple)) + 5, (float)std::ceil(std::get<4>(newtuple)) + 5, (float)std::ceil(std::get<6>(newtuple)) + 5};
+
+        TrajectorySettings settings;
+        settings.spacing = (float)grid_spacing;
+        settings.probeRadius = probe_radius;
+        settings.waterDiameter = water_diameter;
+        settings.cutoffDistance = cutoff_distance;
+        settings.hashSpacing = cell_size;
+        settings.skin = skin_distance;
+
+        std::cout << "-> Stamping " << atomvector.size() << " atoms into the grids" << std::endl;
+        TrajectoryGrid grid(atomvector, minB, maxB, settings);
+
+        TrajectoryReader reader(trajectory_file, atomvector.size());
+        if (!reader.isOpen()) {
+            std::cerr << "Error: Could not open trajectory " << trajectory_file << std::endl;
+            return 1;
+        }
+
+        std::ofstream frame_log(output_file + "_frames.csv");
+        frame_log << "frame,restamped_atoms,waters" << std::endl;
+
+        std::vector<std::array<double, 3>> coords;
+        while (reader.next(coords)) {
+            TRACE_SPAN("trajectory frame");
+            size_t restamped = 0;
+            std::string frame_error;
+            if (!grid.update(coords, restamped, frame_error)) {
+                std::cerr << "\nError: " << trajectory_file << ": frame " << grid.frames() + 1 << ": " << frame_error << std::endl;
+                return 1;
+            }
+            size_t waters = grid.accumulate();
+
+            frame_log << grid.frames() << "," << restamped << "," << waters << std::endl;
+            std::cout << "\r** Frame " << grid.frames() << ": " << waters << " waters, "
+                      << restamped << " atoms restamped **\033[K" << std::flush;
+        }
+        std::cout << std::endl;
+
+        if (!reader.error().empty()) {
+            std::cerr << "Error: " << trajectory_file << ": " << reader.error() << std::endl;
+            return 1;
+        }
+        if (grid.frames() == 0) {
+            std::cerr << "Error: No frames in trajectory " << trajectory_file << std::endl;
+            return 1;
+        }
+        trajectory_frames = grid.frames();
+
+        std::cout << "-> Writing occupancy map to " << output_file << "_occupancy.dx" << std::endl;
+        grid.writeDX(output_file + "_occupancy.dx");
+
+        std::vector<Atom> sites = grid.sites(min_occupancy);
+        std::cout << "\n** " << sites.size() << " sites hold a water in at least " << min_occupancy * 100
+                  << "% of " << trajectory_frames << " frames **" << std::endl;
+
+        std::cout << "-> Clustering " << sites.size() << " sites" << std::flush;
+        streamed_clusters = clusterAtoms(sites, grid_spacing, hash_spacing);
+    }
+
+    if(!only_cluster && trajectory_file.empty()) { 
+    // ---------- reading PDB into vector ----------
+
+        std::cout << "-> Entering pdbtovector" << std::endl;
+
+        // the structure is parsed while the stage cache hashes the input files
+        std::tuple<std::vector<Atom>, double, double, double, double, double, double> newtuple;
+        uint64_t pdbKey = 0, vertFileKey = 0;
+
+        TaskGraph inputStages;
+        inputStages.add("pdbtovector", [&]() { newtuple = pdbtovector(input_file); });
+        inputStages.add("hash inputs", [&]() {
+            pdbKey = hashFile(input_file);
+            if (!vert_file.empty()) vertFileKey = hashFile(vert_file);
+        });
+        inputStages.run();
 
         std::vector<Atom> atomvector = std::get<0>(newtuple);
+        if (atomvector.empty()) {
+            std::cerr << "Error: No atoms read from " << input_file << std::endl;
+            return 1;
+        }
 
         double minx = std::get<1>(newtuple);
         double maxx = std::get<2>(newtuple);
@@ -149,9 +835,15 @@ int main(int argc, char* argv[]){
 
     // ---------- build hashmap with vector ----------
 
-        std::cout << "-> Building hashmap" << std::endl;
+        // cells sized from the query radii; the stencil covers the cutoff and every possible clash
+        CellStencil overlapStencil = makeOverlapStencil(atomvector, water_diameter, cutoff_distance, cell_size);
+
+        // --morton: the overlap pass reads atoms cell by cell, so it gets a copy stored along the Z-order curve
+        std::vector<Atom> mortonAtoms;
+        std::vector<Atom>& overlapAtoms = morton_order ? mortonAtoms : atomvector;
 
-        std::unordered_map<GridKey, std::vector<int>> map = buildSpatialGrid(atomvector, hash_spacing);
+        // built by the "overlap grid" stage, alongside the surface and classification stages
+        std::unordered_map<GridKey, std::vector<int>> map;
 
         double start_x = std::floor(minx);
         double end_x   = std::ceil(maxx);
@@ -167,126 +859,653 @@ int main(int argc, char* argv[]){
         int nz = (int)((end_z - start_z) / grid_spacing + 1e-5) + 1;
 
 
-        long total_reps = (long)((nx+10) * (ny+10) * (nz+10));
+        long total_reps = (long)(nx+10) * (ny+10) * (nz+10);
 
-    // ---------- separate surface and internal ----------
+        Vec3 minB = {(float)start_x - 5, (float)start_y - 5, (float)start_z - 5};
+        Vec3 maxB = {(float)end_x + 5, (float)end_y + 5, (float)end_z + 5};
+
+        // --lattice: the box corner moves down onto a multiple of both the grid spacing and the fill step, so the
+        // grids of every run share one global lattice (whole Angstroms already are, for spacings that divide 1 A)
+        double box_step = 1;
+        if (snap_lattice) {
+            double step = latticeStep(grid_spacing);
+            minB = {(float)(std::floor(minB.x / step) * step), (float)(std::floor(minB.y / step) * step), (float)(std::floor(minB.z / step) * step)};
+            box_step = latticeStep(step, 1.0);
+        }
+
+        // --roi: every grid stage runs on the region plus the margin, only points inside the region are dowsed
+        if (roi.active()) {
+            if (!clampToRegion(roi, roi_margin, minB, maxB, box_step)) {
+                std::cerr << "Error: The --roi region does not overlap the structure" << std::endl;
+                return 1;
+            }
+            total_reps = (long)(std::ceil((maxB.x - minB.x) / grid_spacing) + 1) *
+                         (long)(std::ceil((maxB.y - minB.y) / grid_spacing) + 1) *
+                         (long)(std::ceil((maxB.z - minB.z) / grid_spacing) + 1);
+            std::cout << "-> Region of interest: grid box (" << minB.x << ", " << minB.y << ", " << minB.z << ") - ("
+                      << maxB.x << ", " << maxB.y << ", " << maxB.z << ")" << std::endl;
+        }
+
+    // ---------- stage cache keys ----------
+    // Each key chains the content hash of the inputs with every parameter the stage (and the stages
+    // before it) depends on, so any upstream change produces a different key.
 
-        std::cout << "-> Processing vertices" << std::endl;
+        StageCache cache("temp/cache", use_cache);
 
+        bool generated_surface = vert_file.empty();
+        std::string generated_vert_file = "temp/" + std::filesystem::path(stripCompressionSuffix(input_file)).stem().string() + ".vert";
 
-        std::vector<Vertex> mySurface = vert_to_vector(vert_file);
+        uint64_t surfaceKey = hashValues(pdbKey, "surface", classifier, probe_radius, vertex_density, grid_spacing, shellradius);
+        uint64_t classifyKey = hashValues(generated_surface ? surfaceKey : vertFileKey,
+                                          pdbKey, "classify", classifier, grid_spacing, shellradius);
+        // the classifier's own inputs count whatever the surface source; with -v the surface key is not in the chain
+        if (classifier == "morph") {
+            classifyKey = hashValues(classifyKey, "morph", probe_radius, vertex_density);
+        } else if (classifier == "mesh") {
+            classifyKey = hashFile(face_file, classifyKey);
+        }
+        if (!parent_file.empty()) {
+            classifyKey = hashFile(parent_file, classifyKey);
+        }
+        if (snap_lattice) {
+            surfaceKey = hashValues(surfaceKey, "lattice", minB.x, minB.y, minB.z);
+            classifyKey = hashValues(classifyKey, "lattice", minB.x, minB.y, minB.z);
+        }
+        if (roi.active()) {
+            // the morphological surface comes from the clamped grid; the region also clips the fill
+            surfaceKey = hashValues(surfaceKey, "roi", minB.x, minB.y, minB.z, maxB.x, maxB.y, maxB.z);
+            classifyKey = hashValues(classifyKey, "roi", minB.x, minB.y, minB.z, maxB.x, maxB.y, maxB.z, roi_spec, roi_radius);
+        }
+        uint64_t fillKey = hashValues(classifyKey, "fill", 0.25f, max_memory_mb > 0);
+        uint64_t watersKey = hashValues(fillKey, "waters", water_diameter, cutoff_distance, "full reach");
+        uint64_t environmentKey = hashValues(watersKey, "environment", hydrophobic_scale, "linear");
+
+        // the waters are all later stages need, unless the run streams or serves the fill itself
+        bool reuse_waters = !stream_mode && serve_target.empty() && cache.has("waters", watersKey) &&
+                            (!generated_surface || cache.has("surface", surfaceKey)) &&
+                            (!write_burial || (cache.has("filled", fillKey) && cache.has("burial", fillKey))) &&
+                            probe_diameters.empty() &&
+                            (!hydrophobic_scale || cache.has("environment", environmentKey));
+
+    // ---------- separate surface and internal ----------
 
         std::vector<Vec3> insidePoints;
         std::vector<Vec3> outsidePoints;
-        
-        Vec3 minB = {(float)start_x - 5, (float)start_y - 5, (float)start_z - 5};
-        Vec3 maxB = {(float)end_x + 5, (float)end_y + 5, (float)end_z + 5};
-        
-        SeparateGridPoints(mySurface, minB, maxB, (float)grid_spacing, shellradius, insidePoints, outsidePoints);
+        std::vector<Vertex> mySurface;
+
+        // classification snapshots are bitsets over the classifier lattice
+        int classifyDimX = static_cast<int>(std::ceil((maxB.x - minB.x) / grid_spacing));
+        int classifyDimY = static_cast<int>(std::ceil((maxB.y - minB.y) / grid_spacing));
+        int classifyDimZ = static_cast<int>(std::ceil((maxB.z - minB.z) / grid_spacing));
+
+        auto loadClassified = [&](const char* stage, std::vector<Vec3>& points) {
+            std::vector<uint64_t> bits;
+            if (!cache.load(stage, classifyKey, bits)) return false;
+            points = unpackLatticePoints(bits, minB, classifyDimX, classifyDimY, classifyDimZ, (float)grid_spacing);
+            return true;
+        };
+        auto storeClassified = [&](const char* stage, const std::vector<Vec3>& points) {
+            if (!cache.enabled()) return;
+            cache.store(stage, classifyKey, packLatticePoints(points, minB, classifyDimX, classifyDimY, classifyDimZ, (float)grid_spacing));
+        };
+
+        // the tiled path classifies slab by slab inside FillInternalVoidTiled
+        bool classify_needed = !reuse_waters && max_memory_mb == 0;
+        bool classify_cached = classify_needed &&
+                               loadClassified("inside", insidePoints) &&
+                               loadClassified("outside", outsidePoints) &&
+                               (classifier != "morph" || !generated_surface || cache.has("surface", surfaceKey));
+
+        if (classify_cached) {
+            std::cout << "-> Reusing cached inside/outside classification" << std::endl;
+        }
+
+        // independent stages: the overlap pass's hash grid and the surface/classification chain
+        TaskGraph gridStages;
+        bool unreadable_input = false;   // set by a stage whose vert or face file could not be read
+
+        std::cout << "-> Building hashmap (" << overlapStencil.cellSize << " A cells, "
+                  << overlapStencil.offsets.size() << " neighbor cells)" << std::endl;
+
+        gridStages.add("overlap grid", [&]() {
+            if (morton_order) {
+                mortonAtoms = atomvector;
+                applyOrder(mortonAtoms, mortonOrder(mortonAtoms, overlapStencil.cellSize, [](const Atom& a) { return a.getCoords(); }));
+            }
+            map = buildSpatialGrid(overlapAtoms, overlapStencil.cellSize);
+        });
+
+        if (classifier == "morph") {
+            gridStages.add("classify", [&]() {
+                std::vector<Vertex> voxelSurface;
+
+                if (classify_needed && !classify_cached) {
+                    logLine("-> Classifying grid by morphology");
+
+                    // categorize_water.py still needs a surface file, take it from the voxel boundary
+                    SeparateGridPointsMorphology(atomvector, minB, maxB, (float)grid_spacing, probe_radius, shellradius,
+                                                 insidePoints, outsidePoints,
+                                                 generated_surface ? &voxelSurface : nullptr, vertex_density);
+
+                    storeClassified("inside", insidePoints);
+                    storeClassified("outside", outsidePoints);
+                    if (generated_surface) cache.store("surface", surfaceKey, voxelSurface);
+                } else if (generated_surface) {
+                    cache.load("surface", surfaceKey, voxelSurface);
+                }
+
+                if (generated_surface) {
+                    vert_file = generated_vert_file;
+                    writeVertFile(voxelSurface, vert_file, probe_radius, vertex_density, atomvector.size());
+                }
+            });
+        } else {
+            TaskGraph::Stage surfaceStage = gridStages.add("surface", [&]() {
+                logLine("-> Processing vertices");
+
+                if (!generated_surface) {
+                    if (!reuse_waters) {
+                        mySurface = vert_to_vector(vert_file);
+                        unreadable_input = mySurface.empty();
+                    }
+                } else if (cache.load("surface", surfaceKey, mySurface)) {
+                    logLine("-> Reusing cached surface (" + std::to_string(mySurface.size()) + " vertices)");
+                } else {
+                    logLine("-> Generating surface vertices");
+                    mySurface = generateSurfaceVertices(atomvector, probe_radius, vertex_density);
+                    cache.store("surface", surfaceKey, mySurface);
+                    logLine("** Generated " + std::to_string(mySurface.size()) + " vertices **");
+                }
+
+                if (generated_surface) {
+                    // categorize_water.py still reads the surface from disk
+                    vert_file = generated_vert_file;
+                    writeVertFile(mySurface, vert_file, probe_radius, vertex_density, atomvector.size());
+                }
+
+                // the nearest vertex scatter then writes grid cells in Z-order; mesh faces index the vertices as read
+                if (morton_order && classifier != "mesh") {
+                    applyOrder(mySurface, mortonOrder(mySurface, grid_spacing, [](const Vertex& v) {
+                        return std::array<double, 3>{v.position.x, v.position.y, v.position.z};
+                    }));
+                }
+            });
+
+            gridStages.add("classify", [&]() {
+                if (unreadable_input) return;
+                if (classify_needed && !classify_cached) {
+                    if (classifier == "mesh") {
+                        std::vector<std::array<int, 3>> myFaces = face_to_vector(face_file);
+                        if (myFaces.empty()) {
+                            unreadable_input = true;
+                            return;
+                        }
+                        SeparateGridPointsMesh(mySurface, myFaces, minB, maxB, (float)grid_spacing, shellradius, insidePoints, outsidePoints);
+                    } else if (classifier == "vote") {
+                        SeparateGridPointsVote(mySurface, minB, maxB, (float)grid_spacing, shellradius, insidePoints, outsidePoints);
+                    } else {
+                        SeparateGridPoints(mySurface, minB, maxB, (float)grid_spacing, shellradius, insidePoints, outsidePoints);
+                    }
+                    storeClassified("inside", insidePoints);
+                    storeClassified("outside", outsidePoints);
+                }
+            }, {surfaceStage});
+        }
+
+        gridStages.run();
+        if (unreadable_input) {
+            std::cerr << "Error: No surface read from " << (classifier == "mesh" ? face_file + " or " : "") << vert_file << std::endl;
+            return 1;
+        }
 
         
         PRINT_LOG(WriteWaterPDB(insidePoints, output_file + "_in.pdb"));
         PRINT_LOG(WriteWaterPDB(outsidePoints, output_file + "_out.pdb"));
 
 
-        std::cout << "-> Flood fill" << std::endl;
+        if (stream_mode) {
+        // ---------- streaming: flood fill -> overlaps -> categorize -> cluster labels ----------
 
-        std::vector<Vec3> allpoints;
-        std::vector<std::vector<Vec3>> layers;
+            // the morphological classifier only wrote its surface to disk
+            if (mySurface.empty()) {
+                mySurface = vert_to_vector(vert_file);
+                if (mySurface.empty()) {
+                    std::cerr << "Error: No surface read from " << vert_file << std::endl;
+                    return 1;
+                }
+            }
 
-        FillInternalVoid(outsidePoints, insidePoints, minB, maxB, .25, allpoints, layers);
+            PointSource source;
+            if (max_memory_mb > 0) {
+                TilePlan plan = planTiles(minB, maxB, (float)grid_spacing, max_memory_mb * 1024 * 1024);
+                std::cout << "-> Tiled flood fill: " << plan.slabCount << " slabs of " << plan.slabThickness
+                          << " slices, " << plan.concurrent << " at a time" << std::endl;
+
+                source = [&, plan](const std::function<void(std::vector<Vec3>&)>& emit) {
+                    FillInternalVoidTiled(mySurface, minB, maxB, (float)grid_spacing, shellradius, plan,
+                        [&](int /*slab*/, std::vector<Vec3>& points) {
+                            keepInRegion(roi, points);
+                            emit(points);
+                        });
+                };
+            } else {
+                // morph/mesh/vote classify the full grid, so the fill is materialized once and streamed from there
+                source = [&](const std::function<void(std::vector<Vec3>&)>& emit) {
+                    std::vector<Vec3> allpoints;
+                    FillInternalVoid(outsidePoints, insidePoints, minB, maxB, .25, allpoints);
+                    keepInRegion(roi, allpoints);
+                    emit(allpoints);
+                };
+            }
 
-        std::cout  << "-> total gridpoints = " << std::scientific << std::setprecision(3) << (double)total_reps << std::endl;
-        std::cout << std::scientific << std::setprecision(3) << "-- removed " << (double)total_reps - (double)allpoints.size() << " (" << std::fixed << std::setprecision(1) << ((double)total_reps - (double)allpoints.size()) / total_reps * 100 <<"%) --" << std::endl;
-        std::cout << std::scientific << std::setprecision(3) << "-> Dowsing " << (double)allpoints.size() << std::endl;
-        
-        PRINT_LOG(WriteWaterPDB(allpoints, output_file + "_all_internals_before_protein_overlap.pdb"));
+            StreamSettings settings;
+            settings.hashSpacing = hash_spacing;
+            settings.overlapStencil = overlapStencil;
+            settings.waterDiameter = water_diameter;
+            settings.cutoffDistance = cutoff_distance;
+            settings.surfaceRadius = std::stod(r_value);
+            settings.clusterSpacing = grid_spacing;
 
+            std::cout << "-> Streaming in chunks of " << settings.chunkSize << " points" << std::endl;
+
+            StreamStats stats;
+            streamed_clusters = streamWaters(source, overlapAtoms, map, mySurface, settings, stats);
+
+            std::cout << std::scientific << std::setprecision(3) << "\n-> Dowsed " << (double)stats.dowsed << std::endl;
+            std::cout << "\n** There are " << stats.waters << " waters (" << stats.waters - stats.surface
+                      << " internal, " << stats.surface << " surface) **" << std::endl;
+        } else {
 
-    // ---------- remove overlaps with Protein atoms ----------
 
-        std::vector<Atom> watervector = {};
-        int dbug = 0;
-        std::cout << "\033[?25l";
-        int total_points = allpoints.size();
+        // ---------- remove overlaps with Protein atoms ----------
 
-        for (int i = 0; i < total_points; i++){
-            
+            std::vector<Atom> watervector = {};
 
-            double percent = 0.0;
-            if (i % 1000 == 0 || i == total_points - 1) {
-                double percent = ((double)(i + 1) / total_points) * 100.0;
-                std::cout << "\r** Iteration: " << i + 1 << " of " << total_points << " **\033[K\n"
-                          << "   Progress:  " << std::fixed << std::setprecision(1) << percent << "%\033[K" << std::flush;
-                std::cout << "\033[1A";
+            // --hydrophobic: environment of every water, in watervector order
+            std::vector<SiteEnvironment> environments;
+            std::vector<double> hydrophobicity = getHydrophobicity(overlapAtoms, hydrophobic_scale);
+
+            // --serve keeps the fill, the waters and their clusters resident for point queries
+            std::unique_ptr<QueryServer> server;
+            if (!serve_target.empty()) {
+                server = std::make_unique<QueryServer>(atomvector, hash_spacing, minB, maxB, (float)grid_spacing,
+                                                       max_memory_mb * 1024 * 1024);
+                if (server->sparse()) {
+                    std::cout << "-> Query server lattice exceeds --max-memory, keeping the filled cells sparse" << std::endl;
+                }
             }
 
-            std::array<double, 3> temp_array = {allpoints[i].x, allpoints[i].y ,allpoints[i].z};
-            if(getOverlap_cluster(map, atomvector, temp_array, hash_spacing, water_diameter, cutoff_distance)){
-                Atom newatom("HOH", "O", temp_array);
-                watervector.push_back(newatom);
+            auto removeOverlaps = [&](const std::vector<Vec3>& points) {
+                TRACE_SPAN("protein overlap");
+                size_t total_points = points.size();
+                if (server) server->addFilled(points);
+
+                // --morton visits the points along the Z-order curve, so successive queries share atom
+                // cells; the survivors are still emitted in the order the points came in
+                std::vector<uint32_t> order;
+                if (morton_order) {
+                    order = mortonOrder(points, MORTON_POINT_CELL, [](const Vec3& p) {
+                        return std::array<double, 3>{p.x, p.y, p.z};
+                    });
+                }
+                std::vector<uint8_t> keep(total_points, 0);
+                std::vector<SiteEnvironment> pointEnvironments(hydrophobic_scale ? total_points : 0);
+
+                for (size_t k = 0; k < total_points; k++){
+
+                    if (k % 1000 == 0 || k == total_points - 1) {
+                        double percent = ((double)(k + 1) / total_points) * 100.0;
+                        std::cout << "\r** Iteration: " << k + 1 << " of " << total_points << " **\033[K\n"
+                                  << "   Progress:  " << std::fixed << std::setprecision(1) << percent << "%\033[K" << std::flush;
+                        std::cout << "\033[1A";
+                    }
+
+                    size_t i = morton_order ? order[k] : k;
+                    std::array<double, 3> temp_array = {points[i].x, points[i].y ,points[i].z};
+                    keep[i] = getOverlap_cluster(map, overlapAtoms, temp_array, overlapStencil, water_diameter, cutoff_distance,
+                                                 hydrophobic_scale ? &hydrophobicity : nullptr,
+                                                 hydrophobic_scale ? &pointEnvironments[i] : nullptr);
+                }
+
+                for (size_t i = 0; i < total_points; i++) {
+                    if (keep[i]) {
+                        Atom newatom("HOH", "O", {points[i].x, points[i].y, points[i].z});
+                        watervector.push_back(newatom);
+                        if (hydrophobic_scale) environments.push_back(pointEnvironments[i]);
+                    }
+                }
+            };
+
+            std::vector<Vec3> cachedWaters;
+
+            // fill snapshots are 32-bit indices into the FillInternalVoid lattice, in BFS order
+            int fillDimX = static_cast<int>(std::ceil((maxB.x - minB.x) / .25f)) + 1;
+            int fillDimY = static_cast<int>(std::ceil((maxB.y - minB.y) / .25f)) + 1;
+            int fillDimZ = static_cast<int>(std::ceil((maxB.z - minB.z) / .25f)) + 1;
+            std::vector<uint32_t> fillIndices;
+
+            // burial depth per fill lattice cell (--burial); cached as one depth per fill index
+            std::vector<uint16_t> burial;
+            auto loadBurial = [&]() {
+                std::vector<uint16_t> depths;
+                if (!cache.load("burial", fillKey, depths) || depths.size() != fillIndices.size()) return false;
+                burial.assign((size_t)fillDimX * fillDimY * fillDimZ, BURIAL_UNFILLED);
+                for (size_t i = 0; i < fillIndices.size(); i++) {
+                    burial[fillIndices[i]] = depths[i];
+                }
+                return true;
+            };
+
+            if (reuse_waters && cache.load("waters", watersKey, cachedWaters)) {
+                std::cout << "-> Reusing cached waters (flood fill and overlap pass skipped)" << std::endl;
+                if (hydrophobic_scale && !(cache.load("environment", environmentKey, environments) && environments.size() == cachedWaters.size())) {
+                    std::cerr << "Error: Cached hydrophobic environments are unreadable, rerun with --no-cache" << std::endl;
+                    return 1;
+                }
+                for (size_t i = 0; i < cachedWaters.size(); i++) {
+                    const Vec3& w = cachedWaters[i];
+                    watervector.push_back(Atom("HOH", "O", {w.x, w.y, w.z}));
+                }
+                if (write_burial && !(cache.load("filled", fillKey, fillIndices) && loadBurial())) {
+                    std::cerr << "Error: Cached burial depths are unreadable, rerun with --no-cache" << std::endl;
+                    return 1;
+                }
+            } else if (max_memory_mb > 0) {
+                // classify, fill and dowse one slab at a time; only the waters outlive a slab
+                TilePlan plan = planTiles(minB, maxB, (float)grid_spacing, max_memory_mb * 1024 * 1024);
+                std::cout << "-> Tiled flood fill: " << plan.slabCount << " slabs of " << plan.slabThickness
+                          << " slices, " << plan.concurrent << " at a time" << std::endl;
+
+                size_t dowsed = 0;
+                std::cout << "\033[?25l";
+                FillInternalVoidTiled(mySurface, minB, maxB, (float)grid_spacing, shellradius, plan,
+                    [&](int /*slab*/, std::vector<Vec3>& points) {
+                        keepInRegion(roi, points);
+                        dowsed += points.size();
+                        removeOverlaps(points);
+                    });
+                std::cout << "\n\n\033[?25h";
+
+                std::cout << std::scientific << std::setprecision(3) << "-> Dowsed " << (double)dowsed << std::endl;
+            } else {
+                std::cout << "-> Flood fill" << std::endl;
+
+                std::vector<Vec3> allpoints;
+
+                if (cache.load("filled", fillKey, fillIndices) && (!write_burial || loadBurial())) {
+                    std::cout << "-> Reusing cached flood fill" << std::endl;
+                    allpoints = unpackFillIndices(fillIndices, minB, fillDimX, fillDimY, fillDimZ, .25f);
+                } else {
+                    FillInternalVoid(outsidePoints, insidePoints, minB, maxB, .25, allpoints, write_burial ? &burial : nullptr);
+                    if (cache.enabled() && packFillIndices(allpoints, minB, fillDimX, fillDimY, fillDimZ, .25f, fillIndices)) {
+                        cache.store("filled", fillKey, fillIndices);
+                        if (write_burial) {
+                            std::vector<uint16_t> depths(fillIndices.size());
+                            for (size_t i = 0; i < fillIndices.size(); i++) {
+                                depths[i] = burial[fillIndices[i]];
+                            }
+                            cache.store("burial", fillKey, depths);
+                        }
+                    }
+                }
+                keepInRegion(roi, allpoints);
+
+                std::cout  << "-> total gridpoints = " << std::scientific << std::setprecision(3) << (double)total_reps << std::endl;
+                std::cout << std::scientific << std::setprecision(3) << "-- removed " << (double)total_reps - (double)allpoints.size() << " (" << std::fixed << std::setprecision(1) << ((double)total_reps - (double)allpoints.size()) / total_reps * 100 <<"%) --" << std::endl;
+                std::cout << std::scientific << std::setprecision(3) << "-> Dowsing " << (double)allpoints.size() << std::endl;
+
+                PRINT_LOG(WriteWaterPDB(allpoints, output_file + "_all_internals_before_protein_overlap.pdb"));
+
+                std::cout << "\033[?25l";
+                removeOverlaps(allpoints);
+                std::cout << "\n\n\033[?25h";
+
+                if (!probe_diameters.empty()) {
+                    // one stencil on the same grid covers the largest probe; smaller ones are thresholds
+                    double smallest = *std::min_element(probe_diameters.begin(), probe_diameters.end());
+                    double largest = *std::max_element(probe_diameters.begin(), probe_diameters.end());
+                    CellStencil probeStencil = makeOverlapStencil(overlapAtoms, largest, cutoff_distance, overlapStencil.cellSize);
+
+                    std::cout << "-> Clearance field for " << allpoints.size() << " points" << std::endl;
+                    ClearanceField field = computeClearance(map, overlapAtoms, allpoints, probeStencil, cutoff_distance, smallest / 2.0);
+
+                    ProbeSweep sweep = sweepProbes(allpoints, field, probe_diameters, .25, grid_spacing);
+                    for (size_t k = 0; k < sweep.diameters.size(); k++) {
+                        size_t fitted = 0;
+                        for (const auto& cluster : sweep.clusters[k]) fitted += cluster.size();
+                        std::cout << "   probe " << std::fixed << std::setprecision(2) << sweep.diameters[k] << " A: "
+                                  << fitted << " points in " << sweep.clusters[k].size() << " clusters" << std::endl;
+                    }
+
+                    std::cout << "-> Writing probe sweep to " << output_file << "_probes.csv" << std::endl;
+                    std::vector<std::string> sweepRemarks = {"grid spacing = " + std::to_string(grid_spacing),
+                                                             "vert file = " + vert_file};
+                    if (!writeProbeSweep(sweep, output_file, sweepRemarks, output_compression)) return 1;
+                }
             }
-            dbug += 1;
 
-        }
-        std::cout << "\n\n\033[?25h";
+            if (cachedWaters.empty() && cache.enabled()) {
+                std::vector<Vec3> waterPoints;
+                waterPoints.reserve(watervector.size());
+                for (const Atom& w : watervector) {
+                    std::array<double, 3> c = w.getCoords();
+                    waterPoints.push_back({(float)c[0], (float)c[1], (float)c[2]});
+                }
+                cache.store("waters", watersKey, waterPoints);
+                if (hydrophobic_scale) cache.store("environment", environmentKey, environments);
+            }
 
-        std::cout << "\n** There are " << watervector.size() << " waters **" <<std::endl;
+            // --parent: the parent's waters stand wherever no changed atom is within reach, with the
+            // internal/surface category (0/1 b-factor) of the parent's clustered output; -1 marks recomputed waters
+            std::vector<int> parentCategory;
+            if (!parent_file.empty()) {
+                std::vector<Atom> parentWaters = std::get<0>(pdbtovector(parent_waters_file));
+                if (parentWaters.empty()) {
+                    std::cerr << "Error: No waters in " << parent_waters_file << std::endl;
+                    return 1;
+                }
+
+                std::vector<Atom> patched;
+                patched.reserve(parentWaters.size() + watervector.size());
+                for (const Atom& w : parentWaters) {
+                    if (!roi.contains(w.getCoords())) {
+                        patched.push_back(Atom("HOH", "O", w.getCoords(), w.get_bfactor()));
+                        parentCategory.push_back(w.get_bfactor() >= 0.5 ? 1 : 0);
+                    }
+                }
+                std::cout << "-> Patched " << watervector.size() << " recomputed waters into " << patched.size()
+                          << " of the parent's " << parentWaters.size() << std::endl;
+                patched.insert(patched.end(), watervector.begin(), watervector.end());
+                watervector.swap(patched);
+                parentCategory.resize(watervector.size(), -1);
+            }
 
+            std::cout << "\n** There are " << watervector.size() << " waters **" <<std::endl;
 
-        std::cout << "-> Entering vectortopdb" << std::endl;
-        
-        vectortopdb(watervector, output_file + "_all_internal_gridpoints.pdb");
+            if (write_burial) {
+                std::cout << "-> Writing burial depth map to " << output_file << "_burial.dx" << std::endl;
+                WriteDXMap(output_file + "_burial.dx", "burial depth (flood fill steps of 0.25 A from the shell, 1 = seeds)",
+                           fillDimX, fillDimY, fillDimZ, minB, .25, [&](size_t i) { return (double)burial[i]; });
+            }
 
-    
+            if (place_sites) {
+                std::cout << "-> Placing water sites" << std::endl;
+
+                PlacementSettings settings;
+                settings.minDistance = water_diameter;
+                std::vector<size_t> chosen;
+                watervector = placeWaterSites(watervector, atomvector, settings, &chosen);
+
+                if (hydrophobic_scale) {
+                    std::vector<SiteEnvironment> placed;
+                    for (size_t i : chosen) placed.push_back(environments[i]);
+                    environments.swap(placed);
+                }
+                if (!parentCategory.empty()) {
+                    std::vector<int> placed;
+                    for (size_t i : chosen) placed.push_back(parentCategory[i]);
+                    parentCategory.swap(placed);
+                }
+
+                std::cout << "** Placed " << watervector.size() << " sites **" << std::endl;
+            }
 
-    // ---------- run categorize_water ----------
-    // ---------- this further separates gridpoints into internal/external based on proximity to surface ----------
+            if (snap_lattice) {
+                std::vector<std::array<double, 3>> waterPoints;
+                waterPoints.reserve(watervector.size());
+                for (const Atom& w : watervector) {
+                    waterPoints.push_back(w.getCoords());
+                }
+
+                LatticeSet waterSet;
+                std::string lattice_error;
+                if (!makeLatticeSet(waterPoints, waterSet, lattice_error)) {
+                    std::cerr << "Error: " << lattice_error << std::endl;
+                    return 1;
+                }
+                std::cout << "-> Writing " << waterSet.count() << " waters as " << waterSet.words.size() << " lattice words to "
+                          << output_file << "_waters.lattice" << std::endl;
+                if (!writeLatticeSet(waterSet, output_file + "_waters.lattice")) return 1;
+            }
 
-    std::cout << "-> Entering categorize_water" << std::endl;
+            if (server) {
+                std::cout << "-> Clustering waters for the query server" << std::endl;
+                server->setWaters(watervector, grid_spacing);
 
-    std::string categorize_water_python = "python categorize_water/categorize_water.py -f " + output_file + "_all_internal_gridpoints.pdb" 
-                                                                        " -s " + vert_file + 
-                                                                        " -o " + output_file +
-                                                                        " -r " + r_value;
-    int result = std::system(categorize_water_python.c_str());
+                // clients wait for this line before sending queries
+                std::cout << "ready" << std::endl;
+                if (serve_target == "-") {
+                    return server->serveStream(std::cin, std::cout);
+                }
+                return server->serveUnixSocket(serve_target);
+            }
 
-    if (result == 0) {
-    } else {
-        std::cerr << "categorize_water.py failed." << std::endl;
-        return 1;
-    }
 
-    std::string reformat_python = "python scripts/reformat.py -o "+ output_file + "_reformatted.pdb " + output_file + "_internal.pdb " + output_file + "_surface.pdb";
+            // only the recomputed waters are categorized; the surface of a --parent run may cover just the region
+            if (!parentCategory.empty()) {
+                std::vector<Atom> recomputed;
+                for (size_t i = 0; i < watervector.size(); i++) {
+                    if (parentCategory[i] < 0) recomputed.push_back(watervector[i]);
+                    else parent_kept.push_back(Atom("HOH", "O", watervector[i].getCoords(), parentCategory[i]));
+                }
+                watervector.swap(recomputed);
+            }
 
-    result = std::system(reformat_python.c_str());
+            std::cout << "-> Entering vectortopdb" << std::endl;
 
-    if (result == 0) {
-    } else {
-        std::cerr << "reformat.py failed." << std::endl;
-        return 1;
-    }
+            vectortopdb(watervector, output_file + "_all_internal_gridpoints.pdb");
+
+            if (hydrophobic_scale) {
+                for (size_t i = 0; i < watervector.size(); i++) {
+                    site_environments[siteKey(watervector[i].getCoords())] = environments[i];
+                }
+            }
+
+
+
+        // ---------- run categorize_water ----------
+        // ---------- this further separates gridpoints into internal/external based on proximity to surface ----------
+
+            std::cout << "-> Entering categorize_water" << std::endl;
+
+            // the script reads plain text, so a compressed -v is inflated into temp/ first, like a generated surface
+            std::string categorize_vert_file = vert_file;
+            if (!compressionSuffix(vert_file).empty()) {
+                categorize_vert_file = "temp/" + std::filesystem::path(stripCompressionSuffix(vert_file)).filename().string();
+                std::string inflate_error;
+                if (!decompressFile(vert_file, categorize_vert_file, &inflate_error)) {
+                    std::cerr << "Error: " << inflate_error << std::endl;
+                    return 1;
+                }
+            }
+
+            std::string categorize_water_python = "python categorize_water/categorize_water.py -f " + output_file + "_all_internal_gridpoints.pdb" 
+                                                                                " -s " + categorize_vert_file + 
+                                                                                " -o " + output_file +
+                                                                                " -r " + r_value;
+            int result;
+            {
+                TRACE_SPAN("categorize_water.py");
+                result = std::system(categorize_water_python.c_str());
+            }
+
+            if (result == 0) {
+            } else {
+                std::cerr << "categorize_water.py failed." << std::endl;
+                return 1;
+            }
+
+            std::string reformat_python = "python scripts/reformat.py -o "+ output_file + "_reformatted.pdb " + output_file + "_internal.pdb " + output_file + "_surface.pdb";
+
+            {
+                TRACE_SPAN("reformat.py");
+                result = std::system(reformat_python.c_str());
+            }
+
+            if (result == 0) {
+            } else {
+                std::cerr << "reformat.py failed." << std::endl;
+                return 1;
+            }
 
-    input_file = output_file + "_reformatted.pdb";
+            input_file = output_file + "_reformatted.pdb";
+        }
     } 
     //---------- begin clustering ----------
 
-    std::tuple<std::vector<Atom>, double, double, double, double, double, double> cluster_tuple = pdbtovector(input_file);
+    std::vector<std::string> remarks;
+    std::vector<std::vector<Atom>> clusters;
+    size_t pointCount = 0;
+
+    bool clustered_in_process = (stream_mode || !trajectory_file.empty()) && !only_cluster;
+
+    if (clustered_in_process) {
+        if (!trajectory_file.empty()) {
+            remarks.push_back("B-FACTOR = fraction of the " + std::to_string(trajectory_frames) + " frames with a water at the site");
+            remarks.push_back("trajectory = " + trajectory_file);
+            remarks.push_back("skin = " + std::to_string(skin_distance) + ", minimum occupancy = " + std::to_string(min_occupancy));
+        } else {
+            // same legend reformat.py writes
+            remarks.push_back("B-FACTOR LEGEND (SOURCE FILES):");
+            remarks.push_back("B-FACTOR 0.00 = internal (streamed)");
+            remarks.push_back("B-FACTOR 1.00 = surface (streamed)");
+        }
+        remarks.push_back("--------------------------------");
+
+        clusters = std::move(streamed_clusters);
+        for (const auto& cluster : clusters) {
+            pointCount += cluster.size();
+        }
+    } else {
+        remarks = extractRemarks(input_file);
+    }
 
-    std::vector<std::string> remarks = extractRemarks(input_file);
     std::string grid_spacing_remark = "grid spacing = " + std::to_string(grid_spacing);
     remarks.push_back(grid_spacing_remark);
-    if(!only_cluster){
+    if(!only_cluster && trajectory_file.empty()){
         std::string radius = "surface +- " + r_value;
-        std::string water_diameter_remark = "water diameter = " + std::to_string(water_diameter);
+        std::string water_diameter_remark = "water diameter = " + std::to_string(water_diameter) + (place_sites ? " (placed sites)" : "");
         std::string vert_file_remark = "vert file = " + vert_file;
         remarks.push_back(radius);  remarks.push_back(water_diameter_remark); remarks.push_back(vert_file_remark);
     }
 
-    std::vector<Atom> allAtoms = std::get<0>(cluster_tuple);
+    if (!clustered_in_process) {
+        std::tuple<std::vector<Atom>, double, double, double, double, double, double> cluster_tuple = pdbtovector(input_file);
+        std::vector<Atom> allAtoms = std::get<0>(cluster_tuple);
+        allAtoms.insert(allAtoms.end(), parent_kept.begin(), parent_kept.end());
+        if (allAtoms.empty()) {
+            std::cerr << "Error: No points read from " << input_file << std::endl;
+            return 1;
+        }
+        pointCount = allAtoms.size();
+
+        // placed sites are a water diameter apart, so they are connected at that step instead of the grid's
+        double cluster_spacing = place_sites ? water_diameter : grid_spacing;
+        double cluster_map_spacing = std::max(hash_spacing, std::sqrt(3.15) * cluster_spacing);
 
-    std::cout << "-> Clustering " << allAtoms.size() << " points" << std::flush;
-    std::vector<std::vector<Atom>> clusters = clusterAtoms(allAtoms, grid_spacing, hash_spacing);
+        std::cout << "-> Clustering " << allAtoms.size() << " points" << std::flush;
+        clusters = clusterAtoms(allAtoms, cluster_spacing, cluster_map_spacing);
+    }
     std::cout << "\n** Found " << clusters.size() << " clusters **" << std::endl;
     
     size_t totalClusteredAtoms = 0;
@@ -295,19 +1514,51 @@ int main(int argc, char* argv[]){
     }
 
     std::cout << "-> Total Clustered Atoms: " << totalClusteredAtoms << "  "
-              << (totalClusteredAtoms == allAtoms.size() ? "PASS" : "FAIL") << std::endl;
+              << (totalClusteredAtoms == pointCount ? "PASS" : "FAIL") << std::endl;
+
+    if (hydrophobic_scale) {
+        // one row per site of the clustered output: its serial and cluster (unwrapped, as the cif/bcif id and
+        // auth_seq_id; the pdb wraps them at 100000 and 9999) and its environment
+        std::cout << "-> Writing hydrophobic environments to " << output_file << "_hydrophobic.csv" << std::endl;
+
+        std::ofstream csv(output_file + "_hydrophobic.csv");
+        csv << "serial,cluster,x,y,z,hydrophobicity,contacts\n" << std::fixed;
+        size_t serial = 1;
+        for (size_t k = 0; k < clusters.size(); k++) {
+            for (const Atom& site : clusters[k]) {
+                std::array<double, 3> c = site.getCoords();
+                auto found = site_environments.find(siteKey(c));
+                if (found == site_environments.end()) {
+                    std::cerr << "Error: No hydrophobic environment for the site at " << c[0] << ", " << c[1] << ", " << c[2] << std::endl;
+                    return 1;
+                }
+                csv << serial++ << "," << k + 1 << "," << std::setprecision(3) << c[0] << "," << c[1] << "," << c[2] << ","
+                    << std::setprecision(4) << found->second.hydrophobicity << "," << found->second.contacts << "\n";
+            }
+        }
+        if (!csv) {
+            std::cerr << "Error: Could not write " << output_file << "_hydrophobic.csv" << std::endl;
+            return 1;
+        }
+    }
 
-    std::cout << "-> Writing to " << output_file << ".pdb" << std::flush;
-    writeClusteredPDB(clusters, output_file, remarks);
+    std::cout << "-> Writing to " << output_file << "." << output_format << output_compression << std::flush;
+    if (output_format == "cif") {
+        if (!writeClusteredCIF(clusters, output_file, remarks, output_compression)) return 1;
+    } else if (output_format == "bcif") {
+        if (!writeClusteredBCIF(clusters, output_file, remarks, output_compression)) return 1;
+    } else {
+        writeClusteredPDB(clusters, output_file, remarks, output_compression);
+    }
 
 
     std::cout << "\n-> Launching pyMOL" << std::endl;
 
     if(pymol && !structure_file.empty()) {
-        createPyMOLSession(output_file, output_file, structure_file);
+        createPyMOLSession(output_file, output_file, structure_file, "." + output_format + output_compression);
     } else if (pymol)
     {
-        createPyMOLSession(output_file, output_file);
+        createPyMOLSession(output_file, output_file, "", "." + output_format + output_compression);
     }
     
 
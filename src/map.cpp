@@ -3,6 +3,64 @@
 #include "AtomicRadii.h"
 #include "common.h"
 
+#include <algorithm>
+
+
+CellStencil makeCellStencil(double cellSize, double reach) {
+    CellStencil stencil;
+    stencil.cellSize = cellSize;
+    stencil.reach = reach;
+
+    // per axis, a cell |d| away is at least (|d| - 1) cells from any point of the center cell
+    int extent = std::max(1, (int)std::ceil(reach / cellSize));
+    std::vector<std::pair<double, GridKey>> cells;
+    for (int dz = -extent; dz <= extent; dz++) {
+        for (int dy = -extent; dy <= extent; dy++) {
+            for (int dx = -extent; dx <= extent; dx++) {
+                double gx = std::max(0, std::abs(dx) - 1) * cellSize;
+                double gy = std::max(0, std::abs(dy) - 1) * cellSize;
+                double gz = std::max(0, std::abs(dz) - 1) * cellSize;
+                double gap = std::sqrt(gx * gx + gy * gy + gz * gz);
+                if (gap <= reach) cells.push_back({gap, {dx, dy, dz}});
+            }
+        }
+    }
+    std::stable_sort(cells.begin(), cells.end(),
+                     [](const std::pair<double, GridKey>& a, const std::pair<double, GridKey>& b) { return a.first < b.first; });
+
+    for (const auto& c : cells) {
+        stencil.minDistance.push_back(c.first);
+        stencil.offsets.push_back(c.second);
+    }
+    return stencil;
+}
+
+CellStencil makeOverlapStencil(const std::vector<Atom>& atoms, double diameter, double cutoff_dist, double cellSize) {
+    double maxRadius = 0;
+    for (const Atom& atom : atoms) {
+        maxRadius = std::max(maxRadius, getParams(atom.get_resname(), atom.get_atomname()).radius_aa);
+    }
+
+    double collisionReach = diameter / 2.0 + maxRadius;
+    double reach = std::max(cutoff_dist, collisionReach);
+    if (cellSize <= 0) cellSize = reach / CELLS_PER_REACH;
+
+    CellStencil stencil = makeCellStencil(cellSize, reach);
+    stencil.collisionReach = collisionReach;
+    return stencil;
+}
+
+std::vector<double> getHydrophobicity(const std::vector<Atom>& atoms, int scale) {
+    std::vector<double> values;
+    if (scale != 1986 && scale != 1989 && scale != 1998) return values;
+
+    values.reserve(atoms.size());
+    for (const Atom& atom : atoms) {
+        AtomParams params = getParams(atom.get_resname(), atom.get_atomname());
+        values.push_back(scale == 1986 ? params.hc_1986 : scale == 1989 ? params.hc_1989 : params.hc_1998);
+    }
+    return values;
+}
 
 GridKey getGridKey(const Atom& input_water, double gridCellSize) {
     std::array<double, 3> pos = input_water.getCoords();
@@ -23,6 +81,7 @@ GridKey getGridKey_pos(const std::array<double, 3> pos, double gridCellSize) {
 
 std::unordered_map<GridKey, std::vector<int>>
 buildSpatialGrid(std::vector<Atom> objects, double gridCellSize) {
+    TRACE_SPAN("buildSpatialGrid");
 
     std::unordered_map<GridKey, std::vector<int>> grid;
 
@@ -63,65 +122,93 @@ void printSpatialGrid(const std::unordered_map<GridKey, std::vector<int>>& grid)
 
 
 //find overlaps and also update nearest neighbors
-bool getOverlap_cluster(const std::unordered_map<GridKey, std::vector<int>>& grid, std::vector<Atom>& Atomvector, std::array<double,3> target, double gridCellSize, double diameter, double cutoff_dist) {
+bool getOverlap_cluster(const std::unordered_map<GridKey, std::vector<int>>& grid, std::vector<Atom>& Atomvector, std::array<double,3> target, const CellStencil& stencil, double diameter, double cutoff_dist,
+                        const std::vector<double>* hydrophobicity, SiteEnvironment* environment) {
 
     double cutoff_dist_sq = (cutoff_dist * cutoff_dist);
     double targetRadius = diameter / 2.0; 
+    double reach_sq = stencil.reach * stencil.reach;
+    double collision_reach_sq = stencil.collisionReach * stencil.collisionReach;
+    double cellSize = stencil.cellSize;
 
 
     // 1. Get the center coordinates of the target particle
-    GridKey centerKey = getGridKey_pos(target, gridCellSize);
+    GridKey centerKey = getGridKey_pos(target, cellSize);
 
     bool at_least_one_neighbor = false;
 
-    // 2. Loop through X, Y, Z offsets (-1, 0, 1)
-    for (int dx = -1; dx <= 1; dx++) {
-        for (int dy = -1; dy <= 1; dy++) {
-            for (int dz = -1; dz <= 1; dz++) {
-                
-                // 3. Construct the neighbor key
-                // Note: Assuming GridKey is a struct with members x, y, z
-                GridKey neighborKey;
-                neighborKey.x = centerKey.x + dx;
-                neighborKey.y = centerKey.y + dy;
-                neighborKey.z = centerKey.z + dz;
-
-                // 4. Try to find this neighbor box in the map
-                auto it = grid.find(neighborKey);
-
-                // 5. If the box exists (contains particles)
-                if (it != grid.end()) {
-
-                    const std::vector<int>& indices = it->second;
-                    
-                    for (int neighborIndex : indices) {  
-
-                        std::array<double,3> origCoords = target;
-                        std::array<double,3> targetCoords = Atomvector[neighborIndex].getCoords();
-
-                        double distance = 0;
-                        double dX = origCoords[0] - targetCoords[0];
-                        double dY = origCoords[1] - targetCoords[1];
-                        double dZ = origCoords[2] - targetCoords[2];
-
-                        distance = (dX*dX) + (dY*dY) + (dZ*dZ);
-
-                        AtomParams params = getParams(Atomvector[neighborIndex].get_resname(), Atomvector[neighborIndex].get_atomname());
-                        double atomradius =  params.radius_aa;
-
-                        double collisionThreshold = targetRadius + atomradius;
-
-                        if(distance <= (collisionThreshold * collisionThreshold)) {
-                            return false;
-                        }
-                        if (distance <= cutoff_dist_sq) {
-                            at_least_one_neighbor = true;
-                        }
+    // scoring needs every atom within the cutoff, so the scan cannot stop at the first neighbor
+    bool scoring = environment && hydrophobicity;
+    if (environment) *environment = SiteEnvironment();
+    double stop_reach = scoring ? std::max(stencil.collisionReach, cutoff_dist) : stencil.collisionReach;
+    double stop_reach_sq = stop_reach * stop_reach;
+    double hydrophobic_sum = 0;
+
+    // 2. Loop through the stencil, nearest cells first
+    for (size_t k = 0; k < stencil.offsets.size(); k++) {
+
+        // once a neighbor is found only a clash can change the answer, and no farther cell can hold one
+        if (at_least_one_neighbor && stencil.minDistance[k] > stop_reach) break;
+
+        // 3. Construct the neighbor key
+        const GridKey& offset = stencil.offsets[k];
+        GridKey neighborKey;
+        neighborKey.x = centerKey.x + offset.x;
+        neighborKey.y = centerKey.y + offset.y;
+        neighborKey.z = centerKey.z + offset.z;
+
+        // skip cells the target itself is too far from (the stencil bound holds for the whole center cell)
+        double gap_sq = 0;
+        int cell[3] = {neighborKey.x, neighborKey.y, neighborKey.z};
+        for (int axis = 0; axis < 3; axis++) {
+            double lo = cell[axis] * cellSize;
+            double gap = std::max({lo - target[axis], target[axis] - (lo + cellSize), 0.0});
+            gap_sq += gap * gap;
+        }
+        if (gap_sq > (at_least_one_neighbor ? stop_reach_sq : reach_sq)) continue;
+
+        // 4. Try to find this neighbor box in the map
+        auto it = grid.find(neighborKey);
+
+        // 5. If the box exists (contains particles)
+        if (it != grid.end()) {
+
+            const std::vector<int>& indices = it->second;
+            
+            for (int neighborIndex : indices) {  
+
+                std::array<double,3> origCoords = target;
+                std::array<double,3> targetCoords = Atomvector[neighborIndex].getCoords();
+
+                double distance = 0;
+                double dX = origCoords[0] - targetCoords[0];
+                double dY = origCoords[1] - targetCoords[1];
+                double dZ = origCoords[2] - targetCoords[2];
+
+                distance = (dX*dX) + (dY*dY) + (dZ*dZ);
+
+                // the radius lookup is a string map, only pay for it when a clash is possible
+                if (distance <= collision_reach_sq) {
+                    AtomParams params = getParams(Atomvector[neighborIndex].get_resname(), Atomvector[neighborIndex].get_atomname());
+                    double atomradius =  params.radius_aa;
+
+                    double collisionThreshold = targetRadius + atomradius;
+
+                    if(distance <= (collisionThreshold * collisionThreshold)) {
+                        return false;
                     }
                 }
-            } 
+                if (distance <= cutoff_dist_sq) {
+                    at_least_one_neighbor = true;
+
+                    if (scoring) {
+                        hydrophobic_sum += (*hydrophobicity)[neighborIndex] * (1.0 - std::sqrt(distance) / cutoff_dist);
+                        environment->contacts++;
+                    }
+                }
+            }
         }
     }
+    if (scoring) environment->hydrophobicity = (float)hydrophobic_sum;
     return at_least_one_neighbor;
 }
-
@@ -0,0 +1,295 @@
+#include "mesh.h"
+
+#include "common.h"
+#include "compress.h"
+#include "parallel.h"
+
+#include <cstdint>
+
+
+std::vector<std::array<int, 3>> face_to_vector(std::string face_file) {
+    TRACE_SPAN("face_to_vector");
+    std::vector<std::array<int, 3>> output;
+    std::unique_ptr<std::istream> infile = openInputStream(face_file);
+    std::string line_string;
+
+    if (!infile) {
+        std::cerr << "Error: Could not open face file: " << face_file << std::endl;
+        return output;
+    }
+
+    int z = 0;
+    while (std::getline(*infile, line_string)) {
+        if (!line_string.empty() && (z > 2)) {
+            std::stringstream ss(line_string);
+            int a, b, c;
+            if (ss >> a >> b >> c) {
+                output.push_back({a - 1, b - 1, c - 1});
+            }
+        }
+        z++;
+    }
+    if (infile->bad()) {
+        std::cerr << "Error: Could not read " << face_file << " to the end (corrupt or truncated)" << std::endl;
+        output.clear();
+    }
+    return output;
+}
+
+static inline float component(const Vec3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+MeshBVH::MeshBVH(const std::vector<Vertex>& surfaceVertices, const std::vector<std::array<int, 3>>& surfaceFaces) {
+    vertices.reserve(surfaceVertices.size());
+    for (const auto& v : surfaceVertices) {
+        vertices.push_back(v.position);
+    }
+
+    // drop faces that reference missing vertices (truncated or mismatched files)
+    for (const auto& f : surfaceFaces) {
+        if (f[0] < 0 || f[1] < 0 || f[2] < 0) continue;
+        if ((size_t)f[0] >= vertices.size() || (size_t)f[1] >= vertices.size() || (size_t)f[2] >= vertices.size()) continue;
+        faces.push_back(f);
+    }
+
+    order.resize(faces.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+
+    if (!faces.empty()) {
+        nodes.reserve(2 * faces.size() / 4 + 1);
+        build(0, (int)faces.size());
+    }
+}
+
+// Median split on the longest axis of the triangle centroids, leaves hold up to 4 triangles
+int MeshBVH::build(int first, int count) {
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+
+    Vec3 boxMin = {FLT_MAX, FLT_MAX, FLT_MAX};
+    Vec3 boxMax = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    Vec3 centMin = boxMin;
+    Vec3 centMax = boxMax;
+
+    for (int i = first; i < first + count; i++) {
+        const auto& f = faces[order[i]];
+        Vec3 centroid = {0.0f, 0.0f, 0.0f};
+        for (int k = 0; k < 3; k++) {
+            const Vec3& p = vertices[f[k]];
+            boxMin = {std::min(boxMin.x, p.x), std::min(boxMin.y, p.y), std::min(boxMin.z, p.z)};
+            boxMax = {std::max(boxMax.x, p.x), std::max(boxMax.y, p.y), std::max(boxMax.z, p.z)};
+            centroid = centroid + p * (1.0f / 3.0f);
+        }
+        centMin = {std::min(centMin.x, centroid.x), std::min(centMin.y, centroid.y), std::min(centMin.z, centroid.z)};
+        centMax = {std::max(centMax.x, centroid.x), std::max(centMax.y, centroid.y), std::max(centMax.z, centroid.z)};
+    }
+
+    nodes[index].boxMin = boxMin;
+    nodes[index].boxMax = boxMax;
+
+    if (count <= 4) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    Vec3 extent = centMax - centMin;
+    int axis = 0;
+    if (extent.y > extent.x && extent.y >= extent.z) axis = 1;
+    else if (extent.z > extent.x && extent.z > extent.y) axis = 2;
+
+    int mid = first + count / 2;
+    std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count,
+        [&](int a, int b) {
+            const auto& fa = faces[a];
+            const auto& fb = faces[b];
+            float ca = component(vertices[fa[0]], axis) + component(vertices[fa[1]], axis) + component(vertices[fa[2]], axis);
+            float cb = component(vertices[fb[0]], axis) + component(vertices[fb[1]], axis) + component(vertices[fb[2]], axis);
+            return ca < cb;
+        });
+
+    int left = build(first, mid - first);
+    int right = build(mid, first + count - mid);
+    nodes[index].left = left;
+    nodes[index].right = right;
+    return index;
+}
+
+size_t MeshBVH::triangleCount() const {
+    return faces.size();
+}
+
+void MeshBVH::lineCrossings(Vec3 origin, int axis, std::vector<float>& outCrossings) const {
+    if (nodes.empty()) return;
+
+    // the line is infinite along `axis`, so only the two other coordinates are tested
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    float pu = component(origin, u);
+    float pv = component(origin, v);
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const BVHNode& node = nodes[stack[--top]];
+
+        if (pu < component(node.boxMin, u) || pu > component(node.boxMax, u)) continue;
+        if (pv < component(node.boxMin, v) || pv > component(node.boxMax, v)) continue;
+
+        if (node.left >= 0) {
+            stack[top++] = node.left;
+            stack[top++] = node.right;
+            continue;
+        }
+
+        for (int i = node.first; i < node.first + node.count; i++) {
+            const auto& f = faces[order[i]];
+            const Vec3& a = vertices[f[0]];
+            const Vec3& b = vertices[f[1]];
+            const Vec3& c = vertices[f[2]];
+
+            // 2D point in triangle on the (u, v) projection
+            float au = component(a, u) - pu, av = component(a, v) - pv;
+            float bu = component(b, u) - pu, bv = component(b, v) - pv;
+            float cu = component(c, u) - pu, cv = component(c, v) - pv;
+
+            float w0 = bu * cv - bv * cu;
+            float w1 = cu * av - cv * au;
+            float w2 = au * bv - av * bu;
+
+            bool positive = w0 > 0.0f && w1 > 0.0f && w2 > 0.0f;
+            bool negative = w0 < 0.0f && w1 < 0.0f && w2 < 0.0f;
+            if (!positive && !negative) continue;
+
+            float sum = w0 + w1 + w2;
+            float hit = (w0 * component(a, axis) + w1 * component(b, axis) + w2 * component(c, axis)) / sum;
+            outCrossings.push_back(hit);
+        }
+    }
+}
+
+void SeparateGridPointsMesh(
+    const std::vector<Vertex>& surfaceVertices,
+    const std::vector<std::array<int, 3>>& surfaceFaces,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float searchRadius,
+    std::vector<Vec3>& outInside,
+    std::vector<Vec3>& outOutside
+) {
+    TRACE_SPAN("SeparateGridPointsMesh");
+    int dim[3] = {
+        static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing)),
+        static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing)),
+        static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing))
+    };
+    size_t slice = (size_t)dim[0] * dim[1];
+    size_t totalCells = slice * dim[2];
+
+    // --- PHASE 1: NARROW BAND (same cells the vertex classifier would look at) ---
+    std::vector<uint8_t> band(totalCells, 0);
+    float searchRadiusSq = searchRadius * searchRadius;
+    int searchRadius_cells = static_cast<int>(std::ceil(searchRadius / spacing));
+
+    parallelFor(dim[2], [&](size_t zBegin, size_t zEnd, unsigned int) {
+        for (const Vertex& vert : surfaceVertices) {
+            int cx = static_cast<int>(std::floor((vert.position.x - minBound.x) / spacing));
+            int cy = static_cast<int>(std::floor((vert.position.y - minBound.y) / spacing));
+            int cz = static_cast<int>(std::floor((vert.position.z - minBound.z) / spacing));
+
+            int z0 = std::max((int)zBegin, cz - searchRadius_cells);
+            int z1 = std::min((int)zEnd - 1, cz + searchRadius_cells);
+
+            for (int z = z0; z <= z1; z++) {
+                for (int y = std::max(0, cy - searchRadius_cells); y <= std::min(dim[1] - 1, cy + searchRadius_cells); y++) {
+                    for (int x = std::max(0, cx - searchRadius_cells); x <= std::min(dim[0] - 1, cx + searchRadius_cells); x++) {
+                        Vec3 gridPos = {minBound.x + x * spacing, minBound.y + y * spacing, minBound.z + z * spacing};
+                        if ((gridPos - vert.position).lengthSq() <= searchRadiusSq) {
+                            band[(size_t)z * slice + (size_t)y * dim[0] + x] = 1;
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // --- PHASE 2: BATCHED PARITY QUERIES ---
+    // One line query per lattice row and axis; a cell is inside along that axis when an odd number
+    // of crossings lie beyond it. The lines are nudged off the lattice so they never graze an edge.
+    MeshBVH bvh(surfaceVertices, surfaceFaces);
+    std::vector<uint8_t> votes(totalCells, 0);
+
+    const float nudge[3] = {spacing * 1.3e-3f, spacing * 2.9e-3f, spacing * 4.1e-3f};
+    const size_t strides[3] = {1, (size_t)dim[0], slice};
+
+    for (int axis = 0; axis < 3; axis++) {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        size_t rows = (size_t)dim[u] * dim[v];
+
+        parallelFor(rows, [&](size_t begin, size_t end, unsigned int) {
+            std::vector<float> crossings;
+
+            for (size_t row = begin; row < end; row++) {
+                int iu = (int)(row % dim[u]);
+                int iv = (int)(row / dim[u]);
+                size_t base = iu * strides[u] + iv * strides[v];
+
+                bool any = false;
+                for (int k = 0; k < dim[axis]; k++) {
+                    if (band[base + k * strides[axis]]) { any = true; break; }
+                }
+                if (!any) continue;
+
+                float coords[3];
+                coords[u] = component(minBound, u) + iu * spacing + nudge[u];
+                coords[v] = component(minBound, v) + iv * spacing + nudge[v];
+                coords[axis] = 0.0f;
+
+                crossings.clear();
+                bvh.lineCrossings({coords[0], coords[1], coords[2]}, axis, crossings);
+                std::sort(crossings.begin(), crossings.end());
+
+                // walk the row once, counting crossings already passed
+                size_t passed = 0;
+                for (int k = 0; k < dim[axis]; k++) {
+                    float position = component(minBound, axis) + k * spacing;
+                    while (passed < crossings.size() && crossings[passed] < position) passed++;
+
+                    size_t cell = base + k * strides[axis];
+                    if (band[cell] && ((crossings.size() - passed) % 2 == 1)) {
+                        votes[cell]++;
+                    }
+                }
+            }
+        });
+    }
+
+    // --- PHASE 3: CLASSIFY ---
+    for (int z = 0; z < dim[2]; z++) {
+        for (int y = 0; y < dim[1]; y++) {
+            for (int x = 0; x < dim[0]; x++) {
+                size_t i = (size_t)z * slice + (size_t)y * dim[0] + (size_t)x;
+                if (!band[i]) continue;
+
+                Vec3 test_point;
+                test_point.x = minBound.x + (x * spacing);
+                test_point.y = minBound.y + (y * spacing);
+                test_point.z = minBound.z + (z * spacing);
+
+                if (votes[i] >= 2) {
+                    outInside.push_back(test_point);
+                } else {
+                    outOutside.push_back(test_point);
+                }
+            }
+        }
+    }
+
+    DEBUG_LOG("SeparateGridPointsMesh: " << bvh.triangleCount() << " triangles, "
+              << outInside.size() << " inside, " << outOutside.size() << " outside");
+}
@@ -0,0 +1,828 @@
+#include "mmcif.h"
+
+#include "AtomicRadii.h"
+#include "common.h"
+#include "compress.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// rows formatted before each fwrite
+static const size_t CIF_BLOCK_BYTES = 1 << 20;
+
+// One row of _atom_site per atom, clusters in rank order
+struct AtomSiteRow {
+    const Atom* atom;
+    long long serial;
+    long long cluster;
+};
+
+static std::vector<AtomSiteRow> atomSiteRows(const std::vector<std::vector<Atom>>& clusters) {
+    std::vector<AtomSiteRow> rows;
+    long long serial = 1;
+    for (size_t i = 0; i < clusters.size(); i++) {
+        for (const Atom& atom : clusters[i]) {
+            rows.push_back({&atom, serial++, (long long)i + 1});
+        }
+    }
+    return rows;
+}
+
+static std::string blockName(const std::string& filename) {
+    std::string name = std::filesystem::path(filename).filename().string();
+    for (char& c : name) {
+        if (c == ' ' || c == '\t') c = '_';
+    }
+    return name.empty() ? "allwaters" : name;
+}
+
+static std::string elementOf(const Atom& atom) {
+    return atom.get_atomname().substr(0, 1);
+}
+
+
+// ==================== mmCIF ====================
+
+bool writeClusteredCIF(const std::vector<std::vector<Atom>>& clusters,
+                       const std::string& filename,
+                       const std::vector<std::string>& remarks,
+                       const std::string& compression) {
+    TRACE_SPAN("writeClusteredCIF");
+    std::unique_ptr<std::ostream> pFile = openOutputStream(filename + ".cif" + compression);
+    if (!pFile) {
+        std::cerr << "Error: Could not open " << filename << ".cif" << compression << " for writing." << std::endl;
+        return false;
+    }
+
+    streamPrintf(*pFile, "data_%s\n#\n", blockName(filename).c_str());
+
+    // semicolon text fields take any remark that does not start a line with ';'
+    if (!remarks.empty()) {
+        streamPrintf(*pFile, "loop_\n_pdbx_database_remark.id\n_pdbx_database_remark.text\n");
+        for (size_t i = 0; i < remarks.size(); i++) {
+            streamPrintf(*pFile, "%zu\n;%s\n;\n", i + 1, remarks[i].c_str());
+        }
+        streamPrintf(*pFile, "#\n");
+    }
+
+    streamPrintf(*pFile, "loop_\n");
+    const char* columns[] = {"group_PDB", "id", "type_symbol", "label_atom_id", "label_comp_id", "label_asym_id",
+                             "label_entity_id", "label_seq_id", "Cartn_x", "Cartn_y", "Cartn_z", "occupancy",
+                             "B_iso_or_equiv", "auth_seq_id", "auth_asym_id", "pdbx_PDB_model_num"};
+    for (const char* column : columns) {
+        streamPrintf(*pFile, "_atom_site.%s\n", column);
+    }
+
+    std::string block;
+    block.reserve(CIF_BLOCK_BYTES + 256);
+    char line[256];
+
+    for (const AtomSiteRow& row : atomSiteRows(clusters)) {
+        std::array<double, 3> c = row.atom->getCoords();
+        int length = snprintf(line, sizeof(line), "HETATM %lld %s %s %s A 1 . %.3f %.3f %.3f 1.00 %.2f %lld A 1\n",
+                              row.serial, elementOf(*row.atom).c_str(), row.atom->get_atomname().c_str(),
+                              row.atom->get_resname().c_str(), c[0], c[1], c[2], row.atom->get_bfactor(), row.cluster);
+        block.append(line, std::min<size_t>(length, sizeof(line) - 1));
+
+        if (block.size() >= CIF_BLOCK_BYTES) {
+            pFile->write(block.data(), (std::streamsize)block.size());
+            block.clear();
+        }
+    }
+    block += "#\n";
+    pFile->write(block.data(), (std::streamsize)block.size());
+
+    return closeOutputStream(*pFile);
+}
+
+
+// ==================== BinaryCIF ====================
+
+// BinaryCIF ByteArray type codes
+enum BinaryCIFType : int {
+    BCIF_INT8 = 1, BCIF_INT16 = 2, BCIF_INT32 = 3,
+    BCIF_UINT8 = 4, BCIF_UINT16 = 5, BCIF_UINT32 = 6,
+    BCIF_FLOAT32 = 32, BCIF_FLOAT64 = 33
+};
+
+// Minimal MessagePack writer (big-endian lengths, the subset BinaryCIF needs)
+class MsgPackWriter {
+    std::vector<uint8_t> bytes;
+
+    void put(uint8_t b) { bytes.push_back(b); }
+    void putBig(uint64_t value, int size) {
+        for (int i = size - 1; i >= 0; i--) put((uint8_t)(value >> (8 * i)));
+    }
+
+    public:
+    void map(size_t n) {
+        if (n < 16) put((uint8_t)(0x80 | n));
+        else if (n < 65536) { put(0xde); putBig(n, 2); }
+        else { put(0xdf); putBig(n, 4); }
+    }
+    void array(size_t n) {
+        if (n < 16) put((uint8_t)(0x90 | n));
+        else if (n < 65536) { put(0xdc); putBig(n, 2); }
+        else { put(0xdd); putBig(n, 4); }
+    }
+    void str(const std::string& s) {
+        size_t n = s.size();
+        if (n < 32) put((uint8_t)(0xa0 | n));
+        else if (n < 256) { put(0xd9); put((uint8_t)n); }
+        else if (n < 65536) { put(0xda); putBig(n, 2); }
+        else { put(0xdb); putBig(n, 4); }
+        bytes.insert(bytes.end(), s.begin(), s.end());
+    }
+    void bin(const std::vector<uint8_t>& data) {
+        size_t n = data.size();
+        if (n < 256) { put(0xc4); put((uint8_t)n); }
+        else if (n < 65536) { put(0xc5); putBig(n, 2); }
+        else { put(0xc6); putBig(n, 4); }
+        bytes.insert(bytes.end(), data.begin(), data.end());
+    }
+    void integer(int64_t v) {
+        if (v >= 0 && v < 128) put((uint8_t)v);
+        else if (v < 0 && v >= -32) put((uint8_t)(int8_t)v);
+        else { put(0xd3); putBig((uint64_t)v, 8); }
+    }
+    void boolean(bool v) { put(v ? 0xc3 : 0xc2); }
+    void nil() { put(0xc0); }
+
+    const std::vector<uint8_t>& data() const { return bytes; }
+};
+
+// One step of a column's encoding chain, written as a MessagePack map
+struct BinaryCIFEncoding {
+    std::string kind;
+    std::vector<std::pair<std::string, int64_t>> params;   // integer parameters (type, origin, srcSize, ...)
+    std::vector<std::pair<std::string, bool>> flags;       // IntegerPacking isUnsigned
+};
+
+struct EncodedColumn {
+    std::vector<BinaryCIFEncoding> encoding;   // in the order applied; readers undo them back to front
+    std::vector<uint8_t> data;
+};
+
+static void writeEncoding(MsgPackWriter& out, const std::vector<BinaryCIFEncoding>& chain) {
+    out.array(chain.size());
+    for (const BinaryCIFEncoding& e : chain) {
+        out.map(1 + e.params.size() + e.flags.size());
+        out.str("kind");
+        out.str(e.kind);
+        for (const auto& p : e.params) {
+            out.str(p.first);
+            out.integer(p.second);
+        }
+        for (const auto& f : e.flags) {
+            out.str(f.first);
+            out.boolean(f.second);
+        }
+    }
+}
+
+template <typename T>
+static std::vector<uint8_t> littleEndianBytes(const std::vector<T>& values) {
+    // x86/ARM hosts are little endian, as BinaryCIF byte arrays are
+    std::vector<uint8_t> bytes(values.size() * sizeof(T));
+    if (!values.empty()) std::memcpy(bytes.data(), values.data(), bytes.size());
+    return bytes;
+}
+
+// IntegerPacking: every value as a run of 1 or 2 byte words, saturated words continue into the next
+static size_t packedLength(const std::vector<int32_t>& values, int byteCount, bool isUnsigned) {
+    int64_t upper = isUnsigned ? (byteCount == 1 ? 0xFF : 0xFFFF) : (byteCount == 1 ? 0x7F : 0x7FFF);
+    int64_t lower = isUnsigned ? 0 : -upper - 1;
+    size_t length = 0;
+    for (int32_t v : values) {
+        if (v >= 0) length += (size_t)(v / upper) + 1;
+        else length += (size_t)(v / lower) + 1;
+    }
+    return length;
+}
+
+template <typename T>
+static std::vector<T> packIntegers(const std::vector<int32_t>& values, bool isUnsigned) {
+    int64_t upper = std::numeric_limits<T>::max();
+    int64_t lower = isUnsigned ? 0 : std::numeric_limits<T>::min();
+    std::vector<T> packed;
+    for (int32_t value : values) {
+        int64_t v = value;
+        if (v >= 0) {
+            while (v >= upper) { packed.push_back((T)upper); v -= upper; }
+        } else {
+            while (v <= lower) { packed.push_back((T)lower); v -= lower; }
+        }
+        packed.push_back((T)v);
+    }
+    return packed;
+}
+
+// Int32 values into bytes: packed into 1 or 2 byte words when that is smaller, plain Int32 otherwise
+static void finishIntegers(const std::vector<int32_t>& values, EncodedColumn& column) {
+    bool isUnsigned = true;
+    for (int32_t v : values) {
+        if (v < 0) { isUnsigned = false; break; }
+    }
+
+    size_t size1 = packedLength(values, 1, isUnsigned);
+    size_t size2 = packedLength(values, 2, isUnsigned) * 2;
+    size_t size4 = values.size() * 4;
+
+    if (size4 <= size1 && size4 <= size2) {
+        column.encoding.push_back({"ByteArray", {{"type", BCIF_INT32}}, {}});
+        column.data = littleEndianBytes(values);
+        return;
+    }
+
+    int byteCount = size1 <= size2 ? 1 : 2;
+    column.encoding.push_back({"IntegerPacking", {{"byteCount", byteCount}, {"srcSize", (int64_t)values.size()}}, {{"isUnsigned", isUnsigned}}});
+    if (byteCount == 1) {
+        column.encoding.push_back({"ByteArray", {{"type", isUnsigned ? BCIF_UINT8 : BCIF_INT8}}, {}});
+        column.data = isUnsigned ? littleEndianBytes(packIntegers<uint8_t>(values, true))
+                                 : littleEndianBytes(packIntegers<int8_t>(values, false));
+    } else {
+        column.encoding.push_back({"ByteArray", {{"type", isUnsigned ? BCIF_UINT16 : BCIF_INT16}}, {}});
+        column.data = isUnsigned ? littleEndianBytes(packIntegers<uint16_t>(values, true))
+                                 : littleEndianBytes(packIntegers<int16_t>(values, false));
+    }
+}
+
+// Integer column: optionally delta coded (sorted ids, coordinates), optionally run-length coded (repeats)
+static EncodedColumn encodeIntegers(std::vector<int32_t> values, bool delta, bool runLength) {
+    EncodedColumn column;
+
+    if (delta && !values.empty()) {
+        int32_t origin = values[0];
+        for (size_t i = values.size() - 1; i > 0; i--) values[i] -= values[i - 1];
+        values[0] = 0;
+        column.encoding.push_back({"Delta", {{"origin", origin}, {"srcType", BCIF_INT32}}, {}});
+    }
+
+    if (runLength) {
+        std::vector<int32_t> runs;
+        for (size_t i = 0; i < values.size();) {
+            size_t j = i;
+            while (j < values.size() && values[j] == values[i]) j++;
+            runs.push_back(values[i]);
+            runs.push_back((int32_t)(j - i));
+            i = j;
+        }
+        column.encoding.push_back({"RunLength", {{"srcType", BCIF_INT32}, {"srcSize", (int64_t)values.size()}}, {}});
+        values.swap(runs);
+    }
+
+    finishIntegers(values, column);
+    return column;
+}
+
+// Float column as fixed point integers (value * factor, rounded), then as an integer column
+static EncodedColumn encodeFixedPoint(const std::vector<double>& values, int factor, bool delta, bool runLength) {
+    std::vector<int32_t> fixed(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        fixed[i] = (int32_t)std::lround(values[i] * factor);
+    }
+    EncodedColumn column = encodeIntegers(fixed, delta, runLength);
+    column.encoding.insert(column.encoding.begin(), {"FixedPoint", {{"factor", factor}, {"srcType", BCIF_FLOAT32}}, {}});
+    return column;
+}
+
+// String column: the distinct strings concatenated, the column as run-length coded indices into them
+static void writeStringColumn(MsgPackWriter& out, const std::vector<std::string>& values) {
+    std::map<std::string, int32_t> indexOf;
+    std::vector<int32_t> indices(values.size());
+    std::string stringData;
+    std::vector<int32_t> offsets = {0};
+
+    for (size_t i = 0; i < values.size(); i++) {
+        auto it = indexOf.find(values[i]);
+        if (it == indexOf.end()) {
+            it = indexOf.emplace(values[i], (int32_t)indexOf.size()).first;
+            stringData += values[i];
+            offsets.push_back((int32_t)stringData.size());
+        }
+        indices[i] = it->second;
+    }
+
+    EncodedColumn data = encodeIntegers(indices, false, true);
+    EncodedColumn offsetColumn = encodeIntegers(offsets, true, false);
+
+    out.map(2);
+    out.str("encoding");
+    out.array(1);
+    out.map(5);
+    out.str("kind");
+    out.str("StringArray");
+    out.str("dataEncoding");
+    writeEncoding(out, data.encoding);
+    out.str("stringData");
+    out.str(stringData);
+    out.str("offsetEncoding");
+    writeEncoding(out, offsetColumn.encoding);
+    out.str("offsets");
+    out.bin(offsetColumn.data);
+    out.str("data");
+    out.bin(data.data);
+}
+
+// mask, when given, holds a byte per row: 0 for a value, 1 for '.' (not applicable), 2 for '?' (unknown)
+static void writeColumn(MsgPackWriter& out, const std::string& name, const EncodedColumn& column,
+                        const EncodedColumn* mask = nullptr) {
+    out.map(3);
+    out.str("name");
+    out.str(name);
+    out.str("data");
+    out.map(2);
+    out.str("encoding");
+    writeEncoding(out, column.encoding);
+    out.str("data");
+    out.bin(column.data);
+    out.str("mask");
+    if (!mask) {
+        out.nil();
+        return;
+    }
+    out.map(2);
+    out.str("encoding");
+    writeEncoding(out, mask->encoding);
+    out.str("data");
+    out.bin(mask->data);
+}
+
+static void writeColumn(MsgPackWriter& out, const std::string& name, const std::vector<std::string>& values) {
+    out.map(3);
+    out.str("name");
+    out.str(name);
+    out.str("data");
+    writeStringColumn(out, values);
+    out.str("mask");
+    out.nil();
+}
+
+bool writeClusteredBCIF(const std::vector<std::vector<Atom>>& clusters,
+                        const std::string& filename,
+                        const std::vector<std::string>& remarks,
+                        const std::string& compression) {
+    TRACE_SPAN("writeClusteredBCIF");
+    std::vector<AtomSiteRow> rows = atomSiteRows(clusters);
+    size_t n = rows.size();
+
+    MsgPackWriter out;
+    out.map(3);
+    out.str("version");
+    out.str("0.3.0");
+    out.str("encoder");
+    out.str("allwaters");
+    out.str("dataBlocks");
+    out.array(1);
+    out.map(2);
+    out.str("header");
+    out.str(blockName(filename));
+    out.str("categories");
+    out.array(remarks.empty() ? 1 : 2);
+
+    if (!remarks.empty()) {
+        std::vector<int32_t> ids(remarks.size());
+        for (size_t i = 0; i < remarks.size(); i++) ids[i] = (int32_t)i + 1;
+
+        out.map(3);
+        out.str("name");
+        out.str("_pdbx_database_remark");
+        out.str("columns");
+        out.array(2);
+        writeColumn(out, "id", encodeIntegers(ids, true, true));
+        writeColumn(out, "text", remarks);
+        out.str("rowCount");
+        out.integer((int64_t)remarks.size());
+    }
+
+    // --- _atom_site, column by column ---
+    std::vector<std::string> elements(n), atomNames(n), resNames(n);
+    std::vector<std::string> group(n, "HETATM"), chain(n, "A"), entity(n, "1");
+    std::vector<int32_t> serials(n), clusterIds(n), models(n, 1), seq(n, 0), seqMissing(n, 1);
+    std::vector<double> x(n), y(n), z(n), occupancy(n, 1.0), bfactors(n);
+
+    for (size_t i = 0; i < n; i++) {
+        const Atom& atom = *rows[i].atom;
+        std::array<double, 3> c = atom.getCoords();
+        elements[i] = elementOf(atom);
+        atomNames[i] = atom.get_atomname();
+        resNames[i] = atom.get_resname();
+        serials[i] = (int32_t)rows[i].serial;
+        clusterIds[i] = (int32_t)rows[i].cluster;
+        x[i] = c[0];
+        y[i] = c[1];
+        z[i] = c[2];
+        bfactors[i] = atom.get_bfactor();
+    }
+
+    out.map(3);
+    out.str("name");
+    out.str("_atom_site");
+    out.str("columns");
+    out.array(16);
+    writeColumn(out, "group_PDB", group);
+    writeColumn(out, "id", encodeIntegers(serials, true, true));
+    writeColumn(out, "type_symbol", elements);
+    writeColumn(out, "label_atom_id", atomNames);
+    writeColumn(out, "label_comp_id", resNames);
+    writeColumn(out, "label_asym_id", chain);
+    writeColumn(out, "label_entity_id", entity);
+    // waters have no label_seq_id: an integer column, every row masked as '.'
+    EncodedColumn seqMask = encodeIntegers(seqMissing, false, true);
+    writeColumn(out, "label_seq_id", encodeIntegers(seq, false, true), &seqMask);
+    // waters of a cluster are neighbors on the grid, so successive coordinates differ by little
+    writeColumn(out, "Cartn_x", encodeFixedPoint(x, 1000, true, false));
+    writeColumn(out, "Cartn_y", encodeFixedPoint(y, 1000, true, false));
+    writeColumn(out, "Cartn_z", encodeFixedPoint(z, 1000, true, false));
+    writeColumn(out, "occupancy", encodeFixedPoint(occupancy, 100, false, true));
+    writeColumn(out, "B_iso_or_equiv", encodeFixedPoint(bfactors, 100, false, true));
+    writeColumn(out, "auth_seq_id", encodeIntegers(clusterIds, true, true));
+    writeColumn(out, "auth_asym_id", chain);
+    writeColumn(out, "pdbx_PDB_model_num", encodeIntegers(models, false, true));
+    out.str("rowCount");
+    out.integer((int64_t)n);
+
+    std::unique_ptr<std::ostream> pFile = openOutputStream(filename + ".bcif" + compression);
+    if (!pFile) {
+        std::cerr << "Error: Could not open " << filename << ".bcif" << compression << " for writing." << std::endl;
+        return false;
+    }
+    pFile->write(reinterpret_cast<const char*>(out.data().data()), (std::streamsize)out.data().size());
+    return closeOutputStream(*pFile);
+}
+
+
+// ==================== mmCIF input ====================
+
+bool isCIFFile(const std::string& filename) {
+    std::string extension = std::filesystem::path(stripCompressionSuffix(filename)).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    return extension == ".cif" || extension == ".mmcif";
+}
+
+// Read-only mapping of a whole file; a compressed file is inflated into memory instead
+class MappedFile {
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::string inflated;
+
+    public:
+    explicit MappedFile(const std::string& path) {
+        if (!compressionSuffix(path).empty()) {
+            std::string error;
+            std::unique_ptr<std::istream> in = openInputStream(path, &error);
+            if (!in) {
+                std::cerr << "Error: " << error << std::endl;
+                return;
+            }
+            std::vector<char> chunk(1 << 20);
+            while (in->read(chunk.data(), (std::streamsize)chunk.size()) || in->gcount() > 0) {
+                inflated.append(chunk.data(), (size_t)in->gcount());
+            }
+            if (in->bad()) {
+                std::cerr << "Error: " << path << " is corrupt or truncated" << std::endl;
+                inflated.clear();
+                return;
+            }
+            if (!inflated.empty()) {
+                bytes = inflated.data();
+                length = inflated.size();
+            }
+            return;
+        }
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                bytes = static_cast<const char*>(mapped);
+                length = (size_t)info.st_size;
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (bytes && inflated.empty()) munmap(const_cast<char*>(bytes), length);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+static bool isCIFSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Splits the next value off [p, end): a bare word, or a '...' / "..." string whose closing quote is
+// followed by whitespace. value is set without the quotes. Returns the position after the value, or
+// nullptr when only whitespace is left.
+static const char* nextValue(const char* p, const char* end, std::string_view& value) {
+    while (p < end && isCIFSpace(*p)) p++;
+    if (p >= end) return nullptr;
+
+    if (*p == '\'' || *p == '"') {
+        char quote = *p++;
+        const char* begin = p;
+        while (p < end && !(*p == quote && (p + 1 == end || isCIFSpace(p[1])))) p++;
+        value = std::string_view(begin, p - begin);
+        return p < end ? p + 1 : p;
+    }
+
+    const char* begin = p;
+    while (p < end && !isCIFSpace(*p)) p++;
+    value = std::string_view(begin, p - begin);
+    return p;
+}
+
+static bool startsWith(const char* p, const char* end, const char* word) {
+    size_t n = std::strlen(word);
+    return (size_t)(end - p) >= n && std::strncmp(p, word, n) == 0;
+}
+
+// A line that ends a loop's values: the next tag, loop or block
+static bool endsLoop(const char* line, const char* end) {
+    return *line == '_' || startsWith(line, end, "loop_") || startsWith(line, end, "data_") ||
+           startsWith(line, end, "save_") || startsWith(line, end, "global_") || startsWith(line, end, "stop_");
+}
+
+// _atom_site columns the reader maps, -1 when absent
+struct AtomSiteColumns {
+    int count = 0;
+    int x = -1, y = -1, z = -1, bfactor = -1;
+    int comp = -1, atom = -1, chain = -1, seq = -1, model = -1;
+};
+
+static bool missingValue(std::string_view v) {
+    return v.empty() || v == "?" || v == ".";
+}
+
+static double parseNumber(std::string_view v) {
+    double out = 0.0;
+    if (missingValue(v)) return 0.0;
+    if (v[0] == '+') v.remove_prefix(1);
+    std::from_chars(v.data(), v.data() + v.size(), out);
+    return out;
+}
+
+static int parseInteger(std::string_view v, int fallback) {
+    int out = fallback;
+    if (missingValue(v)) return fallback;
+    if (v[0] == '+') v.remove_prefix(1);
+    std::from_chars(v.data(), v.data() + v.size(), out);
+    return out;
+}
+
+// One row of values into an Atom, the same fields pdbtovector takes from the fixed columns
+static void appendRow(const std::vector<std::string_view>& row, const AtomSiteColumns& columns,
+                      std::vector<Atom>& atoms, std::vector<AtomSiteIdentity>* identities) {
+    std::string resName(row[columns.comp]);
+    std::string atomName(row[columns.atom]);
+    std::array<double, 3> coords = {parseNumber(row[columns.x]), parseNumber(row[columns.y]), parseNumber(row[columns.z])};
+    double b_factor = columns.bfactor >= 0 ? parseNumber(row[columns.bfactor]) : 0.0;
+
+    Atom atom(resName, atomName, coords, b_factor);
+    atom.set_radius(getParams(resName, atomName).radius_aa);
+    atoms.push_back(std::move(atom));
+
+    if (identities) {
+        AtomSiteIdentity identity;
+        if (columns.chain >= 0 && !missingValue(row[columns.chain])) identity.chain = std::string(row[columns.chain]);
+        if (columns.seq >= 0) identity.seq = parseInteger(row[columns.seq], 0);
+        if (columns.model >= 0) identity.model = parseInteger(row[columns.model], 1);
+        identities->push_back(std::move(identity));
+    }
+}
+
+// Maps the tags of the _atom_site loop to the columns used; auth_ ids win over label_ ids like the
+// names a PDB file of the same structure carries
+static AtomSiteColumns mapColumns(const std::vector<std::string>& tags) {
+    AtomSiteColumns columns;
+    columns.count = (int)tags.size();
+    int labelComp = -1, labelAtom = -1, labelChain = -1, labelSeq = -1;
+
+    for (int i = 0; i < (int)tags.size(); i++) {
+        const std::string& tag = tags[i];
+        if (tag == "Cartn_x") columns.x = i;
+        else if (tag == "Cartn_y") columns.y = i;
+        else if (tag == "Cartn_z") columns.z = i;
+        else if (tag == "B_iso_or_equiv") columns.bfactor = i;
+        else if (tag == "auth_comp_id") columns.comp = i;
+        else if (tag == "label_comp_id") labelComp = i;
+        else if (tag == "auth_atom_id") columns.atom = i;
+        else if (tag == "label_atom_id") labelAtom = i;
+        else if (tag == "auth_asym_id") columns.chain = i;
+        else if (tag == "label_asym_id") labelChain = i;
+        else if (tag == "auth_seq_id") columns.seq = i;
+        else if (tag == "label_seq_id") labelSeq = i;
+        else if (tag == "pdbx_PDB_model_num") columns.model = i;
+    }
+    if (columns.comp < 0) columns.comp = labelComp;
+    if (columns.atom < 0) columns.atom = labelAtom;
+    if (columns.chain < 0) columns.chain = labelChain;
+    if (columns.seq < 0) columns.seq = labelSeq;
+    return columns;
+}
+
+// Finds the _atom_site loop: fills its tags and returns the offset of its first value line,
+// or std::string::npos. Semicolon text fields of other categories are skipped whole.
+static size_t findAtomSiteLoop(const char* data, size_t size, std::vector<std::string>& tags) {
+    const char* end = data + size;
+    const char* line = data;
+    bool inLoop = false;
+    bool inText = false;
+
+    while (line < end) {
+        const char* next = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        const char* lineEnd = next ? next : end;
+        next = next ? next + 1 : end;
+
+        if (*line == ';') {
+            inText = !inText;
+        } else if (!inText) {
+            if (startsWith(line, lineEnd, "loop_")) {
+                inLoop = true;
+                tags.clear();
+            } else if (inLoop && startsWith(line, lineEnd, "_atom_site.")) {
+                const char* tagEnd = line + 11;
+                while (tagEnd < lineEnd && !isCIFSpace(*tagEnd)) tagEnd++;
+                tags.emplace_back(line + 11, tagEnd);
+            } else if (inLoop && !tags.empty()) {
+                return (size_t)(line - data);
+            } else if (*line == '_') {
+                inLoop = false;
+            }
+        }
+        line = next;
+    }
+    return std::string::npos;
+}
+
+// Values of one chunk parsed one row per line; bad when a line does not hold exactly one row
+struct AtomSiteChunk {
+    std::vector<Atom> atoms;
+    std::vector<AtomSiteIdentity> identities;
+    bool stopped = false;   // reached the end of the loop
+    bool bad = false;
+};
+
+static void parseChunk(const char* data, size_t begin, size_t end, size_t size,
+                       const AtomSiteColumns& columns, bool wantIdentities, AtomSiteChunk& chunk) {
+    const char* fileEnd = data + size;
+    const char* line = data + begin;
+    // a chunk starts at the first line that begins inside it
+    if (begin > 0 && data[begin - 1] != '\n') {
+        const char* newline = static_cast<const char*>(std::memchr(line, '\n', fileEnd - line));
+        line = newline ? newline + 1 : fileEnd;
+    }
+
+    std::vector<std::string_view> row(columns.count);
+    std::vector<AtomSiteIdentity>* identities = wantIdentities ? &chunk.identities : nullptr;
+
+    while (line < data + end && line < fileEnd) {
+        const char* newline = static_cast<const char*>(std::memchr(line, '\n', fileEnd - line));
+        const char* lineEnd = newline ? newline : fileEnd;
+        const char* next = newline ? newline + 1 : fileEnd;
+
+        const char* p = line;
+        while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+        if (p == lineEnd || *p == '#') {
+            line = next;
+            continue;
+        }
+        if (endsLoop(line, lineEnd)) {
+            chunk.stopped = true;
+            return;
+        }
+        if (*line == ';') {
+            chunk.bad = true;
+            return;
+        }
+
+        int n = 0;
+        std::string_view value;
+        while (n <= columns.count && (p = nextValue(p, lineEnd, value)) != nullptr) {
+            if (n < columns.count) row[n] = value;
+            n++;
+        }
+        if (n != columns.count) {
+            chunk.bad = true;
+            return;
+        }
+        appendRow(row, columns, chunk.atoms, identities);
+        line = next;
+    }
+}
+
+// The general reading of the loop's values: a stream of values, rows of columns.count of them wherever
+// the line breaks fall, semicolon text fields and comments included
+static void parseSerial(const char* data, size_t begin, size_t size, const AtomSiteColumns& columns,
+                        std::vector<Atom>& atoms, std::vector<AtomSiteIdentity>* identities) {
+    const char* end = data + size;
+    const char* p = data + begin;
+    std::vector<std::string_view> row;
+    row.reserve(columns.count);
+
+    while (p < end) {
+        while (p < end && isCIFSpace(*p)) p++;
+        if (p >= end) break;
+
+        bool lineStart = p == data || p[-1] == '\n';
+        if (*p == '#') {
+            const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            p = newline ? newline + 1 : end;
+            continue;
+        }
+        if (lineStart && endsLoop(p, end)) break;
+
+        std::string_view value;
+        if (lineStart && *p == ';') {
+            // text field: up to the next line starting with ';'
+            const char* begin = p + 1;
+            const char* q = begin;
+            while (q < end && !(*q == ';' && q[-1] == '\n')) q++;
+            value = std::string_view(begin, (q > begin && q[-1] == '\n' ? q - 1 : q) - begin);
+            p = q < end ? q + 1 : end;
+        } else {
+            p = nextValue(p, end, value);
+            if (!p) break;
+        }
+
+        row.push_back(value);
+        if ((int)row.size() == columns.count) {
+            appendRow(row, columns, atoms, identities);
+            row.clear();
+        }
+    }
+}
+
+std::vector<Atom> readAtomSiteCIF(const std::string& filename, std::vector<AtomSiteIdentity>* identities) {
+    TRACE_SPAN("readAtomSiteCIF");
+    std::vector<Atom> atoms;
+    if (identities) identities->clear();
+
+    MappedFile file(filename);
+    if (!file.data()) {
+        std::cerr << "Error: Could not read " << filename << std::endl;
+        return atoms;
+    }
+
+    std::vector<std::string> tags;
+    size_t dataStart = findAtomSiteLoop(file.data(), file.size(), tags);
+    AtomSiteColumns columns = mapColumns(tags);
+    if (dataStart == std::string::npos || columns.x < 0 || columns.y < 0 || columns.z < 0 ||
+        columns.comp < 0 || columns.atom < 0) {
+        std::cerr << "Error: No _atom_site loop with coordinates, residue and atom names in " << filename << std::endl;
+        return atoms;
+    }
+
+    size_t length = file.size() - dataStart;
+    std::vector<AtomSiteChunk> chunks(parallelChunkCount(length));
+    parallelFor(length, [&](size_t begin, size_t end, unsigned int c) {
+        parseChunk(file.data(), dataStart + begin, dataStart + end, file.size(), columns, identities != nullptr, chunks[c]);
+    });
+
+    // chunks in file order up to the one that reached the end of the loop; chunks past it read other categories
+    bool regular = true;
+    size_t total = 0;
+    size_t used = 0;
+    while (used < chunks.size()) {
+        regular = regular && !chunks[used].bad;
+        total += chunks[used].atoms.size();
+        if (chunks[used++].stopped) break;
+    }
+
+    if (!regular) {
+        parseSerial(file.data(), dataStart, file.size(), columns, atoms, identities);
+        return atoms;
+    }
+
+    atoms.reserve(total);
+    if (identities) identities->reserve(total);
+    for (size_t c = 0; c < used; c++) {
+        std::move(chunks[c].atoms.begin(), chunks[c].atoms.end(), std::back_inserter(atoms));
+        if (identities) std::move(chunks[c].identities.begin(), chunks[c].identities.end(), std::back_inserter(*identities));
+    }
+    return atoms;
+}
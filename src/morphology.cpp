@@ -0,0 +1,288 @@
+#include "morphology.h"
+
+#include "AtomicRadii.h"
+#include "common.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <functional>
+
+
+static const float EDT_INF = 1e20f;
+
+// 1D squared distance transform of the sampled function f (lower envelope of parabolas).
+// v and z are scratch buffers of size n and n + 1.
+static void distanceTransform1D(const float* f, int n, float* d, int* v, float* z) {
+    int k = 0;
+    v[0] = 0;
+    z[0] = -EDT_INF;
+    z[1] = EDT_INF;
+
+    // z[0] = -INF guarantees the pop loop stops at the first parabola
+    for (int q = 1; q < n; q++) {
+        float s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        while (s <= z[k]) {
+            k--;
+            s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.0f * (q - v[k]));
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = EDT_INF;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q) k++;
+        float diff = (float)(q - v[k]);
+        d[q] = diff * diff + f[v[k]];
+    }
+}
+
+// Runs the 1D transform along one axis for every line of the grid
+static void transformAxis(std::vector<float>& dist, size_t lines, int length, size_t stride,
+                          const std::function<size_t(size_t)>& lineStart, bool parallel) {
+    auto run = [&](size_t begin, size_t end, unsigned int) {
+        std::vector<float> f(length), d(length), z(length + 1);
+        std::vector<int> v(length);
+
+        for (size_t line = begin; line < end; line++) {
+            size_t base = lineStart(line);
+
+            bool any_finite = false;
+            for (int i = 0; i < length; i++) {
+                f[i] = dist[base + i * stride];
+                if (f[i] < EDT_INF) any_finite = true;
+            }
+            if (!any_finite) continue;
+
+            distanceTransform1D(f.data(), length, d.data(), v.data(), z.data());
+
+            for (int i = 0; i < length; i++) {
+                dist[base + i * stride] = d[i];
+            }
+        }
+    };
+
+    if (parallel) {
+        parallelFor(lines, run);
+    } else {
+        run(0, lines, 0);
+    }
+}
+
+std::vector<float> squaredDistanceTransform(const std::vector<uint8_t>& mask, int dimX, int dimY, int dimZ, bool parallel) {
+    size_t slice = (size_t)dimX * dimY;
+    std::vector<float> dist(mask.size());
+
+    for (size_t i = 0; i < mask.size(); i++) {
+        dist[i] = mask[i] ? 0.0f : EDT_INF;
+    }
+
+    // X lines: one per (y, z)
+    transformAxis(dist, (size_t)dimY * dimZ, dimX, 1,
+        [&](size_t line) { return line * dimX; }, parallel);
+
+    // Y lines: one per (x, z)
+    transformAxis(dist, (size_t)dimX * dimZ, dimY, dimX,
+        [&](size_t line) { return (line / dimX) * slice + (line % dimX); }, parallel);
+
+    // Z lines: one per (x, y)
+    transformAxis(dist, slice, dimZ, slice,
+        [&](size_t line) { return line; }, parallel);
+
+    return dist;
+}
+
+void SeparateGridPointsMorphology(
+    const std::vector<Atom>& atoms,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float probeRadius,
+    float searchRadius,
+    std::vector<Vec3>& outInside,
+    std::vector<Vec3>& outOutside,
+    std::vector<Vertex>* outSurface,
+    float density
+) {
+    TRACE_SPAN("SeparateGridPointsMorphology");
+    // same lattice as SeparateGridPoints
+    int dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing));
+    int dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing));
+    int dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing));
+    size_t slice = (size_t)dimX * dimY;
+    size_t totalCells = slice * dimZ;
+
+    // --- PHASE 1: RASTERIZE ATOM SPHERES ---
+    // Each thread owns a range of z slices, so writes never collide.
+    std::vector<Vec3> centers(atoms.size());
+    std::vector<float> radii(atoms.size());
+    for (size_t i = 0; i < atoms.size(); i++) {
+        std::array<double, 3> c = atoms[i].getCoords();
+        centers[i] = {(float)c[0], (float)c[1], (float)c[2]};
+        radii[i] = (float)getParams(atoms[i].get_resname(), atoms[i].get_atomname()).radius_ua;
+    }
+
+    std::vector<uint8_t> mask(totalCells, 0);
+
+    parallelFor(dimZ, [&](size_t zBegin, size_t zEnd, unsigned int) {
+        for (size_t a = 0; a < centers.size(); a++) {
+            const Vec3& c = centers[a];
+            float r = radii[a];
+            if (r <= 0.0f) continue;
+
+            int z0 = std::max((int)zBegin, (int)std::ceil((c.z - r - minBound.z) / spacing));
+            int z1 = std::min((int)zEnd - 1, (int)std::floor((c.z + r - minBound.z) / spacing));
+            if (z0 > z1) continue;
+
+            int y0 = std::max(0, (int)std::ceil((c.y - r - minBound.y) / spacing));
+            int y1 = std::min(dimY - 1, (int)std::floor((c.y + r - minBound.y) / spacing));
+            int x0 = std::max(0, (int)std::ceil((c.x - r - minBound.x) / spacing));
+            int x1 = std::min(dimX - 1, (int)std::floor((c.x + r - minBound.x) / spacing));
+
+            float rSq = r * r;
+            for (int z = z0; z <= z1; z++) {
+                float dz = minBound.z + z * spacing - c.z;
+                for (int y = y0; y <= y1; y++) {
+                    float dy = minBound.y + y * spacing - c.y;
+                    for (int x = x0; x <= x1; x++) {
+                        float dx = minBound.x + x * spacing - c.x;
+                        if (dx * dx + dy * dy + dz * dz <= rSq) {
+                            mask[(size_t)z * slice + (size_t)y * dimX + x] = 1;
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // --- PHASE 2: CLOSING BY THE PROBE (dilate, then erode) ---
+    float probeSq = (probeRadius / spacing) * (probeRadius / spacing);
+    {
+        std::vector<float> dist = squaredDistanceTransform(mask, dimX, dimY, dimZ);
+        for (size_t i = 0; i < totalCells; i++) {
+            mask[i] = dist[i] <= probeSq ? 0 : 1; // 1 = outside the dilated atoms
+        }
+    }
+    {
+        std::vector<float> dist = squaredDistanceTransform(mask, dimX, dimY, dimZ);
+        for (size_t i = 0; i < totalCells; i++) {
+            mask[i] = dist[i] > probeSq ? 1 : 0; // 1 = solvent excluded
+        }
+    }
+
+    // --- PHASE 3: BURIED CAVITIES BELONG TO THE INTERIOR ---
+    // Flood the solvent from the box border; whatever solvent it cannot reach is a cavity.
+    {
+        std::vector<uint8_t> reached(totalCells, 0);
+        std::vector<size_t> stack;
+
+        for (int z = 0; z < dimZ; z++) {
+            for (int y = 0; y < dimY; y++) {
+                for (int x = 0; x < dimX; x++) {
+                    if (x != 0 && y != 0 && z != 0 && x != dimX - 1 && y != dimY - 1 && z != dimZ - 1) continue;
+                    size_t i = (size_t)z * slice + (size_t)y * dimX + x;
+                    if (!mask[i] && !reached[i]) {
+                        reached[i] = 1;
+                        stack.push_back(i);
+                    }
+                }
+            }
+        }
+
+        while (!stack.empty()) {
+            size_t i = stack.back();
+            stack.pop_back();
+
+            int z = (int)(i / slice);
+            int y = (int)((i % slice) / dimX);
+            int x = (int)(i % dimX);
+
+            const int dx[6] = {1, -1, 0, 0, 0, 0};
+            const int dy[6] = {0, 0, 1, -1, 0, 0};
+            const int dz[6] = {0, 0, 0, 0, 1, -1};
+
+            for (int n = 0; n < 6; n++) {
+                int nx = x + dx[n], ny = y + dy[n], nz = z + dz[n];
+                if (nx < 0 || nx >= dimX || ny < 0 || ny >= dimY || nz < 0 || nz >= dimZ) continue;
+
+                size_t j = (size_t)nz * slice + (size_t)ny * dimX + nx;
+                if (!mask[j] && !reached[j]) {
+                    reached[j] = 1;
+                    stack.push_back(j);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < totalCells; i++) {
+            if (!reached[i]) mask[i] = 1;
+        }
+    }
+
+    // --- PHASE 4: NARROW BAND AROUND THE BOUNDARY ---
+    float searchSq = (searchRadius / spacing) * (searchRadius / spacing);
+
+    std::vector<float> toInterior = squaredDistanceTransform(mask, dimX, dimY, dimZ);
+    std::vector<uint8_t> solvent(totalCells);
+    for (size_t i = 0; i < totalCells; i++) solvent[i] = !mask[i];
+    std::vector<float> toSolvent = squaredDistanceTransform(solvent, dimX, dimY, dimZ);
+    solvent.clear();
+    solvent.shrink_to_fit();
+
+    for (int z = 0; z < dimZ; z++) {
+        for (int y = 0; y < dimY; y++) {
+            for (int x = 0; x < dimX; x++) {
+                size_t i = (size_t)z * slice + (size_t)y * dimX + x;
+
+                Vec3 point;
+                point.x = minBound.x + (x * spacing);
+                point.y = minBound.y + (y * spacing);
+                point.z = minBound.z + (z * spacing);
+
+                if (mask[i]) {
+                    if (toSolvent[i] <= searchSq) outInside.push_back(point);
+                } else {
+                    if (toInterior[i] <= searchSq) outOutside.push_back(point);
+                }
+            }
+        }
+    }
+
+    // --- OPTIONAL: SURFACE POINTS FOR THE PYTHON HELPERS ---
+    // Interior cells touching solvent, at most one per coarse cell of ~1/density A^2 footprint.
+    // The normal points down the distance gradient toward the solvent.
+    if (outSurface) {
+        int stride = std::max(1, (int)std::lround(1.0f / std::sqrt(density) / spacing));
+        int coarseX = dimX / stride + 1;
+        int coarseY = dimY / stride + 1;
+        int coarseZ = dimZ / stride + 1;
+        std::vector<uint8_t> taken((size_t)coarseX * coarseY * coarseZ, 0);
+
+        for (int z = 1; z < dimZ - 1; z++) {
+            for (int y = 1; y < dimY - 1; y++) {
+                for (int x = 1; x < dimX - 1; x++) {
+                    size_t i = (size_t)z * slice + (size_t)y * dimX + x;
+                    if (!mask[i] || toSolvent[i] > 1.0f) continue;
+
+                    size_t coarse = ((size_t)(z / stride) * coarseY + (y / stride)) * coarseX + (x / stride);
+                    if (taken[coarse]) continue;
+
+                    Vec3 normal = {
+                        toInterior[i + 1] - toInterior[i - 1] - (toSolvent[i + 1] - toSolvent[i - 1]),
+                        toInterior[i + dimX] - toInterior[i - dimX] - (toSolvent[i + dimX] - toSolvent[i - dimX]),
+                        toInterior[i + slice] - toInterior[i - slice] - (toSolvent[i + slice] - toSolvent[i - slice])
+                    };
+                    float len = std::sqrt(normal.lengthSq());
+                    if (len <= 0.0f) continue;
+
+                    taken[coarse] = 1;
+                    Vec3 point = {minBound.x + x * spacing, minBound.y + y * spacing, minBound.z + z * spacing};
+                    outSurface->push_back({point, normal * (1.0f / len)});
+                }
+            }
+        }
+    }
+
+    DEBUG_LOG("SeparateGridPointsMorphology: " << outInside.size() << " inside, " << outOutside.size() << " outside");
+}
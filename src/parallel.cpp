@@ -0,0 +1,224 @@
+#include "parallel.h"
+
+#include <iostream>
+
+
+// index of the calling thread's deque in the pool, 0 outside the pool
+static thread_local size_t t_queueIndex = 0;
+
+// set once instance() built the pool, so setThreadCount only resizes a pool that exists
+static std::atomic<bool> s_poolStarted{false};
+
+static std::mutex s_logMutex;
+
+void setThreadCount(unsigned int n) {
+    g_thread_count = n;
+    if (s_poolStarted.load()) ThreadPool::instance().resize(getThreadCount() - 1);
+}
+
+void logLine(const std::string& line) {
+    std::lock_guard<std::mutex> lock(s_logMutex);
+    std::cout << line << std::endl;
+}
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool(getThreadCount() - 1);
+    return pool;
+}
+
+ThreadPool::ThreadPool(unsigned int workerCount) {
+    queues.push_back(std::make_unique<TaskQueue>());
+    startWorkers(workerCount);
+    s_poolStarted.store(true);
+}
+
+ThreadPool::~ThreadPool() {
+    stopWorkers();
+}
+
+void ThreadPool::startWorkers(unsigned int workerCount) {
+    // [0] stays, the workers' deques are empty while the pool is idle
+    queues.resize(1);
+    for (unsigned int i = 0; i < workerCount; i++) {
+        queues.push_back(std::make_unique<TaskQueue>());
+    }
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers.emplace_back([this, i]() { workerLoop(i + 1); });
+    }
+}
+
+void ThreadPool::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    stopping = false;
+}
+
+void ThreadPool::resize(unsigned int workerCount) {
+    if (workerCount == workers.size()) return;
+    stopWorkers();
+    startWorkers(workerCount);
+}
+
+void ThreadPool::submit(Task task) {
+    // counted before it is visible, so a thief's decrement never comes first
+    queued.fetch_add(1);
+    {
+        TaskQueue& queue = *queues[t_queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    notify();
+}
+
+void ThreadPool::notify() {
+    // taking the lock orders this against a sleeper between its check and its wait
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wake.notify_all();
+}
+
+// Own deque from the back (the task submitted last is the one whose data is warm), then the others
+// from the front, starting after our own so thieves spread over the victims
+bool ThreadPool::take(size_t own, Task& task) {
+    if (queued.load() == 0) return false;
+
+    {
+        TaskQueue& queue = *queues[own];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+
+    for (size_t k = 1; k < queues.size(); k++) {
+        TaskQueue& queue = *queues[(own + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::runOne() {
+    Task task;
+    if (!take(t_queueIndex, task)) return false;
+    task();
+    return true;
+}
+
+void ThreadPool::helpUntil(const std::function<bool()>& done) {
+    while (!done()) {
+        if (runOne()) continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&]() { return done() || queued.load() > 0; });
+    }
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    t_queueIndex = index;
+    TRACE_THREAD_NAME("worker " + std::to_string(index));
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&]() { return stopping || queued.load() > 0; });
+        if (stopping) return;
+    }
+}
+
+
+// ==================== TaskGroup ====================
+
+void TaskGroup::fail() {
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (!error) error = std::current_exception();
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    pending.fetch_add(1);
+    ThreadPool::instance().submit([this, task = std::move(task)]() {
+        try {
+            task();
+        }
+        catch (...) {
+            fail();
+        }
+        // the waiter may return and destroy the group once pending reaches zero
+        ThreadPool& pool = ThreadPool::instance();
+        pending.fetch_sub(1);
+        pool.notify();
+    });
+}
+
+void TaskGroup::runHere(const std::function<void()>& task) {
+    try {
+        task();
+    }
+    catch (...) {
+        fail();
+    }
+}
+
+void TaskGroup::wait() {
+    ThreadPool::instance().helpUntil([this]() { return pending.load() == 0; });
+    if (error) std::rethrow_exception(error);
+}
+
+
+// ==================== TaskGraph ====================
+
+TaskGraph::Stage TaskGraph::add(const std::string& name, std::function<void()> work, const std::vector<Stage>& after) {
+    Stage stage = nodes.size();
+    nodes.push_back({name, std::move(work), {}, after.size()});
+    for (Stage before : after) {
+        nodes[before].next.push_back(stage);
+    }
+    return stage;
+}
+
+void TaskGraph::start(Stage stage, TaskGroup& group, std::vector<std::atomic<size_t>>& waiting) {
+    group.run([this, stage, &group, &waiting]() {
+        if (failed.load()) return;
+        try {
+            TRACE_SPAN("stage: " + nodes[stage].name);
+            nodes[stage].work();
+        }
+        catch (...) {
+            failed.store(true);
+            throw;
+        }
+        for (Stage next : nodes[stage].next) {
+            if (waiting[next].fetch_sub(1) == 1) start(next, group, waiting);
+        }
+    });
+}
+
+void TaskGraph::run() {
+    std::vector<std::atomic<size_t>> waiting(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        waiting[i].store(nodes[i].waitingFor);
+    }
+
+    failed.store(false);
+    TaskGroup group;
+    for (Stage stage = 0; stage < nodes.size(); stage++) {
+        if (nodes[stage].waitingFor == 0) start(stage, group, waiting);
+    }
+    group.wait();
+}
@@ -1,5 +1,8 @@
 #include "pdbtovector.h"
 
+#include "compress.h"
+#include "mmcif.h"
+
 
 std::array<double, 3> get_coords(const std::string& input) {
     // Initialize with 0.0 or a sentinel value (e.g., infinity)
@@ -85,16 +88,36 @@ double get_bfactor(const std::string& input) {
 }
 
 std::tuple<std::vector<Atom>, double, double, double, double, double, double> pdbtovector(std::string filename) {
+    TRACE_SPAN("pdbtovector");
     std::vector<Atom> output;
-    std::ifstream infile(filename);
     
     double minx = INFINITY, maxx = -INFINITY;
     double miny = INFINITY, maxy = -INFINITY;
     double minz = INFINITY, maxz = -INFINITY;
 
+    // mmCIF: the _atom_site rows stand in for the ATOM/HETATM records
+    if (isCIFFile(filename)) {
+        output = readAtomSiteCIF(filename);
+        for (const Atom& atom : output) {
+            std::array<double, 3> c = atom.getCoords();
+            minx = std::min(minx, c[0]); maxx = std::max(maxx, c[0]);
+            miny = std::min(miny, c[1]); maxy = std::max(maxy, c[1]);
+            minz = std::min(minz, c[2]); maxz = std::max(maxz, c[2]);
+        }
+        return {output, minx, maxx, miny, maxy, minz, maxz};
+    }
+
+    // .pdb.gz / .pdb.zst are inflated on a thread of their own while this loop parses
+    std::string error;
+    std::unique_ptr<std::istream> infile = openInputStream(filename, &error);
+    if (!infile) {
+        std::cerr << "Error: " << error << std::endl;
+        return {output, minx, maxx, miny, maxy, minz, maxz};
+    }
+
     std::string line_string;
     
-    while (std::getline(infile, line_string)) {   
+    while (std::getline(*infile, line_string)) {   
         // Check for ATOM or HETATM records
         bool is_atom = (line_string.substr(0, 4) == "ATOM");
         bool is_hetatm = (line_string.substr(0, 6) == "HETATM");
@@ -130,6 +153,12 @@ std::tuple<std::vector<Atom>, double, double, double, double, double, double> pd
         }      
     }
 
+    // a damaged file must not pass for a smaller structure
+    if (infile->bad()) {
+        std::cerr << "Error: Could not read " << filename << " to the end (corrupt or truncated)" << std::endl;
+        output.clear();
+    }
+
     return {output, minx, maxx, miny, maxy, minz, maxz};
 }
 
@@ -137,9 +166,14 @@ std::tuple<std::vector<Atom>, double, double, double, double, double, double> pd
 //-------------------------------------------
 
 void vectortopdb(const std::vector<Atom> &atomvector, std::string output_filename) {
-    std::vector<Atom> output;
-    std::ofstream out_file;
-    out_file.open(output_filename);
+    TRACE_SPAN("vectortopdb");
+    std::string error;
+    std::unique_ptr<std::ostream> out_stream = openOutputStream(output_filename, &error);
+    if (!out_stream) {
+        std::cerr << "Error: " << error << std::endl;
+        return;
+    }
+    std::ostream& out_file = *out_stream;
     out_file << std::fixed;
     out_file << std::setprecision(3);
 
@@ -167,11 +201,13 @@ void vectortopdb(const std::vector<Atom> &atomvector, std::string output_filenam
          << std::setw(8) << std::fixed << std::right << pos[1] // Y
          << std::setw(8) << std::fixed << std::right << pos[2] // Z
          << std::setw(6) << "1.00"                      // Occ
-         << std::setw(6) << "0.00"                      // Temp
+         << std::setw(6) << std::setprecision(2) << atomvector[i].get_bfactor() << std::setprecision(3) // Temp
          << "          "                                // Spacing
          << " O" << "\n";                               // Element
     }   
-    out_file.close();
+    if (!closeOutputStream(out_file)) {
+        std::cerr << "Error: Could not write " << output_filename << std::endl;
+    }
 }
 
 
@@ -0,0 +1,192 @@
+#include "placement.h"
+
+#include "common.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+
+// cells per block edge; blocks must be at least one cell wide so a conflict check never reaches
+// past the neighboring block
+static const int BLOCK_CELLS = 4;
+
+// Dense uniform cells over the bounding box of a point set
+struct CellBox {
+    double cellSize = 1.0;
+    double minX = 0, minY = 0, minZ = 0;
+    int dimX = 1, dimY = 1, dimZ = 1;
+
+    CellBox(const std::vector<std::array<double, 3>>& points, double init_cellSize) : cellSize(init_cellSize) {
+        if (points.empty()) return;
+
+        double maxX = points[0][0], maxY = points[0][1], maxZ = points[0][2];
+        minX = maxX; minY = maxY; minZ = maxZ;
+        for (const auto& p : points) {
+            minX = std::min(minX, p[0]); maxX = std::max(maxX, p[0]);
+            minY = std::min(minY, p[1]); maxY = std::max(maxY, p[1]);
+            minZ = std::min(minZ, p[2]); maxZ = std::max(maxZ, p[2]);
+        }
+        dimX = (int)std::floor((maxX - minX) / cellSize) + 1;
+        dimY = (int)std::floor((maxY - minY) / cellSize) + 1;
+        dimZ = (int)std::floor((maxZ - minZ) / cellSize) + 1;
+    }
+
+    std::array<int, 3> cellOf(const std::array<double, 3>& p) const {
+        return {(int)std::floor((p[0] - minX) / cellSize),
+                (int)std::floor((p[1] - minY) / cellSize),
+                (int)std::floor((p[2] - minZ) / cellSize)};
+    }
+
+    bool inside(int x, int y, int z) const {
+        return x >= 0 && x < dimX && y >= 0 && y < dimY && z >= 0 && z < dimZ;
+    }
+
+    size_t index(int x, int y, int z) const {
+        return ((size_t)z * dimY + y) * dimX + x;
+    }
+};
+
+std::vector<Atom> placeWaterSites(const std::vector<Atom>& candidates, const std::vector<Atom>& protein,
+                                  const PlacementSettings& settings, std::vector<size_t>* chosenIndices) {
+    TRACE_SPAN("placeWaterSites");
+    std::vector<Atom> sites;
+    if (chosenIndices) chosenIndices->clear();
+    if (candidates.empty()) return sites;
+
+    std::vector<std::array<double, 3>> points(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        points[i] = candidates[i].getCoords();
+    }
+
+    // --- PHASE 1: PROTEIN CONTACTS PER CANDIDATE ---
+    // Protein atoms counting-sorted into contactDistance cells, so a 3x3x3 scan covers the range.
+    std::vector<std::array<double, 3>> atomPoints(protein.size());
+    for (size_t i = 0; i < protein.size(); i++) {
+        atomPoints[i] = protein[i].getCoords();
+    }
+
+    CellBox atomBox(atomPoints, settings.contactDistance);
+    std::vector<int> cellStart((size_t)atomBox.dimX * atomBox.dimY * atomBox.dimZ + 1, 0);
+    std::vector<int> cellAtoms(atomPoints.size());
+    for (const auto& p : atomPoints) {
+        std::array<int, 3> c = atomBox.cellOf(p);
+        cellStart[atomBox.index(c[0], c[1], c[2]) + 1]++;
+    }
+    for (size_t c = 0; c + 1 < cellStart.size(); c++) cellStart[c + 1] += cellStart[c];
+    {
+        std::vector<int> next(cellStart.begin(), cellStart.end() - 1);
+        for (size_t i = 0; i < atomPoints.size(); i++) {
+            std::array<int, 3> c = atomBox.cellOf(atomPoints[i]);
+            cellAtoms[next[atomBox.index(c[0], c[1], c[2])]++] = (int)i;
+        }
+    }
+
+    double contactSq = settings.contactDistance * settings.contactDistance;
+    std::vector<int> contacts(points.size(), 0);
+
+    parallelFor(points.size(), [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            if (atomPoints.empty()) break;
+            std::array<int, 3> c = atomBox.cellOf(points[i]);
+
+            int count = 0;
+            for (int z = c[2] - 1; z <= c[2] + 1; z++) {
+                for (int y = c[1] - 1; y <= c[1] + 1; y++) {
+                    for (int x = c[0] - 1; x <= c[0] + 1; x++) {
+                        if (!atomBox.inside(x, y, z)) continue;
+                        size_t cell = atomBox.index(x, y, z);
+
+                        for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                            const std::array<double, 3>& a = atomPoints[cellAtoms[k]];
+                            double dX = points[i][0] - a[0];
+                            double dY = points[i][1] - a[1];
+                            double dZ = points[i][2] - a[2];
+                            if (dX*dX + dY*dY + dZ*dZ <= contactSq) count++;
+                        }
+                    }
+                }
+            }
+            contacts[i] = count;
+        }
+    });
+
+    // --- PHASE 2: CANDIDATES BY BLOCK, BEST FIRST ---
+    CellBox siteBox(points, settings.minDistance);
+    int blocksX = (siteBox.dimX + BLOCK_CELLS - 1) / BLOCK_CELLS;
+    int blocksY = (siteBox.dimY + BLOCK_CELLS - 1) / BLOCK_CELLS;
+    int blocksZ = (siteBox.dimZ + BLOCK_CELLS - 1) / BLOCK_CELLS;
+    size_t blockCount = (size_t)blocksX * blocksY * blocksZ;
+
+    std::vector<std::vector<int>> blockCandidates(blockCount);
+    for (size_t i = 0; i < points.size(); i++) {
+        std::array<int, 3> c = siteBox.cellOf(points[i]);
+        size_t block = ((size_t)(c[2] / BLOCK_CELLS) * blocksY + (c[1] / BLOCK_CELLS)) * blocksX + (c[0] / BLOCK_CELLS);
+        blockCandidates[block].push_back((int)i);
+    }
+
+    // 8 colors by block coordinate parity
+    std::vector<std::vector<size_t>> colorBlocks(8);
+    for (size_t b = 0; b < blockCount; b++) {
+        if (blockCandidates[b].empty()) continue;
+
+        int bx = (int)(b % blocksX);
+        int by = (int)((b / blocksX) % blocksY);
+        int bz = (int)(b / ((size_t)blocksX * blocksY));
+        colorBlocks[(bx & 1) | ((by & 1) << 1) | ((bz & 1) << 2)].push_back(b);
+    }
+
+    // --- PHASE 3: GREEDY PLACEMENT, ONE COLOR AT A TIME ---
+    // A block only writes its own cells and reads one cell beyond, which belongs to another color.
+    // Contacts order the candidates of a block only; sites of earlier colors are fixed by then.
+    std::vector<std::vector<std::array<double, 3>>> placed((size_t)siteBox.dimX * siteBox.dimY * siteBox.dimZ);
+    std::vector<uint8_t> chosen(points.size(), 0);
+    double minSq = settings.minDistance * settings.minDistance;
+
+    for (const std::vector<size_t>& blocks : colorBlocks) {
+        parallelFor(blocks.size(), [&](size_t begin, size_t end, unsigned int) {
+            for (size_t k = begin; k < end; k++) {
+                std::vector<int>& order = blockCandidates[blocks[k]];
+                std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return contacts[a] > contacts[b]; });
+
+                for (int i : order) {
+                    std::array<int, 3> c = siteBox.cellOf(points[i]);
+
+                    bool conflict = false;
+                    for (int z = c[2] - 1; z <= c[2] + 1 && !conflict; z++) {
+                        for (int y = c[1] - 1; y <= c[1] + 1 && !conflict; y++) {
+                            for (int x = c[0] - 1; x <= c[0] + 1 && !conflict; x++) {
+                                if (!siteBox.inside(x, y, z)) continue;
+
+                                for (const std::array<double, 3>& s : placed[siteBox.index(x, y, z)]) {
+                                    double dX = points[i][0] - s[0];
+                                    double dY = points[i][1] - s[1];
+                                    double dZ = points[i][2] - s[2];
+                                    if (dX*dX + dY*dY + dZ*dZ < minSq) {
+                                        conflict = true;
+                                        break;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    if (conflict) continue;
+
+                    placed[siteBox.index(c[0], c[1], c[2])].push_back(points[i]);
+                    chosen[i] = 1;
+                }
+            }
+        });
+    }
+
+    for (size_t i = 0; i < points.size(); i++) {
+        if (!chosen[i]) continue;
+        sites.push_back(candidates[i]);
+        if (chosenIndices) chosenIndices->push_back(i);
+    }
+
+    DEBUG_LOG("placeWaterSites: " << sites.size() << " sites from " << candidates.size() << " candidates");
+    return sites;
+}
@@ -0,0 +1,261 @@
+#include "probes.h"
+
+#include "AtomicRadii.h"
+#include "cluster.h"
+#include "common.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+
+
+// Nearest cells first, like getOverlap_cluster. Instead of stopping at the first clash the scan stops once
+// the clearance is down to floor (no probe fits) or no farther cell can lower it (or hold the first atom
+// within the cutoff)
+static float pointClearance(const std::unordered_map<GridKey, std::vector<int>>& grid, const std::vector<Atom>& atoms,
+                            const std::vector<double>& radii, double maxRadius, std::array<double, 3> target,
+                            const CellStencil& stencil, double cutoff_dist, double floor, bool& nearProtein) {
+    double cellSize = stencil.cellSize;
+    double cutoff_dist_sq = cutoff_dist * cutoff_dist;
+    double collision_reach_sq = stencil.collisionReach * stencil.collisionReach;
+    GridKey centerKey = getGridKey_pos(target, cellSize);
+
+    double best = std::numeric_limits<double>::infinity();
+    nearProtein = false;
+
+    for (size_t k = 0; k < stencil.offsets.size(); k++) {
+        // an atom farther than best + maxRadius cannot beat best, and none past the collision reach counts
+        double stop = std::min(stencil.collisionReach, best + maxRadius);
+        if (!nearProtein) stop = std::max(stop, cutoff_dist);
+        if (stencil.minDistance[k] > stop) break;
+
+        const GridKey& offset = stencil.offsets[k];
+        GridKey neighborKey = {centerKey.x + offset.x, centerKey.y + offset.y, centerKey.z + offset.z};
+
+        double gap_sq = 0;
+        int cell[3] = {neighborKey.x, neighborKey.y, neighborKey.z};
+        for (int axis = 0; axis < 3; axis++) {
+            double lo = cell[axis] * cellSize;
+            double gap = std::max({lo - target[axis], target[axis] - (lo + cellSize), 0.0});
+            gap_sq += gap * gap;
+        }
+        if (gap_sq > stop * stop) continue;
+
+        auto it = grid.find(neighborKey);
+        if (it == grid.end()) continue;
+
+        for (int a : it->second) {
+            std::array<double, 3> c = atoms[a].getCoords();
+            double dX = target[0] - c[0];
+            double dY = target[1] - c[1];
+            double dZ = target[2] - c[2];
+            double distance = dX*dX + dY*dY + dZ*dZ;
+
+            if (distance <= cutoff_dist_sq) nearProtein = true;
+            if (distance <= collision_reach_sq) best = std::min(best, std::sqrt(distance) - radii[a]);
+        }
+        if (best <= floor) break;
+    }
+    return (float)best;
+}
+
+ClearanceField computeClearance(const std::unordered_map<GridKey, std::vector<int>>& grid, const std::vector<Atom>& atoms,
+                                const std::vector<Vec3>& points, const CellStencil& stencil, double cutoff_dist, double floor) {
+    TRACE_SPAN("computeClearance");
+    std::vector<double> radii(atoms.size());
+    double maxRadius = 0;
+    for (size_t i = 0; i < atoms.size(); i++) {
+        radii[i] = getParams(atoms[i].get_resname(), atoms[i].get_atomname()).radius_aa;
+        maxRadius = std::max(maxRadius, radii[i]);
+    }
+
+    ClearanceField field;
+    field.clearance.resize(points.size());
+    field.nearProtein.resize(points.size());
+
+    parallelFor(points.size(), [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            bool nearProtein = false;
+            field.clearance[i] = pointClearance(grid, atoms, radii, maxRadius, {points[i].x, points[i].y, points[i].z},
+                                                stencil, cutoff_dist, floor, nearProtein);
+            field.nearProtein[i] = nearProtein;
+        }
+    });
+    return field;
+}
+
+// clusterLabels for points of a lattice: the neighbor test (within a diagonal grid step) becomes a fixed set of
+// index offsets, looked up in a hash of packed lattice indices instead of scanning the points of nearby cells.
+// Gives the same clusters in the same discovery order.
+static std::vector<int> latticeLabels(const std::vector<Vec3>& points, const std::vector<size_t>& members, double lattice,
+                                      double grid_spacing, std::vector<int>& visitOrder) {
+    std::vector<int> labels(members.size(), -1);
+    visitOrder.clear();
+    visitOrder.reserve(members.size());
+    if (members.empty()) return labels;
+
+    float lo[3] = {points[members[0]].x, points[members[0]].y, points[members[0]].z};
+    for (size_t m : members) {
+        lo[0] = std::min(lo[0], points[m].x);
+        lo[1] = std::min(lo[1], points[m].y);
+        lo[2] = std::min(lo[2], points[m].z);
+    }
+
+    // 21 bits per axis
+    auto index = [&](size_t m) {
+        uint64_t ix = (uint64_t)std::lround((points[m].x - lo[0]) / lattice);
+        uint64_t iy = (uint64_t)std::lround((points[m].y - lo[1]) / lattice);
+        uint64_t iz = (uint64_t)std::lround((points[m].z - lo[2]) / lattice);
+        return (ix << 42) | (iy << 21) | iz;
+    };
+
+    std::unordered_map<uint64_t, int> cells;
+    cells.reserve(members.size());
+    std::vector<uint64_t> keys(members.size());
+    for (size_t j = 0; j < members.size(); j++) {
+        keys[j] = index(members[j]);
+        cells.emplace(keys[j], (int)j);
+    }
+
+    // same threshold as clusterLabels
+    double maxDistSq = 3.0 * grid_spacing * grid_spacing * 1.05;
+    int span = (int)std::floor(std::sqrt(maxDistSq) / lattice);
+    std::vector<std::array<int, 3>> offsets;
+    for (int dx = -span; dx <= span; dx++) {
+        for (int dy = -span; dy <= span; dy++) {
+            for (int dz = -span; dz <= span; dz++) {
+                if ((dx || dy || dz) && (dx*dx + dy*dy + dz*dz) * lattice * lattice <= maxDistSq) offsets.push_back({dx, dy, dz});
+            }
+        }
+    }
+
+    int clusterCount = 0;
+    for (size_t i = 0; i < members.size(); i++) {
+        if (labels[i] != -1) continue;
+
+        labels[i] = clusterCount;
+        size_t head = visitOrder.size();
+        visitOrder.push_back((int)i);
+
+        while (head < visitOrder.size()) {
+            uint64_t key = keys[visitOrder[head++]];
+            int64_t x = (int64_t)(key >> 42), y = (int64_t)((key >> 21) & 0x1FFFFF), z = (int64_t)(key & 0x1FFFFF);
+
+            for (const auto& o : offsets) {
+                if (x + o[0] < 0 || y + o[1] < 0 || z + o[2] < 0) continue;
+                auto it = cells.find(((uint64_t)(x + o[0]) << 42) | ((uint64_t)(y + o[1]) << 21) | (uint64_t)(z + o[2]));
+                if (it == cells.end() || labels[it->second] != -1) continue;
+                labels[it->second] = clusterCount;
+                visitOrder.push_back(it->second);
+            }
+        }
+        clusterCount++;
+    }
+    return labels;
+}
+
+ProbeSweep sweepProbes(const std::vector<Vec3>& points, const ClearanceField& field, std::vector<double> diameters,
+                       double lattice, double grid_spacing) {
+    TRACE_SPAN("sweepProbes");
+    std::sort(diameters.begin(), diameters.end());
+    diameters.erase(std::unique(diameters.begin(), diameters.end()), diameters.end());
+
+    ProbeSweep sweep;
+    sweep.diameters = diameters;
+
+    // cluster of every point at the previous (smaller) probe, -1 where it did not fit
+    std::vector<int> previousCluster(points.size(), -1);
+
+    for (double diameter : diameters) {
+        float radius = (float)(diameter / 2.0);
+
+        std::vector<size_t> members;
+        std::vector<Atom> fitted;
+        for (size_t i = 0; i < points.size(); i++) {
+            if (field.nearProtein[i] && field.clearance[i] > radius) {
+                members.push_back(i);
+                fitted.push_back(Atom("HOH", "O", {points[i].x, points[i].y, points[i].z}, 0.0));
+            }
+        }
+
+        std::vector<int> visitOrder;
+        std::vector<int> labels = latticeLabels(points, members, lattice, grid_spacing, visitOrder);
+
+        // largest first; equal sizes keep discovery order
+        std::vector<size_t> sizes;
+        for (int label : labels) {
+            if (label >= (int)sizes.size()) sizes.resize(label + 1, 0);
+            sizes[label]++;
+        }
+        std::vector<int> rank(sizes.size());
+        std::vector<int> byRank(sizes.size());
+        for (size_t l = 0; l < sizes.size(); l++) byRank[l] = (int)l;
+        std::stable_sort(byRank.begin(), byRank.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+        for (size_t r = 0; r < byRank.size(); r++) rank[byRank[r]] = (int)r;
+
+        std::vector<std::vector<Atom>> clusters(sizes.size());
+        std::vector<int> parents(sizes.size(), -1);
+        for (int idx : visitOrder) {
+            int c = rank[labels[idx]];
+            clusters[c].push_back(fitted[idx]);
+            parents[c] = previousCluster[members[idx]];
+        }
+
+        std::fill(previousCluster.begin(), previousCluster.end(), -1);
+        for (size_t j = 0; j < members.size(); j++) {
+            previousCluster[members[j]] = rank[labels[j]];
+        }
+
+        sweep.clusters.push_back(std::move(clusters));
+        sweep.parents.push_back(std::move(parents));
+    }
+    return sweep;
+}
+
+bool writeProbeSweep(const ProbeSweep& sweep, const std::string& output_file, const std::vector<std::string>& remarks,
+                     const std::string& compression) {
+    TRACE_SPAN("writeProbeSweep");
+    std::ofstream csv(output_file + "_probes.csv");
+    csv << "probe_diameter,cluster,points,x,y,z,parent_probe_diameter,parent_cluster\n" << std::fixed;
+
+    for (size_t k = 0; k < sweep.diameters.size(); k++) {
+        std::ostringstream name;
+        name << std::fixed << std::setprecision(2) << sweep.diameters[k];
+
+        std::vector<std::string> probeRemarks = remarks;
+        probeRemarks.push_back("probe diameter = " + name.str());
+        writeClusteredPDB(sweep.clusters[k], output_file + "_probe_" + name.str(), probeRemarks, compression);
+
+        for (size_t c = 0; c < sweep.clusters[k].size(); c++) {
+            const std::vector<Atom>& cluster = sweep.clusters[k][c];
+            double center[3] = {0, 0, 0};
+            for (const Atom& atom : cluster) {
+                std::array<double, 3> p = atom.getCoords();
+                for (int axis = 0; axis < 3; axis++) center[axis] += p[axis] / cluster.size();
+            }
+
+            // clusters are numbered from 1, like the residue numbers of the PDB files
+            csv << std::setprecision(2) << sweep.diameters[k] << "," << c + 1 << "," << cluster.size() << ","
+                << std::setprecision(3) << center[0] << "," << center[1] << "," << center[2] << ",";
+            if (k > 0) {
+                csv << std::setprecision(2) << sweep.diameters[k - 1] << "," << sweep.parents[k][c] + 1;
+            } else {
+                csv << ",";
+            }
+            csv << "\n";
+        }
+    }
+
+    if (!csv) {
+        std::cerr << "Error: Could not write " << output_file << "_probes.csv" << std::endl;
+        return false;
+    }
+    return true;
+}
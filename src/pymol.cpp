@@ -1,13 +1,13 @@
 #include "pymol.h"
 
-void createPyMOLSession(const std::string& pdb_file, const std::string& session_name, const std::string& structure_file) {
+void createPyMOLSession(const std::string& pdb_file, const std::string& session_name, const std::string& structure_file, const std::string& extension) {
 
     if (std::filesystem::exists("temp/render.pml")) {
         std::filesystem::remove("temp/render.pml");
     }
     
 
-    std::string input_file = pdb_file + ".pdb"; 
+    std::string input_file = pdb_file + extension;
     std::string input_file_stem = std::filesystem::path(pdb_file).stem().string();
     std::string script_name = "temp/render.pml";
 
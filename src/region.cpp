@@ -0,0 +1,339 @@
+#include "region.h"
+
+#include "common.h"
+#include "compress.h"
+#include "mmcif.h"
+#include "parallel.h"
+#include "pdbtovector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+
+bool Region::contains(const std::array<double, 3>& p) const {
+    switch (kind) {
+        case BOX:
+            return p[0] >= lo.x && p[0] <= hi.x && p[1] >= lo.y && p[1] <= hi.y && p[2] >= lo.z && p[2] <= hi.z;
+        case SPHERE: {
+            double dX = p[0] - center[0], dY = p[1] - center[1], dZ = p[2] - center[2];
+            return dX*dX + dY*dY + dZ*dZ <= radius * radius;
+        }
+        case SELECTION: {
+            if (p[0] < lo.x || p[0] > hi.x || p[1] < lo.y || p[1] > hi.y || p[2] < lo.z || p[2] > hi.z) return false;
+
+            // cells start at lo, one radius below the lowest atom, so every atom in reach is in the 3x3x3 block
+            int c[3];
+            for (int axis = 0; axis < 3; axis++) {
+                double origin = axis == 0 ? lo.x : (axis == 1 ? lo.y : lo.z);
+                c[axis] = (int)std::floor((p[axis] - origin) / cellSize);
+            }
+            for (int z = std::max(c[2] - 1, 0); z <= std::min(c[2] + 1, cellDims[2] - 1); z++) {
+                for (int y = std::max(c[1] - 1, 0); y <= std::min(c[1] + 1, cellDims[1] - 1); y++) {
+                    for (int x = std::max(c[0] - 1, 0); x <= std::min(c[0] + 1, cellDims[0] - 1); x++) {
+                        size_t cell = ((size_t)z * cellDims[1] + y) * cellDims[0] + x;
+                        for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                            const std::array<double, 3>& a = selected[cellAtoms[k]];
+                            double dX = p[0] - a[0], dY = p[1] - a[1], dZ = p[2] - a[2];
+                            if (dX*dX + dY*dY + dZ*dZ <= radius * radius) return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+        default:
+            return true;
+    }
+}
+
+static bool parseNumbers(const std::string& text, size_t count, std::vector<double>& out) {
+    out.clear();
+    std::stringstream ss(text);
+    std::string field;
+    while (std::getline(ss, field, ',')) {
+        try {
+            size_t used = 0;
+            out.push_back(std::stod(field, &used));
+            if (used != field.size()) return false;
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+    }
+    return out.size() == count;
+}
+
+// One selection term: [chain:](resname | first[-last])
+struct SelectionTerm {
+    std::string chain;         // empty = any chain
+    std::string resname;       // empty = by number
+    int first = 0, last = 0;
+
+    bool matches(const std::string& atomChain, const std::string& atomRes, int atomSeq) const {
+        if (!chain.empty() && atomChain != chain) return false;
+        if (!resname.empty()) return atomRes == resname;
+        return atomSeq >= first && atomSeq <= last;
+    }
+};
+
+static bool parseTerm(std::string text, SelectionTerm& term) {
+    // mmCIF chain ids may be longer than the one character of PDB files
+    size_t colon = text.find(':');
+    if (colon != std::string::npos && colon > 0) {
+        term.chain = text.substr(0, colon);
+        text = text.substr(colon + 1);
+    }
+    if (text.empty()) return false;
+
+    // a number or range only when it parses completely, so names that start with a digit (1PE) stay names
+    bool number = true;
+    try {
+        // a leading '-' belongs to the first number, the next one separates the range
+        size_t dash = text.find('-', 1);
+        std::string head = text.substr(0, dash);
+        size_t used = 0;
+        term.first = std::stoi(head, &used);
+        number = used == head.size();
+        term.last = term.first;
+        if (number && dash != std::string::npos) {
+            std::string tail = text.substr(dash + 1);
+            term.last = std::stoi(tail, &used);
+            number = used == tail.size();
+        }
+    }
+    catch (const std::exception&) {
+        number = false;
+    }
+
+    if (!number) {
+        term.first = term.last = 0;
+        term.resname = text;
+        return true;
+    }
+    return term.first <= term.last;
+}
+
+// Makes region a selection of its selected atoms and sets its bounds
+static void boundSelection(Region& region, double selectionRadius) {
+    region.kind = Region::SELECTION;
+    region.radius = selectionRadius;
+    std::array<double, 3> lo = region.selected[0], hi = region.selected[0];
+    for (const std::array<double, 3>& a : region.selected) {
+        for (int axis = 0; axis < 3; axis++) {
+            lo[axis] = std::min(lo[axis], a[axis]);
+            hi[axis] = std::max(hi[axis], a[axis]);
+        }
+    }
+    region.lo = {(float)(lo[0] - selectionRadius), (float)(lo[1] - selectionRadius), (float)(lo[2] - selectionRadius)};
+    region.hi = {(float)(hi[0] + selectionRadius), (float)(hi[1] + selectionRadius), (float)(hi[2] + selectionRadius)};
+
+    // cells of at least the radius (and 1 A, so a tiny radius does not make a huge cell box) from lo
+    region.cellSize = std::max(selectionRadius, 1.0);
+    double origin[3] = {region.lo.x, region.lo.y, region.lo.z};
+    auto cellOf = [&](const std::array<double, 3>& a, int axis) {
+        return std::min((int)std::floor((a[axis] - origin[axis]) / region.cellSize), region.cellDims[axis] - 1);
+    };
+    for (int axis = 0; axis < 3; axis++) {
+        region.cellDims[axis] = (int)std::floor((hi[axis] + selectionRadius - origin[axis]) / region.cellSize) + 1;
+    }
+
+    size_t cellCount = (size_t)region.cellDims[0] * region.cellDims[1] * region.cellDims[2];
+    region.cellStart.assign(cellCount + 1, 0);
+    region.cellAtoms.resize(region.selected.size());
+    std::vector<size_t> cellOfAtom(region.selected.size());
+    for (size_t i = 0; i < region.selected.size(); i++) {
+        const std::array<double, 3>& a = region.selected[i];
+        cellOfAtom[i] = ((size_t)cellOf(a, 2) * region.cellDims[1] + cellOf(a, 1)) * region.cellDims[0] + cellOf(a, 0);
+        region.cellStart[cellOfAtom[i] + 1]++;
+    }
+    for (size_t c = 0; c < cellCount; c++) region.cellStart[c + 1] += region.cellStart[c];
+    std::vector<int> next(region.cellStart.begin(), region.cellStart.end() - 1);
+    for (size_t i = 0; i < region.selected.size(); i++) {
+        region.cellAtoms[next[cellOfAtom[i]]++] = (int)i;
+    }
+}
+
+bool parseRegion(const std::string& spec, const std::string& pdbFile, double selectionRadius, Region& region, std::string& error) {
+    size_t colon = spec.find(':');
+    std::string kind = spec.substr(0, colon);
+    std::string body = colon == std::string::npos ? "" : spec.substr(colon + 1);
+    std::vector<double> values;
+
+    if (kind == "box") {
+        if (!parseNumbers(body, 6, values)) {
+            error = "expected box:x0,y0,z0,x1,y1,z1";
+            return false;
+        }
+        region.kind = Region::BOX;
+        region.lo = {(float)std::min(values[0], values[3]), (float)std::min(values[1], values[4]), (float)std::min(values[2], values[5])};
+        region.hi = {(float)std::max(values[0], values[3]), (float)std::max(values[1], values[4]), (float)std::max(values[2], values[5])};
+        return true;
+    }
+
+    if (kind == "sphere") {
+        if (!parseNumbers(body, 4, values) || values[3] <= 0) {
+            error = "expected sphere:x,y,z,r with r > 0";
+            return false;
+        }
+        region.kind = Region::SPHERE;
+        region.center = {values[0], values[1], values[2]};
+        region.radius = values[3];
+        region.lo = {(float)(values[0] - values[3]), (float)(values[1] - values[3]), (float)(values[2] - values[3])};
+        region.hi = {(float)(values[0] + values[3]), (float)(values[1] + values[3]), (float)(values[2] + values[3])};
+        return true;
+    }
+
+    if (kind == "sel") {
+        std::vector<SelectionTerm> terms;
+        std::stringstream ss(body);
+        std::string field;
+        while (std::getline(ss, field, ',')) {
+            SelectionTerm term;
+            if (!parseTerm(field, term)) {
+                error = "bad selection term '" + field + "' (expected RES, N, N-M, or C:RES, C:N-M)";
+                return false;
+            }
+            terms.push_back(term);
+        }
+        if (terms.empty()) {
+            error = "empty selection";
+            return false;
+        }
+
+        auto select = [&](const std::string& chain, const std::string& resname, int resSeq, const std::array<double, 3>& coords) {
+            for (const SelectionTerm& term : terms) {
+                if (term.matches(chain, resname, resSeq)) {
+                    region.selected.push_back(coords);
+                    return;
+                }
+            }
+        };
+
+        if (isCIFFile(pdbFile)) {
+            std::vector<AtomSiteIdentity> identities;
+            std::vector<Atom> atoms = readAtomSiteCIF(pdbFile, &identities);
+            for (size_t i = 0; i < atoms.size(); i++) {
+                select(identities[i].chain, atoms[i].get_resname(), identities[i].seq, atoms[i].getCoords());
+            }
+        } else {
+            std::unique_ptr<std::istream> file = openInputStream(pdbFile, &error);
+            if (!file) return false;
+            std::string line;
+            while (std::getline(*file, line)) {
+                if (line.rfind("ATOM", 0) != 0 && line.rfind("HETATM", 0) != 0) continue;
+                if (line.size() < 54) continue;
+
+                // PDB columns: resName 18-20, chainID 22, resSeq 23-26
+                int resSeq = 0;
+                try {
+                    resSeq = std::stoi(line.substr(22, 4));
+                }
+                catch (const std::exception&) {
+                    continue;
+                }
+                select(std::string(1, line[21]), std::get<0>(get_data(line)), resSeq, get_coords(line));
+            }
+            if (file->bad()) {
+                error = pdbFile + " is corrupt or truncated";
+                return false;
+            }
+        }
+        if (region.selected.empty()) {
+            error = "selection matches no atoms in " + pdbFile;
+            return false;
+        }
+
+        boundSelection(region, selectionRadius);
+        return true;
+    }
+
+    error = "unknown region '" + kind + "' (expected box:, sphere: or sel:)";
+    return false;
+}
+
+bool changedAtomsRegion(const std::string& parentFile, const std::string& variantFile, double selectionRadius, Region& region, std::string& error) {
+    // an atom is the same in both when its residue name, atom name and coordinates (at the 3 decimals of a
+    // PDB file) are; the files are multisets of these, so duplicates are matched one to one
+    auto identity = [](const Atom& atom) {
+        std::array<double, 3> c = atom.getCoords();
+        std::ostringstream key;
+        key << atom.get_resname() << " " << atom.get_atomname() << std::fixed << std::setprecision(3)
+            << " " << c[0] << " " << c[1] << " " << c[2];
+        return key.str();
+    };
+
+    std::vector<Atom> parent = std::get<0>(pdbtovector(parentFile));
+    std::vector<Atom> variant = std::get<0>(pdbtovector(variantFile));
+    if (parent.empty()) {
+        error = "no atoms in " + parentFile;
+        return false;
+    }
+    if (variant.empty()) {
+        error = "no atoms in " + variantFile;
+        return false;
+    }
+
+    std::unordered_map<std::string, int> unmatched;
+    for (const Atom& atom : parent) {
+        unmatched[identity(atom)]++;
+    }
+    for (const Atom& atom : variant) {
+        auto it = unmatched.find(identity(atom));
+        if (it != unmatched.end() && it->second > 0) {
+            it->second--;
+        } else {
+            region.selected.push_back(atom.getCoords());
+        }
+    }
+    // atoms of the parent the variant no longer has leave a change behind as well
+    for (const Atom& atom : parent) {
+        auto it = unmatched.find(identity(atom));
+        if (it->second > 0) {
+            it->second--;
+            region.selected.push_back(atom.getCoords());
+        }
+    }
+
+    if (region.selected.empty()) {
+        error = variantFile + " has the same atoms as " + parentFile;
+        return false;
+    }
+    boundSelection(region, selectionRadius);
+    return true;
+}
+
+bool clampToRegion(const Region& region, double margin, Vec3& minBound, Vec3& maxBound, double step) {
+    if (!region.active()) return true;
+
+    minBound.x = std::max(minBound.x, (float)(std::floor((region.lo.x - margin) / step) * step));
+    minBound.y = std::max(minBound.y, (float)(std::floor((region.lo.y - margin) / step) * step));
+    minBound.z = std::max(minBound.z, (float)(std::floor((region.lo.z - margin) / step) * step));
+    maxBound.x = std::min(maxBound.x, (float)(std::ceil((region.hi.x + margin) / step) * step));
+    maxBound.y = std::min(maxBound.y, (float)(std::ceil((region.hi.y + margin) / step) * step));
+    maxBound.z = std::min(maxBound.z, (float)(std::ceil((region.hi.z + margin) / step) * step));
+
+    return minBound.x < maxBound.x && minBound.y < maxBound.y && minBound.z < maxBound.z;
+}
+
+void keepInRegion(const Region& region, std::vector<Vec3>& points) {
+    if (!region.active()) return;
+    TRACE_SPAN("keepInRegion");
+
+    std::vector<uint8_t> keep(points.size());
+    parallelFor(points.size(), [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            keep[i] = region.contains({points[i].x, points[i].y, points[i].z});
+        }
+    });
+
+    size_t kept = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (keep[i]) points[kept++] = points[i];
+    }
+    points.resize(kept);
+}
@@ -0,0 +1,369 @@
+#include "server.h"
+
+#include "AtomicRadii.h"
+#include "cluster.h"
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <numeric>
+#include <sstream>
+
+#ifndef _WIN32
+    #include <cerrno>
+    #include <cstring>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+
+    // a client that disconnects mid-reply must not raise SIGPIPE in the server (macOS sets SO_NOSIGPIPE instead)
+    #ifndef MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+    #endif
+
+    // longest request line a socket client may send; a client that never sends a newline is cut off here
+    static const size_t MAX_LINE = 65536;
+#endif
+
+
+enum CellFlag : uint8_t {
+    CELL_FILLED = 1,
+    CELL_WATER = 2
+};
+
+// handleLine control codes
+enum SessionControl {
+    SESSION_CONTINUE = 0,
+    SESSION_QUIT = 1,
+    SESSION_SHUTDOWN = 2
+};
+
+QueryServer::QueryServer(std::vector<Atom>& init_atoms, double init_hashSpacing,
+                         Vec3 init_minBound, Vec3 maxBound, float init_spacing, size_t maxMemoryBytes) :
+    atoms(init_atoms),
+    hashSpacing(init_hashSpacing),
+    minBound(init_minBound),
+    spacing(init_spacing)
+{
+    // same lattice as FillInternalVoid
+    dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing)) + 1;
+    dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing)) + 1;
+    dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing)) + 1;
+    size_t latticeCells = (size_t)dimX * dimY * dimZ;
+    sparseCells = maxMemoryBytes > 0 && latticeCells > maxMemoryBytes;
+    if (!sparseCells) cells.assign(latticeCells, 0);
+
+    // radius lookups are string maps, so resolve them once
+    atomRadii.resize(atoms.size());
+    std::vector<GridKey> keys(atoms.size());
+    for (size_t i = 0; i < atoms.size(); i++) {
+        atomRadii[i] = getParams(atoms[i].get_resname(), atoms[i].get_atomname()).radius_aa;
+        maxAtomRadius = std::max(maxAtomRadius, atomRadii[i]);
+
+        keys[i] = getGridKey(atoms[i], hashSpacing);
+        if (i == 0) {
+            keyMin = keys[i];
+            keyMax = keys[i];
+        }
+        keyMin = {std::min(keyMin.x, keys[i].x), std::min(keyMin.y, keys[i].y), std::min(keyMin.z, keys[i].z)};
+        keyMax = {std::max(keyMax.x, keys[i].x), std::max(keyMax.y, keys[i].y), std::max(keyMax.z, keys[i].z)};
+    }
+
+    // counting sort of the atoms into the dense cell box
+    size_t spanX = (size_t)(keyMax.x - keyMin.x + 1);
+    size_t spanY = (size_t)(keyMax.y - keyMin.y + 1);
+    size_t cellCount = atoms.empty() ? 0 : spanX * spanY * (keyMax.z - keyMin.z + 1);
+    cellStart.assign(cellCount + 1, 0);
+    cellAtoms.resize(atoms.size());
+
+    auto cellIndex = [&](const GridKey& k) {
+        return ((size_t)(k.z - keyMin.z) * spanY + (k.y - keyMin.y)) * spanX + (k.x - keyMin.x);
+    };
+    for (const GridKey& k : keys) cellStart[cellIndex(k) + 1]++;
+    for (size_t c = 0; c < cellCount; c++) cellStart[c + 1] += cellStart[c];
+
+    std::vector<int> next(cellStart.begin(), cellStart.end() - 1);
+    for (size_t i = 0; i < atoms.size(); i++) {
+        cellAtoms[next[cellIndex(keys[i])]++] = (int)i;
+    }
+}
+
+void QueryServer::addFilled(const std::vector<Vec3>& points) {
+    for (const Vec3& p : points) {
+        int64_t idx = vectoIndex(p, dimX, dimY, dimZ, minBound, spacing);
+        if (idx == -1) continue;
+        if (sparseCells) filledCells.push_back(idx);
+        else cells[idx] |= CELL_FILLED;
+    }
+}
+
+void QueryServer::setWaters(const std::vector<Atom>& waters, double clusterSpacing) {
+    if (sparseCells) {
+        std::sort(filledCells.begin(), filledCells.end());
+        filledCells.erase(std::unique(filledCells.begin(), filledCells.end()), filledCells.end());
+        filledCells.shrink_to_fit();
+    }
+
+    std::vector<int> labels = clusterLabels(waters, clusterSpacing, hashSpacing);
+
+    // rank clusters by size (largest first), ties in discovery order
+    std::vector<size_t> sizes;
+    for (int label : labels) {
+        if ((size_t)label >= sizes.size()) sizes.resize(label + 1, 0);
+        sizes[label]++;
+    }
+    std::vector<int> byRank(sizes.size());
+    std::iota(byRank.begin(), byRank.end(), 0);
+    std::stable_sort(byRank.begin(), byRank.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+
+    std::vector<int> rankOf(sizes.size());
+    for (size_t r = 0; r < byRank.size(); r++) rankOf[byRank[r]] = (int)r;
+    clusterCount = sizes.size();
+
+    waterCluster.clear();
+    waterCluster.reserve(waters.size());
+    for (size_t i = 0; i < waters.size(); i++) {
+        std::array<double, 3> c = waters[i].getCoords();
+        int64_t idx = vectoIndex({(float)c[0], (float)c[1], (float)c[2]}, dimX, dimY, dimZ, minBound, spacing);
+        if (idx == -1) continue;
+
+        if (!sparseCells) cells[idx] |= CELL_WATER;
+        waterCluster[idx] = rankOf[labels[i]];
+    }
+}
+
+double QueryServer::clearance(const Vec3& p) const {
+    double best = std::numeric_limits<double>::infinity();
+    if (atoms.empty()) return best;
+
+    GridKey center = getGridKey_pos({p.x, p.y, p.z}, hashSpacing);
+    int spanX = keyMax.x - keyMin.x + 1;
+    int spanY = keyMax.y - keyMin.y + 1;
+
+    auto visit = [&](int x, int y, int z) {
+        size_t cell = ((size_t)(z - keyMin.z) * spanY + (y - keyMin.y)) * spanX + (x - keyMin.x);
+
+        for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+            int a = cellAtoms[k];
+            std::array<double, 3> c = atoms[a].getCoords();
+            double dX = p.x - c[0];
+            double dY = p.y - c[1];
+            double dZ = p.z - c[2];
+            best = std::min(best, std::sqrt(dX*dX + dY*dY + dZ*dZ) - atomRadii[a]);
+        }
+    };
+
+    // Expanding rings of cells, starting at the first ring that reaches the atom box.
+    // Atoms in ring r are at least (r - 1) cells away, so the search stops once that bound
+    // (minus the largest radius) cannot beat the best.
+    auto gap = [](int c, int lo, int hi) { return c < lo ? lo - c : (c > hi ? c - hi : 0); };
+    int firstRing = std::max({gap(center.x, keyMin.x, keyMax.x), gap(center.y, keyMin.y, keyMax.y),
+                              gap(center.z, keyMin.z, keyMax.z)});
+    int lastRing = std::max({center.x - keyMin.x, keyMax.x - center.x,
+                             center.y - keyMin.y, keyMax.y - center.y,
+                             center.z - keyMin.z, keyMax.z - center.z});
+
+    for (int ring = firstRing; ring <= lastRing; ring++) {
+        if (ring >= 1 && (ring - 1) * hashSpacing - maxAtomRadius >= best) break;
+
+        // only the shell of the ring, clipped to the atom box: full z columns on its x/y border,
+        // the two z caps inside
+        int x0 = std::max(-ring, keyMin.x - center.x), x1 = std::min(ring, keyMax.x - center.x);
+        int y0 = std::max(-ring, keyMin.y - center.y), y1 = std::min(ring, keyMax.y - center.y);
+        int z0 = std::max(-ring, keyMin.z - center.z), z1 = std::min(ring, keyMax.z - center.z);
+
+        for (int dx = x0; dx <= x1; dx++) {
+            for (int dy = y0; dy <= y1; dy++) {
+                if (std::abs(dx) == ring || std::abs(dy) == ring) {
+                    for (int dz = z0; dz <= z1; dz++) {
+                        visit(center.x + dx, center.y + dy, center.z + dz);
+                    }
+                } else {
+                    if (-ring >= z0) visit(center.x + dx, center.y + dy, center.z - ring);
+                    if (ring > 0 && ring <= z1) visit(center.x + dx, center.y + dy, center.z + ring);
+                }
+            }
+        }
+    }
+    return best;
+}
+
+PointQuery QueryServer::query(const Vec3& p) const {
+    PointQuery result;
+    result.clearance = clearance(p);
+
+    int64_t idx = vectoIndex(p, dimX, dimY, dimZ, minBound, spacing);
+    if (idx == -1) return result;
+
+    if (sparseCells) {
+        result.inside = std::binary_search(filledCells.begin(), filledCells.end(), idx);
+        auto it = waterCluster.find(idx);
+        result.water = it != waterCluster.end();
+        if (result.water) result.cluster = it->second;
+        return result;
+    }
+
+    result.inside = (cells[idx] & CELL_FILLED) != 0;
+    result.water = (cells[idx] & CELL_WATER) != 0;
+    if (result.water) {
+        auto it = waterCluster.find(idx);
+        if (it != waterCluster.end()) result.cluster = it->second;
+    }
+    return result;
+}
+
+std::string QueryServer::handleLine(const std::string& line, int& control) const {
+    control = SESSION_CONTINUE;
+
+    std::stringstream ss(line);
+    std::string first;
+    if (!(ss >> first)) return "";
+
+    if (first == "quit") {
+        control = SESSION_QUIT;
+        return "bye\n";
+    }
+    if (first == "shutdown") {
+        control = SESSION_SHUTDOWN;
+        return "bye\n";
+    }
+    if (first == "info") {
+        std::ostringstream out;
+        out << "lattice " << dimX << " " << dimY << " " << dimZ << " spacing " << spacing
+            << " atoms " << atoms.size() << " waters " << waterCluster.size()
+            << " clusters " << clusterCount << "\n";
+        return out.str();
+    }
+
+    // a batch of points: x y z [x y z ...]
+    std::vector<double> values;
+    std::stringstream numbers(line);
+    double v;
+    while (numbers >> v) values.push_back(v);
+
+    if (!numbers.eof() || values.empty() || values.size() % 3 != 0) {
+        return "error expected x y z triples, info, quit or shutdown\n";
+    }
+
+    std::string out;
+    char buffer[96];
+    for (size_t i = 0; i < values.size(); i += 3) {
+        PointQuery q = query({(float)values[i], (float)values[i + 1], (float)values[i + 2]});
+        snprintf(buffer, sizeof(buffer), "%d %d %d %.3f\n", q.inside ? 1 : 0, q.water ? 1 : 0, q.cluster, q.clearance);
+        out += buffer;
+    }
+    return out;
+}
+
+int QueryServer::serveStream(std::istream& in, std::ostream& out) const {
+    std::string line;
+    while (std::getline(in, line)) {
+        int control;
+        out << handleLine(line, control) << std::flush;
+        if (control != SESSION_CONTINUE) break;
+    }
+    return 0;
+}
+
+int QueryServer::serveUnixSocket(const std::string& path) const {
+#ifdef _WIN32
+    std::cerr << "Error: Unix socket serving is not available on Windows, use --serve -" << std::endl;
+    return 1;
+#else
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        std::cerr << "Error: Could not create socket" << std::endl;
+        return 1;
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path too long: " << path << std::endl;
+        close(server);
+        return 1;
+    }
+    std::copy(path.begin(), path.end(), address.sun_path);
+
+    // only a stale socket from an earlier server is replaced, never another file
+    struct stat existing;
+    if (lstat(path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            std::cerr << "Error: " << path << " exists and is not a socket" << std::endl;
+            close(server);
+            return 1;
+        }
+        unlink(path.c_str());
+    }
+
+    if (bind(server, (sockaddr*)&address, sizeof(address)) != 0 || listen(server, 4) != 0) {
+        std::cerr << "Error: Could not listen on " << path << std::endl;
+        close(server);
+        return 1;
+    }
+
+    std::cout << "-> Listening on " << path << std::endl;
+
+    bool running = true;
+    int status = 0;
+    while (running) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: Could not accept on " << path << ": " << std::strerror(errno) << std::endl;
+            status = 1;
+            break;
+        }
+#ifdef SO_NOSIGPIPE
+        int noSigpipe = 1;
+        setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSigpipe, sizeof(noSigpipe));
+#endif
+
+        std::string pending;
+        char buffer[MAX_LINE];
+        bool open = true;
+
+        while (open) {
+            ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) break;
+            pending.append(buffer, received);
+
+            // answer every complete line, batched into one send
+            std::string reply;
+            size_t newline;
+            while ((newline = pending.find('\n')) != std::string::npos) {
+                int control;
+                reply += handleLine(pending.substr(0, newline), control);
+                pending.erase(0, newline + 1);
+
+                if (control == SESSION_SHUTDOWN) running = false;
+                if (control != SESSION_CONTINUE) {
+                    open = false;
+                    break;
+                }
+            }
+            if (open && pending.size() > MAX_LINE) {
+                reply += "error line longer than " + std::to_string(MAX_LINE) + " bytes\n";
+                open = false;
+            }
+
+            size_t sent = 0;
+            while (sent < reply.size()) {
+                ssize_t n = send(client, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) { open = false; break; }
+                sent += (size_t)n;
+            }
+        }
+        close(client);
+    }
+
+    close(server);
+    unlink(path.c_str());
+    return status;
+#endif
+}
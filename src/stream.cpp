@@ -0,0 +1,208 @@
+#include "stream.h"
+
+#include "common.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <thread>
+
+
+using PointChunk = std::vector<Vec3>;
+using WaterChunk = std::vector<StreamWater>;
+
+static bool nearSurface(
+    const std::unordered_map<GridKey, std::vector<int>>& vertexGrid,
+    const std::vector<Vertex>& surfaceVertices,
+    const std::array<double, 3>& pos,
+    double radius
+) {
+    double radiusSq = radius * radius;
+    GridKey k = getGridKey_pos(pos, radius);
+
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dz = -1; dz <= 1; dz++) {
+                auto it = vertexGrid.find({k.x + dx, k.y + dy, k.z + dz});
+                if (it == vertexGrid.end()) continue;
+
+                for (int v : it->second) {
+                    const Vec3& p = surfaceVertices[v].position;
+                    double dX = pos[0] - p.x;
+                    double dY = pos[1] - p.y;
+                    double dZ = pos[2] - p.z;
+                    if (dX*dX + dY*dY + dZ*dZ <= radiusSq) return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+std::vector<std::vector<Atom>> streamWaters(
+    const PointSource& source,
+    std::vector<Atom>& atoms,
+    const std::unordered_map<GridKey, std::vector<int>>& atomGrid,
+    const std::vector<Vertex>& surfaceVertices,
+    const StreamSettings& settings,
+    StreamStats& stats
+) {
+    BoundedQueue<PointChunk> pointQueue(settings.queueDepth);
+    BoundedQueue<WaterChunk> filteredQueue(settings.queueDepth);
+    BoundedQueue<WaterChunk> categorizedQueue(settings.queueDepth);
+
+    // --- STAGE 1: GRID POINTS, CUT INTO CHUNKS ---
+    std::thread producer([&]() {
+        TRACE_THREAD_NAME("stream producer");
+        PointChunk pending;
+        pending.reserve(settings.chunkSize);
+
+        source([&](std::vector<Vec3>& points) {
+            for (const Vec3& p : points) {
+                pending.push_back(p);
+                if (pending.size() == settings.chunkSize) {
+                    pointQueue.push(std::move(pending));
+                    pending = PointChunk();
+                    pending.reserve(settings.chunkSize);
+                }
+            }
+        });
+
+        if (!pending.empty()) pointQueue.push(std::move(pending));
+        pointQueue.close();
+    });
+
+    // --- STAGE 2: OVERLAP FILTER (each chunk split across the worker threads) ---
+    // stage counters are only read after the threads are joined
+    std::thread filter([&]() {
+        TRACE_THREAD_NAME("stream filter");
+        size_t dowsed = 0, chunks = 0;
+        PointChunk chunk;
+        while (pointQueue.pop(chunk)) {
+            TRACE_SPAN("overlap chunk");
+            std::vector<WaterChunk> parts(parallelChunkCount(chunk.size()));
+
+            parallelFor(chunk.size(), [&](size_t begin, size_t end, unsigned int part) {
+                for (size_t i = begin; i < end; i++) {
+                    std::array<double, 3> pos = {chunk[i].x, chunk[i].y, chunk[i].z};
+                    if (getOverlap_cluster(atomGrid, atoms, pos, settings.overlapStencil, settings.waterDiameter, settings.cutoffDistance)) {
+                        parts[part].push_back({pos, 0.0});
+                    }
+                }
+            });
+
+            WaterChunk waters;
+            for (auto& part : parts) {
+                waters.insert(waters.end(), part.begin(), part.end());
+            }
+
+            dowsed += chunk.size();
+            chunks++;
+            filteredQueue.push(std::move(waters));
+        }
+        stats.dowsed = dowsed;
+        stats.chunks = chunks;
+        filteredQueue.close();
+    });
+
+    // --- STAGE 3: SURFACE / INTERNAL CATEGORIZATION ---
+    std::thread categorize([&]() {
+        TRACE_THREAD_NAME("stream categorize");
+        std::unordered_map<GridKey, std::vector<int>> vertexGrid;
+        for (size_t v = 0; v < surfaceVertices.size(); v++) {
+            const Vec3& p = surfaceVertices[v].position;
+            vertexGrid[getGridKey_pos({p.x, p.y, p.z}, settings.surfaceRadius)].push_back((int)v);
+        }
+
+        size_t surface = 0;
+        WaterChunk chunk;
+        while (filteredQueue.pop(chunk)) {
+            for (StreamWater& water : chunk) {
+                if (nearSurface(vertexGrid, surfaceVertices, water.position, settings.surfaceRadius)) {
+                    water.bfactor = 1.0;
+                    surface++;
+                }
+            }
+            categorizedQueue.push(std::move(chunk));
+        }
+        stats.surface = surface;
+        categorizedQueue.close();
+    });
+
+    // --- STAGE 4: INCREMENTAL CLUSTER LABELING (calling thread) ---
+    // Same adjacency as clusterAtoms; every new water is joined to the already seen neighbors.
+    double maxDistSq = 3.0 * settings.clusterSpacing * settings.clusterSpacing * 1.05;
+
+    std::vector<StreamWater> waters;
+    std::vector<int> parent;
+    std::unordered_map<GridKey, std::vector<int>> waterGrid;
+
+    auto find_root = [&](int c) {
+        while (parent[c] != c) {
+            parent[c] = parent[parent[c]];
+            c = parent[c];
+        }
+        return c;
+    };
+
+    WaterChunk chunk;
+    while (categorizedQueue.pop(chunk)) {
+        for (const StreamWater& water : chunk) {
+            int idx = (int)waters.size();
+            waters.push_back(water);
+            parent.push_back(idx);
+
+            GridKey k = getGridKey_pos(water.position, settings.hashSpacing);
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        auto it = waterGrid.find({k.x + dx, k.y + dy, k.z + dz});
+                        if (it == waterGrid.end()) continue;
+
+                        for (int other : it->second) {
+                            double dX = water.position[0] - waters[other].position[0];
+                            double dY = water.position[1] - waters[other].position[1];
+                            double dZ = water.position[2] - waters[other].position[2];
+                            if (dX*dX + dY*dY + dZ*dZ > maxDistSq) continue;
+
+                            int a = find_root(idx);
+                            int b = find_root(other);
+                            if (a != b) parent[std::max(a, b)] = std::min(a, b);
+                        }
+                    }
+                }
+            }
+            waterGrid[k].push_back(idx);
+        }
+
+        std::cout << "\r** Labeled " << waters.size() << " waters **\033[K" << std::flush;
+    }
+
+    producer.join();
+    filter.join();
+    categorize.join();
+
+    stats.waters = waters.size();
+    waterGrid.clear();
+
+    // --- GATHER CLUSTERS (first appearance order, then by size like clusterAtoms) ---
+    std::vector<int> clusterOf(waters.size(), -1);
+    std::vector<std::vector<Atom>> clusters;
+
+    for (size_t i = 0; i < waters.size(); i++) {
+        int root = find_root((int)i);
+        if (clusterOf[root] == -1) {
+            clusterOf[root] = (int)clusters.size();
+            clusters.emplace_back();
+        }
+        clusters[clusterOf[root]].push_back(Atom("HOH", "O", waters[i].position, waters[i].bfactor));
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(),
+        [](const std::vector<Atom>& a, const std::vector<Atom>& b) {
+            return a.size() > b.size();
+        }
+    );
+
+    DEBUG_LOG("streamWaters: " << stats.chunks << " chunks, " << stats.waters << " waters, " << stats.surface << " surface");
+    return clusters;
+}
@@ -0,0 +1,299 @@
+#include "surface.h"
+
+#include "AtomicRadii.h"
+#include "common.h"
+#include "map.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <cstdio>
+
+
+// Evenly distributed unit vectors (golden spiral), reused for every atom with the same count
+static std::vector<Vec3> unitSpherePoints(int n) {
+    std::vector<Vec3> points;
+    points.reserve(n);
+
+    const float golden_angle = (float)(M_PI * (3.0 - std::sqrt(5.0)));
+
+    for (int k = 0; k < n; k++) {
+        float y = 1.0f - (2.0f * (k + 0.5f)) / n;
+        float r = std::sqrt(std::max(0.0f, 1.0f - y * y));
+        float theta = golden_angle * k;
+        points.push_back({r * std::cos(theta), y, r * std::sin(theta)});
+    }
+    return points;
+}
+
+std::vector<Vertex> generateSurfaceVertices(const std::vector<Atom>& atoms, float probeRadius, float density) {
+    TRACE_SPAN("generateSurfaceVertices");
+
+    // 1. Gather centers and radii (atoms without parameters have radius 0 and are skipped).
+    // These are the radius_ua column of AtomicRadii, not pdb_to_xyzr's radii (ALA CA 2.37 vs 2.00 A), so the
+    // surface sits further out than the MSMS ones in vert_files/ and does not reproduce their runs.
+    size_t n_atoms = atoms.size();
+    std::vector<Vec3> centers(n_atoms);
+    std::vector<float> radii(n_atoms);
+    float max_radius = 0.0f;
+
+    for (size_t i = 0; i < n_atoms; i++) {
+        std::array<double, 3> c = atoms[i].getCoords();
+        centers[i] = {(float)c[0], (float)c[1], (float)c[2]};
+        radii[i] = (float)getParams(atoms[i].get_resname(), atoms[i].get_atomname()).radius_ua;
+        max_radius = std::max(max_radius, radii[i]);
+    }
+
+    // 2. Neighbor lists: two atoms can share a probe if their expanded spheres intersect.
+    // A cell size of the maximum interaction distance keeps the search to a 3x3x3 stencil.
+    double cell_size = 2.0 * (max_radius + probeRadius);
+    if (cell_size <= 0.0) return {};
+
+    std::unordered_map<GridKey, std::vector<int>> grid = buildSpatialGrid(atoms, cell_size);
+
+    std::vector<std::vector<int>> neighbors(n_atoms);
+
+    parallelFor(n_atoms, [&](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            if (radii[i] <= 0.0f) continue;
+
+            GridKey k = getGridKey(atoms[i], cell_size);
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        auto it = grid.find({k.x + dx, k.y + dy, k.z + dz});
+                        if (it == grid.end()) continue;
+
+                        for (int j : it->second) {
+                            if ((size_t)j == i || radii[j] <= 0.0f) continue;
+                            float reach = radii[i] + radii[j] + 2.0f * probeRadius;
+                            if ((centers[i] - centers[j]).lengthSq() < reach * reach) {
+                                neighbors[i].push_back(j);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // 3. Accessible probe positions (SAS samples).
+    // One output buffer per chunk keeps the atom order stable across thread counts.
+    struct Probe {
+        Vec3 center;
+        Vec3 dir;
+        int atom;
+    };
+
+    std::vector<std::vector<Probe>> chunk_probes(parallelChunkCount(n_atoms));
+
+    parallelFor(n_atoms, [&](size_t begin, size_t end, unsigned int chunk) {
+        // sphere templates are cached per sample count, atoms share only a handful of radii
+        std::unordered_map<int, std::vector<Vec3>> sphere_cache;
+
+        for (size_t i = begin; i < end; i++) {
+            float r = radii[i];
+            if (r <= 0.0f) continue;
+
+            float expanded = r + probeRadius;
+            int n_samples = std::max(12, (int)std::ceil(density * 4.0f * (float)M_PI * expanded * expanded));
+
+            auto cached = sphere_cache.find(n_samples);
+            if (cached == sphere_cache.end()) {
+                cached = sphere_cache.emplace(n_samples, unitSpherePoints(n_samples)).first;
+            }
+
+            for (const Vec3& d : cached->second) {
+                Vec3 probe = centers[i] + d * expanded;
+
+                // a probe position is accessible if it does not penetrate any expanded neighbor
+                bool buried = false;
+                for (int j : neighbors[i]) {
+                    float rj = radii[j] + probeRadius;
+                    if ((probe - centers[j]).lengthSq() < rj * rj * 0.9999f) {
+                        buried = true;
+                        break;
+                    }
+                }
+                if (buried) continue;
+
+                chunk_probes[chunk].push_back({probe, d, (int)i});
+            }
+        }
+    });
+
+    std::vector<Probe> all_probes;
+    for (const auto& chunk : chunk_probes) {
+        all_probes.insert(all_probes.end(), chunk.begin(), chunk.end());
+    }
+
+    // 4. Like MSMS (without -all_components) only the external surface is kept, so buried
+    // cavities stay part of the interior and get filled later. Probe positions closer than the
+    // sampling step are joined; the component holding the outermost probe is the external one.
+    const double probe_cell = 2.0 * probeRadius;
+    const float link_distance = std::min(probeRadius, 1.5f / std::sqrt(density));
+
+    std::unordered_map<GridKey, std::vector<int>> link_grid;
+    for (int p = 0; p < (int)all_probes.size(); p++) {
+        const Vec3& c = all_probes[p].center;
+        link_grid[getGridKey_pos({c.x, c.y, c.z}, probe_cell)].push_back(p);
+    }
+
+    std::vector<int> parent(all_probes.size());
+    for (size_t p = 0; p < parent.size(); p++) parent[p] = (int)p;
+
+    auto find_root = [&](int p) {
+        while (parent[p] != p) {
+            parent[p] = parent[parent[p]];
+            p = parent[p];
+        }
+        return p;
+    };
+
+    int outermost = -1;
+    for (int p = 0; p < (int)all_probes.size(); p++) {
+        const Vec3& c = all_probes[p].center;
+        if (outermost < 0 || c.x > all_probes[outermost].center.x) outermost = p;
+
+        GridKey k = getGridKey_pos({c.x, c.y, c.z}, probe_cell);
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dz = -1; dz <= 1; dz++) {
+                    auto it = link_grid.find({k.x + dx, k.y + dy, k.z + dz});
+                    if (it == link_grid.end()) continue;
+
+                    for (int q : it->second) {
+                        if (q <= p) continue;
+                        if ((all_probes[q].center - c).lengthSq() < link_distance * link_distance) {
+                            parent[find_root(q)] = find_root(p);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<Probe> probes;
+    std::vector<Vertex> vertices;
+    if (outermost >= 0) {
+        int external = find_root(outermost);
+        for (int p = 0; p < (int)all_probes.size(); p++) {
+            if (find_root(p) != external) continue;
+
+            // contact vertex: where the probe touches its atom, normal points away from the atom
+            const Probe& probe = all_probes[p];
+            vertices.push_back({centers[probe.atom] + probe.dir * radii[probe.atom], probe.dir});
+            probes.push_back(probe);
+        }
+    }
+
+    // 5. Reentrant vertices. The SES is the inner boundary of the union of all accessible probe
+    // balls, so every point of a probe sphere that faces an atom the probe touches and is not
+    // swallowed by a neighboring probe ball lies on the surface. Its normal points toward the probe.
+    std::unordered_map<GridKey, std::vector<int>> probe_grid;
+    for (int p = 0; p < (int)probes.size(); p++) {
+        const Vec3& c = probes[p].center;
+        probe_grid[getGridKey_pos({c.x, c.y, c.z}, probe_cell)].push_back(p);
+    }
+
+    const std::vector<Vec3> probe_dirs = unitSpherePoints(
+        std::max(12, (int)std::ceil(density * 4.0f * (float)M_PI * probeRadius * probeRadius)));
+    const float touch_tolerance = 0.5f / std::sqrt(density);
+    const float covered_sq = (probeRadius * 0.98f) * (probeRadius * 0.98f);
+
+    std::vector<std::vector<Vertex>> chunk_reentrant(parallelChunkCount(probes.size()));
+
+    parallelFor(probes.size(), [&](size_t begin, size_t end, unsigned int chunk) {
+        std::vector<int> touched;
+        std::vector<Vec3> overlapping;
+
+        for (size_t p = begin; p < end; p++) {
+            const Vec3& center = probes[p].center;
+            int owner = probes[p].atom;
+
+            touched.clear();
+            touched.push_back(owner);
+            for (int j : neighbors[owner]) {
+                float reach = radii[j] + probeRadius + touch_tolerance;
+                if ((center - centers[j]).lengthSq() < reach * reach) {
+                    touched.push_back(j);
+                }
+            }
+            // probes touching a single atom only contribute the contact vertex
+            if (touched.size() < 2) continue;
+
+            overlapping.clear();
+            GridKey k = getGridKey_pos({center.x, center.y, center.z}, probe_cell);
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        auto it = probe_grid.find({k.x + dx, k.y + dy, k.z + dz});
+                        if (it == probe_grid.end()) continue;
+
+                        for (int q : it->second) {
+                            if ((size_t)q == p) continue;
+                            float dist_sq = (probes[q].center - center).lengthSq();
+                            if (dist_sq < 4.0f * probeRadius * probeRadius) {
+                                overlapping.push_back(probes[q].center);
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (const Vec3& u : probe_dirs) {
+                bool faces_atom = false;
+                for (int a : touched) {
+                    if (u.dot(centers[a] - center) > 0.0f) {
+                        faces_atom = true;
+                        break;
+                    }
+                }
+                if (!faces_atom) continue;
+
+                Vec3 pos = center + u * probeRadius;
+
+                bool covered = false;
+                for (const Vec3& other : overlapping) {
+                    if ((pos - other).lengthSq() < covered_sq) {
+                        covered = true;
+                        break;
+                    }
+                }
+                if (covered) continue;
+
+                chunk_reentrant[chunk].push_back({pos, u * -1.0f});
+            }
+        }
+    });
+
+    for (const auto& chunk : chunk_reentrant) {
+        vertices.insert(vertices.end(), chunk.begin(), chunk.end());
+    }
+
+    DEBUG_LOG("generateSurfaceVertices: " << vertices.size() << " vertices, " << probes.size() << " probe positions");
+
+    return vertices;
+}
+
+void writeVertFile(const std::vector<Vertex>& vertices, const std::string& filename, float probeRadius, float density, size_t sphereCount) {
+    TRACE_SPAN("writeVertFile");
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open file %s for writing.\n", filename.c_str());
+        return;
+    }
+
+    // MSMS header: the readers skip the first 3 lines
+    fprintf(file, "# solvent excluded surface vertices generated by allwaters\n");
+    fprintf(file, "#vertex #sphere density probe_r\n");
+    fprintf(file, "%7zu %7zu %5.2f %5.2f\n", vertices.size(), sphereCount, density, probeRadius);
+
+    for (const auto& v : vertices) {
+        fprintf(file, "%9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %7d %7d %2d\n",
+            v.position.x, v.position.y, v.position.z,
+            v.normal.x, v.normal.y, v.normal.z,
+            0, 0, 0);
+    }
+
+    fclose(file);
+}
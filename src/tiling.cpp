@@ -0,0 +1,279 @@
+#include "tiling.h"
+
+#include "common.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+
+enum CellState : uint8_t {
+    CELL_FREE = 0,
+    CELL_WALL = 1,
+    CELL_SEED = 2
+};
+
+// Connected components of the non-wall cells of one slab
+struct SlabLabels {
+    int zBegin = 0;
+    int zEnd = 0;
+    std::vector<int32_t> labels;   // per cell, -1 for walls
+    std::vector<uint8_t> hasSeed;  // per component
+};
+
+TilePlan planTiles(Vec3 minBound, Vec3 maxBound, float spacing, size_t maxMemoryBytes) {
+    TilePlan plan;
+    plan.dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing)) + 1;
+    plan.dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing)) + 1;
+    plan.dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing)) + 1;
+
+    size_t sliceBytes = (size_t)plan.dimX * plan.dimY * TILE_BYTES_PER_CELL;
+
+    // Prefer one slab per thread, but never let slabs get thinner than a few slices:
+    // thin slabs mostly cost extra border stitching.
+    const size_t min_thickness = 8;
+    size_t budget_slices = std::max<size_t>(1, maxMemoryBytes / sliceBytes);
+
+    plan.concurrent = (unsigned int)std::max<size_t>(1, std::min<size_t>(getThreadCount(), budget_slices / min_thickness));
+    size_t thickness = std::max<size_t>(1, budget_slices / plan.concurrent);
+
+    plan.slabThickness = (int)std::min<size_t>(thickness, plan.dimZ);
+    plan.slabCount = (plan.dimZ + plan.slabThickness - 1) / plan.slabThickness;
+
+    if (budget_slices == 1 && sliceBytes > maxMemoryBytes) {
+        std::cerr << "WARNING: a single grid slice needs " << sliceBytes / (1024 * 1024)
+                  << " MB, more than the memory budget" << std::endl;
+    }
+
+    return plan;
+}
+
+static void labelSlab(
+    const std::vector<Vertex>& surfaceVertices,
+    Vec3 minBound,
+    float spacing,
+    float searchRadius,
+    const TilePlan& plan,
+    int classifyDimX,
+    int classifyDimY,
+    int classifyDimZ,
+    SlabLabels& slab
+) {
+    TRACE_SPAN("labelSlab");
+    size_t plane = (size_t)plan.dimX * plan.dimY;
+    int thickness = slab.zEnd - slab.zBegin;
+    size_t slabCells = plane * thickness;
+
+    // 1. Classify the slab exactly like SeparateGridPoints, with the extra fill layer walled off
+    //    as in FillInternalVoid
+    std::vector<uint8_t> state(slabCells, CELL_FREE);
+    for (int z = slab.zBegin; z < slab.zEnd; z++) {
+        size_t slice = (size_t)(z - slab.zBegin) * plane;
+        if (z == plan.dimZ - 1) {
+            std::fill(state.begin() + slice, state.begin() + slice + plane, CELL_WALL);
+            continue;
+        }
+        for (int y = 0; y < plan.dimY; y++) state[slice + (size_t)y * plan.dimX + (plan.dimX - 1)] = CELL_WALL;
+        for (int x = 0; x < plan.dimX; x++) state[slice + (size_t)(plan.dimY - 1) * plan.dimX + x] = CELL_WALL;
+    }
+    {
+        int zEnd = std::min(slab.zEnd, classifyDimZ);
+        if (zEnd > slab.zBegin) {
+            size_t classifyPlane = (size_t)classifyDimX * classifyDimY;
+            std::vector<GridCellInfo> grid(classifyPlane * (zEnd - slab.zBegin));
+
+            ScatterNearestVertex(surfaceVertices, minBound, classifyDimX, classifyDimY, slab.zBegin, zEnd,
+                                 spacing, searchRadius, grid);
+
+            for (int z = slab.zBegin; z < zEnd; z++) {
+                for (int y = 0; y < classifyDimY; y++) {
+                    for (int x = 0; x < classifyDimX; x++) {
+                        const GridCellInfo& cell = grid[(size_t)(z - slab.zBegin) * classifyPlane + (size_t)y * classifyDimX + x];
+                        if (cell.closestVertexIndex == -1) continue;
+
+                        Vec3 test_point;
+                        test_point.x = minBound.x + (x * spacing);
+                        test_point.y = minBound.y + (y * spacing);
+                        test_point.z = minBound.z + (z * spacing);
+
+                        const Vertex& closestVert = surfaceVertices[cell.closestVertexIndex];
+                        float dotproduct = closestVert.normal.dot(test_point - closestVert.position);
+
+                        state[(size_t)(z - slab.zBegin) * plane + (size_t)y * plan.dimX + x] =
+                            dotproduct < 0 ? CELL_SEED : CELL_WALL;
+                    }
+                }
+            }
+        }
+    }
+
+    // 2. Label the connected free/seed regions inside the slab (6-connectivity)
+    slab.labels.assign(slabCells, -1);
+    slab.hasSeed.clear();
+
+    const int dx[6] = {1, -1, 0, 0, 0, 0};
+    const int dy[6] = {0, 0, 1, -1, 0, 0};
+    const int dz[6] = {0, 0, 0, 0, 1, -1};
+
+    std::vector<int64_t> queue;
+
+    for (size_t start = 0; start < slabCells; start++) {
+        if (state[start] == CELL_WALL || slab.labels[start] != -1) continue;
+
+        int32_t label = (int32_t)slab.hasSeed.size();
+        uint8_t seeded = 0;
+
+        queue.clear();
+        queue.push_back((int64_t)start);
+        slab.labels[start] = label;
+
+        for (size_t head = 0; head < queue.size(); head++) {
+            int64_t idx = queue[head];
+            if (state[idx] == CELL_SEED) seeded = 1;
+
+            int cz = (int)(idx / plane);
+            int64_t rem = idx % plane;
+            int cy = (int)(rem / plan.dimX);
+            int cx = (int)(rem % plan.dimX);
+
+            for (int n = 0; n < 6; n++) {
+                int nx = cx + dx[n];
+                int ny = cy + dy[n];
+                int nz = cz + dz[n];
+                if (nx < 0 || nx >= plan.dimX || ny < 0 || ny >= plan.dimY || nz < 0 || nz >= thickness) continue;
+
+                int64_t nIdx = (int64_t)nz * plane + (int64_t)ny * plan.dimX + nx;
+                if (state[nIdx] == CELL_WALL || slab.labels[nIdx] != -1) continue;
+
+                slab.labels[nIdx] = label;
+                queue.push_back(nIdx);
+            }
+        }
+        slab.hasSeed.push_back(seeded);
+    }
+}
+
+void FillInternalVoidTiled(
+    const std::vector<Vertex>& surfaceVertices,
+    Vec3 minBound,
+    Vec3 maxBound,
+    float spacing,
+    float searchRadius,
+    const TilePlan& plan,
+    const std::function<void(int slab, std::vector<Vec3>& points)>& onSlab
+) {
+    TRACE_SPAN("FillInternalVoidTiled");
+    int classifyDimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing));
+    int classifyDimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing));
+    int classifyDimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing));
+
+    size_t plane = (size_t)plan.dimX * plan.dimY;
+
+    // union-find over global component ids (slab offset + local label)
+    std::vector<int64_t> parent;
+    std::vector<uint8_t> seeded;
+    std::vector<int64_t> slabOffset(plan.slabCount, 0);
+
+    auto find_root = [&](int64_t c) {
+        while (parent[c] != c) {
+            parent[c] = parent[parent[c]];
+            c = parent[c];
+        }
+        return c;
+    };
+
+    auto unite = [&](int64_t a, int64_t b) {
+        a = find_root(a);
+        b = find_root(b);
+        if (a == b) return;
+        if (b < a) std::swap(a, b);
+        parent[b] = a;
+        seeded[a] = seeded[a] | seeded[b];
+    };
+
+    // --- PASS 1: LABEL SLABS AND STITCH BORDERS ---
+    std::vector<int64_t> previousPlane;   // global ids of the last slice of the previous slab
+
+    for (int groupBegin = 0; groupBegin < plan.slabCount; groupBegin += plan.concurrent) {
+        int groupEnd = std::min(plan.slabCount, groupBegin + (int)plan.concurrent);
+        std::vector<SlabLabels> group(groupEnd - groupBegin);
+
+        for (int s = groupBegin; s < groupEnd; s++) {
+            group[s - groupBegin].zBegin = s * plan.slabThickness;
+            group[s - groupBegin].zEnd = std::min(plan.dimZ, (s + 1) * plan.slabThickness);
+        }
+
+        parallelFor(group.size(), [&](size_t begin, size_t end, unsigned int) {
+            for (size_t g = begin; g < end; g++) {
+                labelSlab(surfaceVertices, minBound, spacing, searchRadius, plan,
+                          classifyDimX, classifyDimY, classifyDimZ, group[g]);
+            }
+        });
+
+        for (int s = groupBegin; s < groupEnd; s++) {
+            SlabLabels& slab = group[s - groupBegin];
+
+            slabOffset[s] = (int64_t)parent.size();
+            for (size_t c = 0; c < slab.hasSeed.size(); c++) {
+                parent.push_back(slabOffset[s] + (int64_t)c);
+                seeded.push_back(slab.hasSeed[c]);
+            }
+
+            if (!previousPlane.empty()) {
+                for (size_t i = 0; i < plane; i++) {
+                    int32_t label = slab.labels[i];
+                    if (label >= 0 && previousPlane[i] >= 0) {
+                        unite(previousPlane[i], slabOffset[s] + label);
+                    }
+                }
+            }
+
+            size_t last = (size_t)(slab.zEnd - slab.zBegin - 1) * plane;
+            previousPlane.assign(plane, -1);
+            for (size_t i = 0; i < plane; i++) {
+                int32_t label = slab.labels[last + i];
+                if (label >= 0) previousPlane[i] = slabOffset[s] + label;
+            }
+
+            PRINT_LOG("tile " << s + 1 << "/" << plan.slabCount << ": " << slab.hasSeed.size() << " components");
+        }
+    }
+
+    // --- PASS 2: RECOMPUTE SLABS AND EMIT FILLED CELLS ---
+    // Labels are deterministic, so the local ids match pass 1 and map through slabOffset.
+    for (int groupBegin = 0; groupBegin < plan.slabCount; groupBegin += plan.concurrent) {
+        int groupEnd = std::min(plan.slabCount, groupBegin + (int)plan.concurrent);
+        std::vector<std::vector<Vec3>> points(groupEnd - groupBegin);
+
+        parallelFor(points.size(), [&](size_t begin, size_t end, unsigned int) {
+            for (size_t g = begin; g < end; g++) {
+                int s = groupBegin + (int)g;
+
+                SlabLabels slab;
+                slab.zBegin = s * plan.slabThickness;
+                slab.zEnd = std::min(plan.dimZ, (s + 1) * plan.slabThickness);
+                labelSlab(surfaceVertices, minBound, spacing, searchRadius, plan,
+                          classifyDimX, classifyDimY, classifyDimZ, slab);
+
+                // read-only walk to the root, so slabs can share the union-find across threads
+                std::vector<uint8_t> filled(slab.hasSeed.size());
+                for (size_t c = 0; c < filled.size(); c++) {
+                    int64_t root = slabOffset[s] + (int64_t)c;
+                    while (parent[root] != root) root = parent[root];
+                    filled[c] = seeded[root];
+                }
+
+                for (size_t i = 0; i < slab.labels.size(); i++) {
+                    int32_t label = slab.labels[i];
+                    if (label < 0 || !filled[label]) continue;
+
+                    int64_t globalIdx = (int64_t)slab.zBegin * plane + (int64_t)i;
+                    points[g].push_back(indextoVec3(globalIdx, plan.dimX, plan.dimY, plan.dimZ, minBound, spacing));
+                }
+            }
+        });
+
+        for (int s = groupBegin; s < groupEnd; s++) {
+            onSlab(s, points[s - groupBegin]);
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+struct TraceEvent {
+    std::string name;
+    int64_t start;
+    int64_t duration;
+};
+
+// Spans of one thread; kept alive by the registry after the thread exits
+struct TraceThread {
+    int id;
+    std::string name;
+    std::vector<TraceEvent> events;
+    std::mutex mutex;   // uncontended except while writeTrace reads
+};
+
+static std::mutex g_registryMutex;
+static std::vector<std::shared_ptr<TraceThread>> g_threads;
+static const auto g_traceEpoch = std::chrono::steady_clock::now();
+// static initialization runs on the main thread
+static const std::thread::id g_mainThread = std::this_thread::get_id();
+
+static int64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_traceEpoch).count();
+}
+
+static TraceThread& currentThread() {
+    thread_local std::shared_ptr<TraceThread> thread;
+    if (!thread) {
+        thread = std::make_shared<TraceThread>();
+        std::lock_guard<std::mutex> lock(g_registryMutex);
+        thread->id = (int)g_threads.size();
+        thread->name = std::this_thread::get_id() == g_mainThread ? "main" : "thread " + std::to_string(thread->id);
+        g_threads.push_back(thread);
+    }
+    return *thread;
+}
+
+TraceSpan::TraceSpan(std::string init_name) : name(std::move(init_name)), start(traceNow()) {}
+
+TraceSpan::~TraceSpan() {
+    int64_t end = traceNow();
+    TraceThread& thread = currentThread();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    thread.events.push_back({std::move(name), start, end - start});
+}
+
+void traceThreadName(const std::string& name) {
+    TraceThread& thread = currentThread();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    thread.name = name;
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    return out + "\"";
+}
+
+TraceFile::~TraceFile() {
+    if (writeTrace(path)) std::printf("-> Trace written to %s\n", path.c_str());
+}
+
+bool writeTrace(const std::string& filename) {
+    FILE* pFile = fopen(filename.c_str(), "w");
+    if (pFile == NULL) {
+        std::fprintf(stderr, "Error: Could not open %s for writing.\n", filename.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> registryLock(g_registryMutex);
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const std::shared_ptr<TraceThread>& thread : g_threads) {
+        std::lock_guard<std::mutex> lock(thread->mutex);
+        fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":%s}}",
+                first ? "" : ",\n", thread->id, jsonString(thread->name).c_str());
+        first = false;
+        for (const TraceEvent& event : thread->events) {
+            fprintf(pFile, ",\n{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                    jsonString(event.name).c_str(), thread->id, (long long)event.start, (long long)event.duration);
+        }
+    }
+    fprintf(pFile, "\n]}\n");
+
+    bool ok = !ferror(pFile);
+    fclose(pFile);
+    return ok;
+}
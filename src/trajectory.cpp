@@ -0,0 +1,525 @@
+#include "trajectory.h"
+
+#include "AtomicRadii.h"
+#include "common.h"
+#include "compress.h"
+#include "mmcif.h"
+#include "morphology.h"
+#include "parallel.h"
+#include "pdbtovector.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+#include <limits>
+#include <numeric>
+#include <sstream>
+
+
+// edge of the bricks the probe closing is recomputed in
+static const int BRICK = 8;
+
+size_t firstModelAtomCount(const std::string& pdbFile) {
+    if (isCIFFile(pdbFile)) {
+        std::vector<AtomSiteIdentity> identities;
+        readAtomSiteCIF(pdbFile, &identities);
+        size_t count = 0;
+        while (count < identities.size() && identities[count].model == identities[0].model) count++;
+        return count;
+    }
+
+    std::unique_ptr<std::istream> infile = openInputStream(pdbFile);
+    std::string line;
+    size_t count = 0;
+
+    while (infile && std::getline(*infile, line)) {
+        if (line.compare(0, 6, "ENDMDL") == 0) break;
+        if (line.compare(0, 4, "ATOM") == 0 || line.compare(0, 6, "HETATM") == 0) count++;
+    }
+    if (!infile || infile->bad()) {
+        std::cerr << "Error: Could not read " << pdbFile << " (corrupt or truncated)" << std::endl;
+        return 0;
+    }
+    return count;
+}
+
+TrajectoryReader::TrajectoryReader(const std::string& path, size_t init_atomCount) : atomCount(init_atomCount) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    binary = !(extension == ".pdb" || extension == ".ent");
+    file.open(path, binary ? std::ios::binary : std::ios::in);
+}
+
+bool TrajectoryReader::next(std::vector<std::array<double, 3>>& coords) {
+    if (!file.is_open() || !errorMessage.empty()) return false;
+    coords.clear();
+
+    if (binary) {
+        std::vector<float> buffer(atomCount * 3);
+        size_t frameBytes = buffer.size() * sizeof(float);
+
+        file.read(reinterpret_cast<char*>(buffer.data()), (std::streamsize)frameBytes);
+        size_t got = (size_t)file.gcount();
+        if (got == 0) return false;
+        if (got != frameBytes) {
+            errorMessage = "frame " + std::to_string(frameCount + 1) + " is truncated (" + std::to_string(got) +
+                           " of " + std::to_string(frameBytes) + " bytes)";
+            return false;
+        }
+
+        coords.resize(atomCount);
+        for (size_t i = 0; i < atomCount; i++) {
+            coords[i] = {buffer[3 * i], buffer[3 * i + 1], buffer[3 * i + 2]};
+        }
+    } else {
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, 6, "ENDMDL") == 0) {
+                if (!coords.empty()) break;
+                continue;
+            }
+            if (line.compare(0, 4, "ATOM") == 0 || line.compare(0, 6, "HETATM") == 0) {
+                coords.push_back(get_coords(line));
+            }
+        }
+        if (coords.empty()) return false;
+
+        if (coords.size() != atomCount) {
+            errorMessage = "frame " + std::to_string(frameCount + 1) + " has " + std::to_string(coords.size()) +
+                           " atoms, expected " + std::to_string(atomCount);
+            return false;
+        }
+    }
+
+    frameCount++;
+    return true;
+}
+
+TrajectoryGrid::TrajectoryGrid(const std::vector<Atom>& atoms, Vec3 init_minBound, Vec3 init_maxBound,
+                               const TrajectorySettings& init_settings) :
+    settings(init_settings),
+    minBound(init_minBound),
+    maxBound(init_maxBound)
+{
+    float spacing = settings.spacing;
+
+    // same lattice as FillInternalVoid
+    dimX = static_cast<int>(std::ceil((maxBound.x - minBound.x) / spacing)) + 1;
+    dimY = static_cast<int>(std::ceil((maxBound.y - minBound.y) / spacing)) + 1;
+    dimZ = static_cast<int>(std::ceil((maxBound.z - minBound.z) / spacing)) + 1;
+    slice = (size_t)dimX * dimY;
+    size_t totalCells = slice * dimZ;
+
+    atomCover.assign(totalCells, 0);
+    clashCover.assign(totalCells, 0);
+    excluded.assign(totalCells, 0);
+    reached.assign(totalCells, 0);
+    occupancy.assign(totalCells, 0);
+
+    // indextoVec3 rounds minBound + i * spacing (in double) to float, the overlap pass sees that float
+    auto axis = [&](float origin, int dim, std::vector<float>& coord) {
+        coord.resize(dim);
+        for (int i = 0; i < dim; i++) {
+            coord[i] = (float)(origin + ((double)i * spacing));
+        }
+    };
+    axis(minBound.x, dimX, coordX);
+    axis(minBound.y, dimY, coordY);
+    axis(minBound.z, dimZ, coordZ);
+
+    // radius lookups are string maps, so resolve them once
+    reference.resize(atoms.size());
+    coverRadius.resize(atoms.size());
+    clashRadius.resize(atoms.size());
+    topologyMargin = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < atoms.size(); i++) {
+        AtomParams params = getParams(atoms[i].get_resname(), atoms[i].get_atomname());
+        reference[i] = atoms[i].getCoords();
+        coverRadius[i] = (float)params.radius_ua;
+        clashRadius[i] = settings.waterDiameter / 2.0 + params.radius_aa;
+        topologyMargin = std::min(topologyMargin, faceDistance(reference[i]));
+    }
+    stencil = makeOverlapStencil(atoms, settings.waterDiameter, settings.cutoffDistance, settings.hashSpacing);
+    hashGrid = buildSpatialGrid(atoms, stencil.cellSize);
+
+    bricksX = (dimX + BRICK - 1) / BRICK;
+    bricksY = (dimY + BRICK - 1) / BRICK;
+    bricksZ = (dimZ + BRICK - 1) / BRICK;
+    dirtyBricks.assign((size_t)bricksX * bricksY * bricksZ, 0);
+
+    std::vector<int> all(atoms.size());
+    std::iota(all.begin(), all.end(), 0);
+    stampAtoms(all, nullptr);
+    refreshExcluded();
+}
+
+void TrajectoryGrid::stampAtoms(const std::vector<int>& atoms, const std::vector<std::array<double, 3>>* previous) {
+    float spacing = settings.spacing;
+
+    // Each thread owns a range of brick layers, so neither the counts nor the brick flags collide
+    parallelFor(bricksZ, [&](size_t layerBegin, size_t layerEnd, unsigned int) {
+        int zBegin = (int)layerBegin * BRICK;
+        int zEnd = std::min(dimZ, (int)layerEnd * BRICK);
+
+        auto changed = [&](int x, int y, int z) {
+            dirtyBricks[((size_t)(z / BRICK) * bricksY + (y / BRICK)) * bricksX + (x / BRICK)] = 1;
+        };
+
+        // united atom sphere, rasterized exactly like SeparateGridPointsMorphology
+        auto cover = [&](const std::array<double, 3>& pos, int a, int delta) {
+            Vec3 c = {(float)pos[0], (float)pos[1], (float)pos[2]};
+            float r = coverRadius[a];
+            if (r <= 0.0f) return;
+
+            int z0 = std::max(zBegin, (int)std::ceil((c.z - r - minBound.z) / spacing));
+            int z1 = std::min(zEnd - 1, (int)std::floor((c.z + r - minBound.z) / spacing));
+            if (z0 > z1) return;
+
+            int y0 = std::max(0, (int)std::ceil((c.y - r - minBound.y) / spacing));
+            int y1 = std::min(dimY - 1, (int)std::floor((c.y + r - minBound.y) / spacing));
+            int x0 = std::max(0, (int)std::ceil((c.x - r - minBound.x) / spacing));
+            int x1 = std::min(dimX - 1, (int)std::floor((c.x + r - minBound.x) / spacing));
+
+            float rSq = r * r;
+            for (int z = z0; z <= z1; z++) {
+                float dz = minBound.z + z * spacing - c.z;
+                for (int y = y0; y <= y1; y++) {
+                    float dy = minBound.y + y * spacing - c.y;
+                    for (int x = x0; x <= x1; x++) {
+                        float dx = minBound.x + x * spacing - c.x;
+                        if (dx * dx + dy * dy + dz * dz > rSq) continue;
+
+                        uint16_t& count = atomCover[(size_t)z * slice + (size_t)y * dimX + x];
+                        if (delta > 0) {
+                            if (count++ == 0) changed(x, y, z);
+                        } else {
+                            if (--count == 0) changed(x, y, z);
+                        }
+                    }
+                }
+            }
+        };
+
+        // water clash sphere, with getOverlap_cluster's test
+        auto clash = [&](const std::array<double, 3>& pos, int a, int delta) {
+            double r = clashRadius[a];
+            double rSq = r * r;
+
+            // one cell of slack on each side, the distance test decides
+            int z0 = std::max(zBegin, (int)std::floor((pos[2] - r - minBound.z) / spacing));
+            int z1 = std::min(zEnd - 1, (int)std::ceil((pos[2] + r - minBound.z) / spacing));
+            int y0 = std::max(0, (int)std::floor((pos[1] - r - minBound.y) / spacing));
+            int y1 = std::min(dimY - 1, (int)std::ceil((pos[1] + r - minBound.y) / spacing));
+            int x0 = std::max(0, (int)std::floor((pos[0] - r - minBound.x) / spacing));
+            int x1 = std::min(dimX - 1, (int)std::ceil((pos[0] + r - minBound.x) / spacing));
+
+            for (int z = z0; z <= z1; z++) {
+                double dZ = coordZ[z] - pos[2];
+                for (int y = y0; y <= y1; y++) {
+                    double dY = coordY[y] - pos[1];
+                    for (int x = x0; x <= x1; x++) {
+                        double dX = coordX[x] - pos[0];
+                        if ((dX*dX) + (dY*dY) + (dZ*dZ) > rSq) continue;
+
+                        clashCover[(size_t)z * slice + (size_t)y * dimX + x] += delta;
+                    }
+                }
+            }
+        };
+
+        for (int a : atoms) {
+            if (previous) {
+                cover((*previous)[a], a, -1);
+                clash((*previous)[a], a, -1);
+            }
+            cover(reference[a], a, 1);
+            clash(reference[a], a, 1);
+        }
+    });
+}
+
+void TrajectoryGrid::closeWindow(int x0, int y0, int z0, int x1, int y1, int z1, bool parallel) {
+    // Cells of [x0, x1) x [y0, y1) x [z0, z1) only see atom cover within two probe radii: the dilation
+    // reaches one probe radius, the erosion of the dilated region another. Anything the window misses
+    // is farther than the probe from the core, so the core comes out as in the full grid transform.
+    int halo = 2 * (int)std::ceil(settings.probeRadius / settings.spacing);
+    int wx0 = std::max(0, x0 - halo), wx1 = std::min(dimX, x1 + halo);
+    int wy0 = std::max(0, y0 - halo), wy1 = std::min(dimY, y1 + halo);
+    int wz0 = std::max(0, z0 - halo), wz1 = std::min(dimZ, z1 + halo);
+    int wX = wx1 - wx0, wY = wy1 - wy0, wZ = wz1 - wz0;
+
+    auto local = [&](int x, int y, int z) {
+        return ((size_t)(z - wz0) * wY + (size_t)(y - wy0)) * wX + (size_t)(x - wx0);
+    };
+
+    std::vector<uint8_t> mask((size_t)wX * wY * wZ);
+    for (int z = wz0; z < wz1; z++) {
+        for (int y = wy0; y < wy1; y++) {
+            for (int x = wx0; x < wx1; x++) {
+                mask[local(x, y, z)] = atomCover[(size_t)z * slice + (size_t)y * dimX + x] > 0;
+            }
+        }
+    }
+
+    // same closing as SeparateGridPointsMorphology PHASE 2
+    float probeSq = (settings.probeRadius / settings.spacing) * (settings.probeRadius / settings.spacing);
+    {
+        std::vector<float> dist = squaredDistanceTransform(mask, wX, wY, wZ, parallel);
+        for (size_t i = 0; i < mask.size(); i++) {
+            mask[i] = dist[i] <= probeSq ? 0 : 1; // 1 = outside the dilated atoms
+        }
+    }
+
+    std::vector<float> dist = squaredDistanceTransform(mask, wX, wY, wZ, parallel);
+    for (int z = z0; z < z1; z++) {
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                excluded[(size_t)z * slice + (size_t)y * dimX + x] = dist[local(x, y, z)] > probeSq ? 1 : 0;
+            }
+        }
+    }
+}
+
+void TrajectoryGrid::refreshExcluded() {
+    // A cover change reaches two probe radii (dilation, then erosion), so every dirty brick
+    // reopens the brick plus that reach. Overlapping regions are merged until they are disjoint.
+    int reach = 2 * (int)std::ceil(settings.probeRadius / settings.spacing);
+
+    struct Box { int x0, y0, z0, x1, y1, z1; };
+    std::vector<Box> boxes;
+
+    for (size_t b = 0; b < dirtyBricks.size(); b++) {
+        if (!dirtyBricks[b]) continue;
+
+        int x = (int)(b % bricksX) * BRICK;
+        int y = (int)((b / bricksX) % bricksY) * BRICK;
+        int z = (int)(b / ((size_t)bricksX * bricksY)) * BRICK;
+        boxes.push_back({std::max(0, x - reach), std::max(0, y - reach), std::max(0, z - reach),
+                         std::min(dimX, x + BRICK + reach), std::min(dimY, y + BRICK + reach), std::min(dimZ, z + BRICK + reach)});
+    }
+    if (boxes.empty()) return;
+
+    excludedChanged = true;
+    std::fill(dirtyBricks.begin(), dirtyBricks.end(), 0);
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            for (size_t j = i + 1; j < boxes.size(); j++) {
+                Box& a = boxes[i];
+                const Box& b = boxes[j];
+                if (a.x0 >= b.x1 || b.x0 >= a.x1 || a.y0 >= b.y1 || b.y0 >= a.y1 || a.z0 >= b.z1 || b.z0 >= a.z1) continue;
+
+                a = {std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::min(a.z0, b.z0),
+                     std::max(a.x1, b.x1), std::max(a.y1, b.y1), std::max(a.z1, b.z1)};
+                boxes.erase(boxes.begin() + j);
+                merged = true;
+                j = i;
+            }
+        }
+    }
+
+    if (boxes.size() == 1) {
+        const Box& b = boxes[0];
+        closeWindow(b.x0, b.y0, b.z0, b.x1, b.y1, b.z1, true);
+    } else {
+        // disjoint boxes, one transform per worker
+        parallelFor(boxes.size(), [&](size_t begin, size_t end, unsigned int) {
+            for (size_t k = begin; k < end; k++) {
+                const Box& b = boxes[k];
+                closeWindow(b.x0, b.y0, b.z0, b.x1, b.y1, b.z1, false);
+            }
+        });
+    }
+
+    DEBUG_LOG("TrajectoryGrid: closed " << boxes.size() << " regions");
+}
+
+void TrajectoryGrid::floodSolvent() {
+    // Same result as SeparateGridPointsMorphology PHASE 3 (solvent the box border cannot reach is a
+    // cavity), filled a run of x cells at a time since most of the box is open solvent.
+    std::fill(reached.begin(), reached.end(), 0);
+
+    struct Seed { int x, y, z; };
+    std::vector<Seed> stack;
+
+    auto open = [&](size_t i) { return !excluded[i] && !reached[i]; };
+
+    for (int z = 0; z < dimZ; z++) {
+        for (int y = 0; y < dimY; y++) {
+            bool borderRow = (y == 0 || z == 0 || y == dimY - 1 || z == dimZ - 1);
+            if (borderRow) {
+                for (int x = 0; x < dimX; x++) stack.push_back({x, y, z});
+            } else {
+                stack.push_back({0, y, z});
+                stack.push_back({dimX - 1, y, z});
+            }
+        }
+    }
+
+    while (!stack.empty()) {
+        Seed seed = stack.back();
+        stack.pop_back();
+
+        size_t row = (size_t)seed.z * slice + (size_t)seed.y * dimX;
+        if (!open(row + seed.x)) continue;
+
+        // widen to the whole run of open cells along x and mark it
+        int left = seed.x, right = seed.x;
+        while (left > 0 && open(row + left - 1)) left--;
+        while (right < dimX - 1 && open(row + right + 1)) right++;
+        std::fill(reached.begin() + row + left, reached.begin() + row + right + 1, 1);
+
+        // one seed per open run in the four neighboring rows
+        const int dy[4] = {1, -1, 0, 0};
+        const int dz[4] = {0, 0, 1, -1};
+        for (int n = 0; n < 4; n++) {
+            int ny = seed.y + dy[n], nz = seed.z + dz[n];
+            if (ny < 0 || ny >= dimY || nz < 0 || nz >= dimZ) continue;
+
+            size_t neighborRow = (size_t)nz * slice + (size_t)ny * dimX;
+            bool inRun = false;
+            for (int x = left; x <= right; x++) {
+                bool isOpen = open(neighborRow + x);
+                if (isOpen && !inRun) stack.push_back({x, ny, nz});
+                inRun = isOpen;
+            }
+        }
+    }
+
+    excludedChanged = false;
+}
+
+bool TrajectoryGrid::nearAtom(const std::array<double, 3>& p) const {
+    // the neighbor half of getOverlap_cluster, on the stamped positions
+    double cutoffSq = settings.cutoffDistance * settings.cutoffDistance;
+    GridKey center = getGridKey_pos(p, stencil.cellSize);
+
+    for (size_t k = 0; k < stencil.offsets.size(); k++) {
+        if (stencil.minDistance[k] > settings.cutoffDistance) break;
+
+        const GridKey& d = stencil.offsets[k];
+        auto it = hashGrid.find({center.x + d.x, center.y + d.y, center.z + d.z});
+        if (it == hashGrid.end()) continue;
+
+        for (int a : it->second) {
+            double dX = p[0] - reference[a][0];
+            double dY = p[1] - reference[a][1];
+            double dZ = p[2] - reference[a][2];
+            if ((dX*dX) + (dY*dY) + (dZ*dZ) <= cutoffSq) return true;
+        }
+    }
+    return false;
+}
+
+double TrajectoryGrid::faceDistance(const std::array<double, 3>& p) const {
+    return std::min({p[0] - minBound.x, p[1] - minBound.y, p[2] - minBound.z,
+                     maxBound.x - p[0], maxBound.y - p[1], maxBound.z - p[2]});
+}
+
+bool TrajectoryGrid::update(const std::vector<std::array<double, 3>>& coords, size_t& restamped, std::string& error) {
+    restamped = 0;
+    if (coords.size() != reference.size()) {
+        error = "frame has " + std::to_string(coords.size()) + " atoms, the topology " + std::to_string(reference.size());
+        return false;
+    }
+
+    // the box is fixed by the topology; an atom that drifts out of it would silently lose part of its stamps
+    for (size_t i = 0; i < coords.size(); i++) {
+        double reach = std::max((double)coverRadius[i] + settings.probeRadius, clashRadius[i]);
+        if (faceDistance(coords[i]) < std::min(reach, topologyMargin)) {
+            std::ostringstream message;
+            message << std::fixed << std::setprecision(3) << "atom " << i + 1 << " at (" << coords[i][0] << ", "
+                    << coords[i][1] << ", " << coords[i][2] << ") left the grid box of the topology ("
+                    << minBound.x << ", " << minBound.y << ", " << minBound.z << ") - (" << maxBound.x << ", "
+                    << maxBound.y << ", " << maxBound.z << "); align the frames to -p or give a topology covering them";
+            error = message.str();
+            return false;
+        }
+    }
+
+    double skinSq = settings.skin * settings.skin;
+    std::vector<int> moved;
+    for (size_t i = 0; i < coords.size(); i++) {
+        double dX = coords[i][0] - reference[i][0];
+        double dY = coords[i][1] - reference[i][1];
+        double dZ = coords[i][2] - reference[i][2];
+        if (dX*dX + dY*dY + dZ*dZ > skinSq) moved.push_back((int)i);
+    }
+    if (moved.empty()) return true;
+
+    std::vector<std::array<double, 3>> previous = reference;
+
+    for (int a : moved) {
+        GridKey oldKey = getGridKey_pos(reference[a], stencil.cellSize);
+        GridKey newKey = getGridKey_pos(coords[a], stencil.cellSize);
+
+        // keep the hash grid allocated, only move the atom between cells
+        if (!(oldKey == newKey)) {
+            std::vector<int>& cell = hashGrid[oldKey];
+            cell.erase(std::find(cell.begin(), cell.end(), a));
+            if (cell.empty()) hashGrid.erase(oldKey);
+            hashGrid[newKey].push_back(a);
+        }
+        reference[a] = coords[a];
+    }
+
+    stampAtoms(moved, &previous);
+    refreshExcluded();
+    restamped = moved.size();
+    return true;
+}
+
+size_t TrajectoryGrid::accumulate() {
+    if (excludedChanged) floodSolvent();
+    frameCount++;
+
+    // a water is a filled cell (excluded region or cavity) that survives the overlap pass
+    std::vector<size_t> counts(parallelChunkCount(dimZ), 0);
+    parallelFor(dimZ, [&](size_t zBegin, size_t zEnd, unsigned int chunk) {
+        for (size_t z = zBegin; z < zEnd; z++) {
+            for (int y = 0; y < dimY; y++) {
+                for (int x = 0; x < dimX; x++) {
+                    size_t i = z * slice + (size_t)y * dimX + x;
+                    if ((!excluded[i] && reached[i]) || clashCover[i] != 0) continue;
+                    if (!nearAtom({coordX[x], coordY[y], coordZ[z]})) continue;
+
+                    occupancy[i]++;
+                    counts[chunk]++;
+                }
+            }
+        }
+    });
+
+    return std::accumulate(counts.begin(), counts.end(), (size_t)0);
+}
+
+std::vector<Atom> TrajectoryGrid::sites(double minFraction) const {
+    std::vector<Atom> output;
+    if (frameCount == 0) return output;
+
+    for (size_t i = 0; i < occupancy.size(); i++) {
+        if (occupancy[i] == 0) continue;
+
+        double fraction = (double)occupancy[i] / frameCount;
+        if (fraction < minFraction) continue;
+
+        int z = (int)(i / slice);
+        int y = (int)((i % slice) / dimX);
+        int x = (int)(i % dimX);
+        output.push_back(Atom("HOH", "O", {coordX[x], coordY[y], coordZ[z]}, fraction));
+    }
+    return output;
+}
+
+bool TrajectoryGrid::writeDX(const std::string& filename) const {
+    double frames = frameCount > 0 ? (double)frameCount : 1.0;
+    return WriteDXMap(filename, "water occupancy (fraction of " + std::to_string(frameCount) + " frames)",
+                      dimX, dimY, dimZ, minBound, settings.spacing,
+                      [&](size_t i) { return occupancy[i] / frames; });
+}